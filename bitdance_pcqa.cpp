@@ -23,7 +23,9 @@
 #include <sstream>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <thread>
+#include <vector>
 
 
 #include <Open3D.h>
@@ -32,6 +34,7 @@
 #include <stdlib.h>
 
 #include "bitdance_pcqa.h"
+#include "spacing_estimator.h"
 
 #include "ColorSpace/ColorSpace.h"
 #include "ColorSpace/Comparison.h"
@@ -41,13 +44,32 @@
 using namespace open3d;
 using namespace std;
 
+// same as "optimize_voxel_size {2,3} k", on a PC already in memory
+static double estimate_voxel_size(const geometry::PointCloud &pc, double voxel_k, int voxel_strategy)
+{
+    geometry::KDTreeFlann kdtree;
+    kdtree.SetGeometry(pc);
+
+    spacing_estimate est = estimate_mean_spacing(pc, kdtree, voxel_strategy_knn(voxel_strategy));
+    double voxel_size = est.mean * voxel_k;
+
+    fprintf(stderr, "average distance = %0.16f (95%% CI [%0.16f, %0.16f], %zu of %zu points queried)\n",
+            est.mean, est.ci_low, est.ci_high, est.samples, pc.points_.size());
+    fprintf(stderr, "voxel size = %0.16f\n", voxel_size);
+
+    return voxel_size;
+}
+
 int main(int argc, char *argv[])
 {
     bool create_histogram = false;
     bool divide_color_by_255 = false;
     bool voxelize = false;
+    bool voxel_auto = false;
     bool split_files = false;
     double voxel_size = 0;
+    double voxel_k = 0;
+    int voxel_strategy = 3;
 
     int neiborhood_list_size = 0;
     int max_neiborhood_size = 0;
@@ -57,8 +79,9 @@ int main(int argc, char *argv[])
 
     char metrics_enabled_list[MAX_FILENAME] = {0};
     char neiborhood_sizes_list[MAX_FILENAME] = {0};
-    char input_filename[MAX_FILENAME] = {0};
+    vector<string> input_filenames;
     char histogram_filename[MAX_FILENAME] = {0};
+    char reference_filename[MAX_FILENAME] = {0};
 
 
     if (argc < 3){
@@ -66,21 +89,23 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Usage: %s [OPTIONS]\n", argv[0]);
         fprintf(stderr, "Usage example: %s -i input_pc.ply -n 12,11,10,9,8 -h fv_file_prot.csv -m 1,1,1,1,1\n", argv[0]);
         fprintf(stderr, "\nOPTIONS:\n");
-        fprintf(stderr, "    -i input_pc.ply         PC to be evaluated\n");
+        fprintf(stderr, "    -i input_pc.ply         PC to be evaluated (repeat \"-i\" to evaluate several PCs in one run)\n");
         fprintf(stderr, "    -h fv.csv               Save the feature vector as csv output (or use this paramenter as basename, in case \"-s\" is used).\n");
         fprintf(stderr, "    -n neiborhood_sizes_list Comma separated neiborhood size to test(eg: \"12,10,8\"\n");
         fprintf(stderr, "    -m metrics_enabled_list  Comma separated boolean values of the enabled metrics, in the following order: DE2000 12-bit, DE2000 8-bit, Geo 16-bit, Geo 12-bit, Geo 8-bit)\n");
         fprintf(stderr, "    -v voxel_size           Voxelize and use voxel size as specified\n");
+        fprintf(stderr, "    -v auto:k[:strategy]    Voxelize using \"k\" times the average NN (strategy 2) or 8-NN (strategy 3, default) distance, as optimize_voxel_size\n");
+        fprintf(stderr, "    -r reference_pc.ply     Compute the \"auto\" voxel size from this PC instead of the input ones (read once for all of them)\n");
         fprintf(stderr, "    -y                      Divide color attributes by 255\n");
         fprintf(stderr, "    -s                      Split results files (many output files!)\n");
         return EXIT_SUCCESS;
     }
 
     int opt;
-    while ((opt = getopt(argc, argv, "i:h:n:m:v:ys")) != -1){
+    while ((opt = getopt(argc, argv, "i:h:n:m:v:r:ys")) != -1){
         switch (opt){
         case 'i':
-            strncpy (input_filename, optarg, MAX_FILENAME);
+            input_filenames.push_back(optarg);
             break;
         case 's':
             split_files = true;
@@ -97,7 +122,20 @@ int main(int argc, char *argv[])
             break;
         case 'v':
             voxelize = true;
-            voxel_size = atof(optarg);
+            if (strncmp(optarg, "auto:", 5) == 0)
+            {
+                voxel_auto = true;
+                if (sscanf(optarg + 5, "%lf:%d", &voxel_k, &voxel_strategy) < 1)
+                {
+                    fprintf(stderr, "Wrong auto voxel size format: %s\n", optarg);
+                    goto usage_info;
+                }
+            }
+            else
+                voxel_size = atof(optarg);
+            break;
+        case 'r':
+            strncpy (reference_filename, optarg, MAX_FILENAME);
             break;
         case 'y':
             divide_color_by_255 = true;
@@ -111,12 +149,30 @@ int main(int argc, char *argv[])
 
 // COMMAND LINE PARSING //
 
+    if (input_filenames.empty())
+    {
+        fprintf(stderr, "Specify at least one input PC.\n");
+        goto usage_info;
+    }
+
     if (neiborhood_sizes_list[0] == 0)
     {
         fprintf(stderr, "Specify at least one neighbour size.\n");
         goto usage_info;
     }
 
+    if (voxel_auto && !(voxel_k > 0))
+    {
+        fprintf(stderr, "The \"-v auto\" factor k must be greater than 0.\n");
+        goto usage_info;
+    }
+
+    if (voxel_auto && voxel_strategy != 2 && voxel_strategy != 3)
+    {
+        fprintf(stderr, "Only voxelization strategies 2 and 3 are supported by \"-v auto\".\n");
+        goto usage_info;
+    }
+
     // parse input neighborhood list
     char *tok = neiborhood_sizes_list;
     strtok(neiborhood_sizes_list, ",");
@@ -189,409 +245,450 @@ int main(int argc, char *argv[])
         }
     }
 
-    // OPEN THE PC FILE //
-    auto pc = make_shared<geometry::PointCloud>();
+    // the reference PC of "-v auto" is read only once, whatever the number of "-i" PCs
+    shared_ptr<geometry::PointCloud> ref_pc;
 
-    if (io::ReadPointCloud(input_filename, *pc))
+    if (voxel_auto && reference_filename[0] != 0)
     {
-        fprintf(stderr, "Successfully read PC %s\n", input_filename);
-    }
-    else {
-        fprintf(stderr, "Failed to read PC %s.\n", input_filename);
-        return EXIT_FAILURE;
+        ref_pc = make_shared<geometry::PointCloud>();
+        if (io::ReadPointCloud(reference_filename, *ref_pc))
+        {
+            fprintf(stderr, "Successfully read reference PC %s\n", reference_filename);
+        }
+        else {
+            fprintf(stderr, "Failed to read reference PC %s.\n", reference_filename);
+            return EXIT_FAILURE;
+        }
+
+        voxel_size = estimate_voxel_size(*ref_pc, voxel_k, voxel_strategy);
     }
 
-    // workaround ".xyzrgb" 3dtk 2^8 unsigned integer rgb range not read correctly by Open3D
-    if (strstr (input_filename, ".xyzrgb") || divide_color_by_255)
+    for (size_t input = 0; input < input_filenames.size(); input++)
     {
-        for (size_t i = 0; i < pc->points_.size(); i++) {
-            pc->colors_[i](0) = pc->colors_[i](0) / 255.0;
-            pc->colors_[i](1) = pc->colors_[i](1) / 255.0;
-            pc->colors_[i](2) = pc->colors_[i](2) / 255.0;
+        const char *input_filename = input_filenames[input].c_str();
+
+        for (int i = 0; i < MAX_NR_METRICS; i++)
+        {
+            if (metric_enabled[i] != 0)
+            {
+                for (int j = 0; j < neiborhood_list_size; j++)
+                    memset (histogram[i][j], 0, sizeof(double) * end_of_scale[i][j]);
+            }
         }
-    }
 
-    if (voxelize)
-    {
-        pc = pc->VoxelDownSample(voxel_size);
-    }
+        // OPEN THE PC FILE //
+        auto pc = make_shared<geometry::PointCloud>();
 
-    // print_pointcloud(*pc, false);
+        if (ref_pc && strcmp(reference_filename, input_filename) == 0)
+        {
+            *pc = *ref_pc;
+        }
+        else if (io::ReadPointCloud(input_filename, *pc))
+        {
+            fprintf(stderr, "Successfully read PC %s\n", input_filename);
+        }
+        else {
+            fprintf(stderr, "Failed to read PC %s.\n", input_filename);
+            return EXIT_FAILURE;
+        }
 
-    // METRIC PROCESSING //
+        // workaround ".xyzrgb" 3dtk 2^8 unsigned integer rgb range not read correctly by Open3D
+        if (strstr (input_filename, ".xyzrgb") || divide_color_by_255)
+        {
+            for (size_t i = 0; i < pc->points_.size(); i++) {
+                pc->colors_[i](0) = pc->colors_[i](0) / 255.0;
+                pc->colors_[i](1) = pc->colors_[i](1) / 255.0;
+                pc->colors_[i](2) = pc->colors_[i](2) / 255.0;
+            }
+        }
 
-    geometry::KDTreeFlann kdtree;
-    kdtree.SetGeometry(*pc);
+        // same as "optimize_voxel_size {2,3} k", reusing the PC already in memory
+        if (voxel_auto && !ref_pc)
+        {
+            voxel_size = estimate_voxel_size(*pc, voxel_k, voxel_strategy);
+        }
+
+        if (voxelize)
+        {
+            pc = pc->VoxelDownSample(voxel_size);
+        }
+
+        // print_pointcloud(*pc, false);
 
-    // for each point in the PC - parallel execution using OpenMP
+        // METRIC PROCESSING //
+
+        geometry::KDTreeFlann kdtree;
+        kdtree.SetGeometry(*pc);
+
+        // for each point in the PC - parallel execution using OpenMP
 #if USE_OPENMP__ == 1
 #pragma omp parallel for num_threads(max_threads) schedule(dynamic,1000)
 #endif
-    for (size_t i = 0; i < pc->points_.size(); i++) {
-        int label[MAX_NR_METRICS];
-        memset(label, 0, sizeof(int) * MAX_NR_METRICS);
+        for (size_t i = 0; i < pc->points_.size(); i++) {
+            int label[MAX_NR_METRICS];
+            memset(label, 0, sizeof(int) * MAX_NR_METRICS);
 
-        // for fast retrieval of nearest neighbor we use kd-tree
-        std::vector<int> indices_vec(max_neiborhood_size + 1);
-        std::vector<double> dists_vec(max_neiborhood_size + 1);
+            // for fast retrieval of nearest neighbor we use kd-tree
+            std::vector<int> indices_vec(max_neiborhood_size + 1);
+            std::vector<double> dists_vec(max_neiborhood_size + 1);
 
-        // get the nearest neighbors of point with index "i"
-        kdtree.SearchKNN(pc->points_[i], max_neiborhood_size + 1, indices_vec, dists_vec);
+            // get the nearest neighbors of point with index "i"
+            kdtree.SearchKNN(pc->points_[i], max_neiborhood_size + 1, indices_vec, dists_vec);
 
-        for (int foo = 0; foo < neiborhood_list_size; foo++)
-        {
-            int nn = neiborhood_size[foo] + 1;
+            for (int foo = 0; foo < neiborhood_list_size; foo++)
+            {
+                int nn = neiborhood_size[foo] + 1;
 
-            const Eigen::Vector3d &point_color = pc->colors_[i];
-            const Eigen::Vector3d &point_normal = pc->normals_[i];
+                const Eigen::Vector3d &point_color = pc->colors_[i];
+                const Eigen::Vector3d &point_normal = pc->normals_[i];
 
 
-            for (int j = 1 ; j < nn; j++)
-            { // starting from 1, as index 0 refers to the own point.
-                const Eigen::Vector3d &color = pc->colors_[indices_vec[j]];
-                const Eigen::Vector3d &normal = pc->normals_[indices_vec[j]];
-                // const Eigen::Vector3d &point = pc->points_[indices_vec[j]];
+                for (int j = 1 ; j < nn; j++)
+                { // starting from 1, as index 0 refers to the own point.
+                    const Eigen::Vector3d &color = pc->colors_[indices_vec[j]];
+                    const Eigen::Vector3d &normal = pc->normals_[indices_vec[j]];
+                    // const Eigen::Vector3d &point = pc->points_[indices_vec[j]];
 
 
-                double diff = 0;
+                    double diff = 0;
 
-                if (metric_enabled[DLCP_8B] != 0 || metric_enabled[DLCP_12B] != 0)
-                {
+                    if (metric_enabled[DLCP_8B] != 0 || metric_enabled[DLCP_12B] != 0)
+                    {
 
-                    ColorSpace::Rgb a(point_color(0) * 255, point_color(1) * 255, point_color(2) * 255);
-                    ColorSpace::Rgb b(color(0) * 255, color(1) * 255, color(2) * 255);
-                    // CIE LAB Delta E 2000 (CIEDE2000)
-                    diff = ColorSpace::Cie2000Comparison::Compare(&a, &b);
+                        ColorSpace::Rgb a(point_color(0) * 255, point_color(1) * 255, point_color(2) * 255);
+                        ColorSpace::Rgb b(color(0) * 255, color(1) * 255, color(2) * 255);
+                        // CIE LAB Delta E 2000 (CIEDE2000)
+                        diff = ColorSpace::Cie2000Comparison::Compare(&a, &b);
 
 #if 0 // for debugging purposes...
 
-                    ColorSpace::Lab lab_a, lab_b;
-                    a.To<ColorSpace::Lab>(&lab_a);
-                    b.To<ColorSpace::Lab>(&lab_b);
+                        ColorSpace::Lab lab_a, lab_b;
+                        a.To<ColorSpace::Lab>(&lab_a);
+                        b.To<ColorSpace::Lab>(&lab_b);
 
-                    fprintf(stderr, "CIE2000 diff = %.5f, l = %f a = %f b = %f  l = %f a = %f b = %f\n", diff, lab_a.l, lab_a.a, lab_a.b, lab_b.l, lab_b.a, lab_b.b);
+                        fprintf(stderr, "CIE2000 diff = %.5f, l = %f a = %f b = %f  l = %f a = %f b = %f\n", diff, lab_a.l, lab_a.a, lab_a.b, lab_b.l, lab_b.a, lab_b.b);
 #endif
 
-                    if (metric_enabled[DLCP_8B] != 0)
-                    {
-                        // if (diff >= 0 && diff < 2.5) // ~ Just Noticeable Difference
-                        //  label[DLCP_8B] |= 0;
+                        if (metric_enabled[DLCP_8B] != 0)
+                        {
+                            // if (diff >= 0 && diff < 2.5) // ~ Just Noticeable Difference
+                            //  label[DLCP_8B] |= 0;
 
-                        if (diff >= 2.5 && diff < 5.0)
-                            label[DLCP_8B] |= 1 << 0;
+                            if (diff >= 2.5 && diff < 5.0)
+                                label[DLCP_8B] |= 1 << 0;
 
-                        if (diff >= 5.0 && diff < 7.5)
-                            label[DLCP_8B] |= 1 << 1;
+                            if (diff >= 5.0 && diff < 7.5)
+                                label[DLCP_8B] |= 1 << 1;
 
-                        if (diff >= 7.5 && diff < 10.0)
-                            label[DLCP_8B] |= 1 << 2;
+                            if (diff >= 7.5 && diff < 10.0)
+                                label[DLCP_8B] |= 1 << 2;
 
-                        if (diff >= 10.0 && diff < 12.5)
-                            label[DLCP_8B] |= 1 << 3;
+                            if (diff >= 10.0 && diff < 12.5)
+                                label[DLCP_8B] |= 1 << 3;
 
-                        if (diff >= 12.5  && diff < 15.0)
-                            label[DLCP_8B] |= 1 << 4;
+                            if (diff >= 12.5  && diff < 15.0)
+                                label[DLCP_8B] |= 1 << 4;
 
-                        if (diff >= 15.0 && diff < 17.5)
-                            label[DLCP_8B] |= 1 << 5;
+                            if (diff >= 15.0 && diff < 17.5)
+                                label[DLCP_8B] |= 1 << 5;
 
-                        if (diff >= 17.5 && diff < 20.0)
-                            label[DLCP_8B] |= 1 << 6;
+                            if (diff >= 17.5 && diff < 20.0)
+                                label[DLCP_8B] |= 1 << 6;
 
-                        if (diff >= 20.0)
-                            label[DLCP_8B] |= 1 << 7;
-                    }
+                            if (diff >= 20.0)
+                                label[DLCP_8B] |= 1 << 7;
+                        }
 
-                    if (metric_enabled[DLCP_12B] != 0)
-                    {
-                        // if (diff >= 0 && diff < 1.5) // ~ Just Noticeable Difference
-                        //  label[DLCP_12B] |= 0;
+                        if (metric_enabled[DLCP_12B] != 0)
+                        {
+                            // if (diff >= 0 && diff < 1.5) // ~ Just Noticeable Difference
+                            //  label[DLCP_12B] |= 0;
 
-                        if (diff >= 1.5 && diff < 3.0)
-                            label[DLCP_12B] |= 1 << 0;
+                            if (diff >= 1.5 && diff < 3.0)
+                                label[DLCP_12B] |= 1 << 0;
 
-                        if (diff >= 3.0 && diff < 4.5)
-                            label[DLCP_12B] |= 1 << 1;
+                            if (diff >= 3.0 && diff < 4.5)
+                                label[DLCP_12B] |= 1 << 1;
 
-                        if (diff >= 4.5 && diff < 6.0)
-                            label[DLCP_12B] |= 1 << 2;
+                            if (diff >= 4.5 && diff < 6.0)
+                                label[DLCP_12B] |= 1 << 2;
 
-                        if (diff >= 6.0 && diff < 7.5)
-                            label[DLCP_12B] |= 1 << 3;
+                            if (diff >= 6.0 && diff < 7.5)
+                                label[DLCP_12B] |= 1 << 3;
 
-                        if (diff >= 7.5  && diff < 9.0)
-                            label[DLCP_12B] |= 1 << 4;
+                            if (diff >= 7.5  && diff < 9.0)
+                                label[DLCP_12B] |= 1 << 4;
 
-                        if (diff >= 9.0 && diff < 10.5)
-                            label[DLCP_12B] |= 1 << 5;
+                            if (diff >= 9.0 && diff < 10.5)
+                                label[DLCP_12B] |= 1 << 5;
 
-                        if (diff >= 10.5 && diff < 12.0)
-                            label[DLCP_12B] |= 1 << 6;
+                            if (diff >= 10.5 && diff < 12.0)
+                                label[DLCP_12B] |= 1 << 6;
 
-                        if (diff >= 12.0 && diff < 13.5)
-                            label[DLCP_12B] |= 1 << 7;
+                            if (diff >= 12.0 && diff < 13.5)
+                                label[DLCP_12B] |= 1 << 7;
 
-                        if (diff >= 13.5 && diff < 15.0)
-                            label[DLCP_12B] |= 1 << 8;
+                            if (diff >= 13.5 && diff < 15.0)
+                                label[DLCP_12B] |= 1 << 8;
 
-                        if (diff >= 15.0 && diff < 16.5)
-                            label[DLCP_12B] |= 1 << 9;
+                            if (diff >= 15.0 && diff < 16.5)
+                                label[DLCP_12B] |= 1 << 9;
 
-                        if (diff >= 16.5 && diff < 18.0)
-                            label[DLCP_12B] |= 1 << 10;
+                            if (diff >= 16.5 && diff < 18.0)
+                                label[DLCP_12B] |= 1 << 10;
 
-                        if (diff >= 18.0)
-                            label[DLCP_12B] |= 1 << 11;
+                            if (diff >= 18.0)
+                                label[DLCP_12B] |= 1 << 11;
+                        }
                     }
-                }
 
 
-                double dist = 0;
+                    double dist = 0;
 
-                if (metric_enabled[DGEO_16B] || metric_enabled[DGEO_12B] || metric_enabled[DGEO_8B])
-                {
-                    dist =  sqrt ( (pow((point_normal[0] - normal[0]), 2)) +
-                                   (pow((point_normal[1] - normal[1]), 2)) +
-                                   (pow((point_normal[2] - normal[2]), 2)) );
-                    // fprintf(stderr, "dist: %.8f central pt normal: %.4f %.4f %.4f\nneighbo pt normal: %.4f %.4f %.4f\n\n", dist, point_normal(0), point_normal(1), point_normal(2), normal(0), normal(1), normal(2));
-                }
+                    if (metric_enabled[DGEO_16B] || metric_enabled[DGEO_12B] || metric_enabled[DGEO_8B])
+                    {
+                        dist =  sqrt ( (pow((point_normal[0] - normal[0]), 2)) +
+                                       (pow((point_normal[1] - normal[1]), 2)) +
+                                       (pow((point_normal[2] - normal[2]), 2)) );
+                        // fprintf(stderr, "dist: %.8f central pt normal: %.4f %.4f %.4f\nneighbo pt normal: %.4f %.4f %.4f\n\n", dist, point_normal(0), point_normal(1), point_normal(2), normal(0), normal(1), normal(2));
+                    }
 
 
-                if (metric_enabled[DGEO_16B] != 0)
-                {
-                    // if (dist >= 0 && dist < 0.05)
-                    // label[DGEO_16B] |= 0;
+                    if (metric_enabled[DGEO_16B] != 0)
+                    {
+                        // if (dist >= 0 && dist < 0.05)
+                        // label[DGEO_16B] |= 0;
 
-                    if (dist >= 0.05 && dist < 0.1)
-                        label[DGEO_16B] |= 1 << 0;
+                        if (dist >= 0.05 && dist < 0.1)
+                            label[DGEO_16B] |= 1 << 0;
 
-                    if (dist >= 0.1 && dist < 0.175)
-                        label[DGEO_16B] |= 1 << 1;
+                        if (dist >= 0.1 && dist < 0.175)
+                            label[DGEO_16B] |= 1 << 1;
 
-                    if (dist >= 0.175 && dist < 0.275)
-                        label[DGEO_16B] |= 1 << 2;
+                        if (dist >= 0.175 && dist < 0.275)
+                            label[DGEO_16B] |= 1 << 2;
 
-                    if (dist >= 0.275 && dist < 0.4)
-                        label[DGEO_16B] |= 1 << 3;
+                        if (dist >= 0.275 && dist < 0.4)
+                            label[DGEO_16B] |= 1 << 3;
 
-                    if (dist >= 0.4 && dist < 0.525)
-                        label[DGEO_16B] |= 1 << 4;
+                        if (dist >= 0.4 && dist < 0.525)
+                            label[DGEO_16B] |= 1 << 4;
 
-                    if (dist >= 0.525 && dist < 0.65)
-                        label[DGEO_16B] |= 1 << 5;
+                        if (dist >= 0.525 && dist < 0.65)
+                            label[DGEO_16B] |= 1 << 5;
 
-                    if (dist >= 0.65 && dist < 0.775)
-                        label[DGEO_16B] |= 1 << 6;
+                        if (dist >= 0.65 && dist < 0.775)
+                            label[DGEO_16B] |= 1 << 6;
 
-                    if (dist >= 0.775 && dist < 0.9)
-                        label[DGEO_16B] |= 1 << 7;
+                        if (dist >= 0.775 && dist < 0.9)
+                            label[DGEO_16B] |= 1 << 7;
 
-                    if (dist >= 0.9 && dist < 1.025)
-                        label[DGEO_16B] |= 1 << 8;
+                        if (dist >= 0.9 && dist < 1.025)
+                            label[DGEO_16B] |= 1 << 8;
 
-                    if (dist >= 1.025 && dist < 1.15)
-                        label[DGEO_16B] |= 1 << 9;
+                        if (dist >= 1.025 && dist < 1.15)
+                            label[DGEO_16B] |= 1 << 9;
 
-                    if (dist >= 1.15 && dist < 1.275)
-                        label[DGEO_16B] |= 1 << 10;
+                        if (dist >= 1.15 && dist < 1.275)
+                            label[DGEO_16B] |= 1 << 10;
 
-                    if (dist >= 1.275 && dist < 1.4)
-                        label[DGEO_16B] |= 1 << 11;
+                        if (dist >= 1.275 && dist < 1.4)
+                            label[DGEO_16B] |= 1 << 11;
 
-                    if (dist >= 1.4 && dist < 1.525)
-                        label[DGEO_16B] |= 1 << 12;
+                        if (dist >= 1.4 && dist < 1.525)
+                            label[DGEO_16B] |= 1 << 12;
 
-                    if (dist >= 1.525 && dist < 1.65)
-                        label[DGEO_16B] |= 1 << 13;
+                        if (dist >= 1.525 && dist < 1.65)
+                            label[DGEO_16B] |= 1 << 13;
 
-                    if (dist >= 1.65 && dist < 1.8)
-                        label[DGEO_16B] |= 1 << 14;
+                        if (dist >= 1.65 && dist < 1.8)
+                            label[DGEO_16B] |= 1 << 14;
 
-                    if (dist >= 1.8 && dist < 2.0)
-                        label[DGEO_16B] |= 1 << 15;
+                        if (dist >= 1.8 && dist < 2.0)
+                            label[DGEO_16B] |= 1 << 15;
 
-                }
+                    }
 
-                if (metric_enabled[DGEO_12B] != 0)
-                {
-                   // if (dist >= 0 && dist < 0.05)
-                    // label[DGEO_16B] |= 0;
+                    if (metric_enabled[DGEO_12B] != 0)
+                    {
+                       // if (dist >= 0 && dist < 0.05)
+                        // label[DGEO_16B] |= 0;
 
-                    if (dist >= 0.05 && dist < 0.1)
-                        label[DGEO_12B] |= 1 << 0;
+                        if (dist >= 0.05 && dist < 0.1)
+                            label[DGEO_12B] |= 1 << 0;
 
-                    if (dist >= 0.1 && dist < 0.3)
-                        label[DGEO_12B] |= 1 << 1;
+                        if (dist >= 0.1 && dist < 0.3)
+                            label[DGEO_12B] |= 1 << 1;
 
-                    if (dist >= 0.3 && dist < 0.45)
-                        label[DGEO_12B] |= 1 << 2;
+                        if (dist >= 0.3 && dist < 0.45)
+                            label[DGEO_12B] |= 1 << 2;
 
-                    if (dist >= 0.45 && dist < 0.6)
-                        label[DGEO_12B] |= 1 << 3;
+                        if (dist >= 0.45 && dist < 0.6)
+                            label[DGEO_12B] |= 1 << 3;
 
-                    if (dist >= 0.6 && dist < 0.75)
-                        label[DGEO_12B] |= 1 << 4;
+                        if (dist >= 0.6 && dist < 0.75)
+                            label[DGEO_12B] |= 1 << 4;
 
-                    if (dist >= 0.75 && dist < 0.9)
-                        label[DGEO_12B] |= 1 << 5;
+                        if (dist >= 0.75 && dist < 0.9)
+                            label[DGEO_12B] |= 1 << 5;
 
-                    if (dist >= 0.9 && dist < 1.05)
-                        label[DGEO_12B] |= 1 << 6;
+                        if (dist >= 0.9 && dist < 1.05)
+                            label[DGEO_12B] |= 1 << 6;
 
-                    if (dist >= 1.05 && dist < 1.2)
-                        label[DGEO_12B] |= 1 << 7;
+                        if (dist >= 1.05 && dist < 1.2)
+                            label[DGEO_12B] |= 1 << 7;
 
-                    if (dist >= 1.2 && dist < 1.35)
-                        label[DGEO_12B] |= 1 << 8;
+                        if (dist >= 1.2 && dist < 1.35)
+                            label[DGEO_12B] |= 1 << 8;
 
-                    if (dist >= 1.35 && dist < 1.55)
-                        label[DGEO_12B] |= 1 << 9;
+                        if (dist >= 1.35 && dist < 1.55)
+                            label[DGEO_12B] |= 1 << 9;
 
-                    if (dist >= 1.55 && dist < 1.75)
-                        label[DGEO_12B] |= 1 << 10;
+                        if (dist >= 1.55 && dist < 1.75)
+                            label[DGEO_12B] |= 1 << 10;
 
-                    if (dist >= 1.75 && dist < 2.0)
-                        label[DGEO_12B] |= 1 << 11;
+                        if (dist >= 1.75 && dist < 2.0)
+                            label[DGEO_12B] |= 1 << 11;
 
-                }
+                    }
 
-                if (metric_enabled[DGEO_8B] != 0)
-                {
-                    if ( normal(0) < 0 && normal(1) < 0 && normal(2) < 0 )
-                        label[DGEO_8B] |= 1 << 0;
+                    if (metric_enabled[DGEO_8B] != 0)
+                    {
+                        if ( normal(0) < 0 && normal(1) < 0 && normal(2) < 0 )
+                            label[DGEO_8B] |= 1 << 0;
 
-                    if ( normal(0) < 0 && normal(1) < 0 && normal(2) >= 0 )
-                        label[DGEO_8B] |= 1 << 1;
+                        if ( normal(0) < 0 && normal(1) < 0 && normal(2) >= 0 )
+                            label[DGEO_8B] |= 1 << 1;
 
-                    if ( normal(0) < 0 && normal(1) >= 0 && normal(2) < 0 )
-                        label[DGEO_8B] |= 1 << 2;
+                        if ( normal(0) < 0 && normal(1) >= 0 && normal(2) < 0 )
+                            label[DGEO_8B] |= 1 << 2;
 
-                    if ( normal(0) < 0 && normal(1) >= 0 && normal(2) >= 0 )
-                        label[DGEO_8B] |= 1 << 3;
+                        if ( normal(0) < 0 && normal(1) >= 0 && normal(2) >= 0 )
+                            label[DGEO_8B] |= 1 << 3;
 
-                    if ( normal(0) >= 0 && normal(1) < 0 && normal(2) < 0 )
-                        label[DGEO_8B] |= 1 << 4;
+                        if ( normal(0) >= 0 && normal(1) < 0 && normal(2) < 0 )
+                            label[DGEO_8B] |= 1 << 4;
 
-                    if ( normal(0) >= 0 && normal(1) < 0 && normal(2) >= 0 )
-                        label[DGEO_8B] |= 1 << 5;
+                        if ( normal(0) >= 0 && normal(1) < 0 && normal(2) >= 0 )
+                            label[DGEO_8B] |= 1 << 5;
 
-                    if ( normal(0) >= 0 && normal(1) >= 0 && normal(2) < 0 )
-                        label[DGEO_8B] |= 1 << 6;
+                        if ( normal(0) >= 0 && normal(1) >= 0 && normal(2) < 0 )
+                            label[DGEO_8B] |= 1 << 6;
 
-                    if ( normal(0) >= 0 && normal(1) >= 0 && normal(2) >= 0 )
-                        label[DGEO_8B] |= 1 << 7;
-                }
+                        if ( normal(0) >= 0 && normal(1) >= 0 && normal(2) >= 0 )
+                            label[DGEO_8B] |= 1 << 7;
+                    }
 
 
-            }
+                }
 
 
-            for (int i = 0; i < MAX_NR_METRICS; i++)
-            {
-                if (metric_enabled[i] != 0)
+                for (int i = 0; i < MAX_NR_METRICS; i++)
                 {
-                    histogram[i][foo][label[i]]++;
+                    if (metric_enabled[i] != 0)
+                    {
+                        histogram[i][foo][label[i]]++;
+                    }
                 }
-            }
 
+            }
         }
-    }
 
-    // normalize
-    for (int i = 0; i < MAX_NR_METRICS; i++)
-    {
-        if (metric_enabled[i] != 0)
+        // normalize
+        for (int i = 0; i < MAX_NR_METRICS; i++)
         {
-            for (int foo = 0; foo < neiborhood_list_size; foo++)
+            if (metric_enabled[i] != 0)
             {
-                for (int j = 0; j < end_of_scale[i][foo]; j++)
+                for (int foo = 0; foo < neiborhood_list_size; foo++)
                 {
-                    histogram[i][foo][j] = histogram[i][foo][j] / pc->points_.size();
+                    for (int j = 0; j < end_of_scale[i][foo]; j++)
+                    {
+                        histogram[i][foo][j] = histogram[i][foo][j] / pc->points_.size();
+                    }
                 }
             }
         }
-    }
 
 
-    // Results output
-    FILE *hist_fp;
+        // Results output
+        FILE *hist_fp;
 
-    //  write
-    if (create_histogram == true)
-    {
-        if (split_files == true)
+        //  write
+        if (create_histogram == true)
         {
-            for (int i = 0; i < MAX_NR_METRICS; i++)
+            if (split_files == true)
             {
-                if (metric_enabled[i] != 0)
+                for (int i = 0; i < MAX_NR_METRICS; i++)
                 {
-                    for (int foo = 0; foo < neiborhood_list_size; foo++)
+                    if (metric_enabled[i] != 0)
                     {
-                        char filename[4096];
-                        // this is our output file format for split files!
-                        sprintf(filename, "%s_M%02d_N%02d.csv", histogram_filename, i, neiborhood_size[foo]);
-
-                        hist_fp = fopen(filename, "a");
-                        if (hist_fp == NULL)
+                        for (int foo = 0; foo < neiborhood_list_size; foo++)
                         {
-                            fprintf(stderr, "Could not write histogram output path: %s.\n", filename);
-                            exit (EXIT_FAILURE);
+                            char filename[4096];
+                            // this is our output file format for split files!
+                            sprintf(filename, "%s_M%02d_N%02d.csv", histogram_filename, i, neiborhood_size[foo]);
+
+                            hist_fp = fopen(filename, "a");
+                            if (hist_fp == NULL)
+                            {
+                                fprintf(stderr, "Could not write histogram output path: %s.\n", filename);
+                                exit (EXIT_FAILURE);
+                            }
+
+                            fprintf(hist_fp, "%s,", input_filename);
+                            for (int j = 0; j < end_of_scale[i][foo]; j++)
+                            {
+
+                                if ( fpclassify(histogram[i][foo][j]) == FP_ZERO ) // if (histogram[i][foo][j] == 0.0) ...
+                                    fprintf(hist_fp, "0.0%s", (j != (end_of_scale[i][foo] - 1))? ",":"");
+                                else
+                                    fprintf(hist_fp, "%0.16f%s", histogram[i][foo][j],(j != (end_of_scale[i][foo] - 1))? ",":"");
+                            }
+                            fprintf(hist_fp, "\n");
+
+                            fclose(hist_fp);
                         }
-
-                        fprintf(hist_fp, "%s,", input_filename);
-                        for (int j = 0; j < end_of_scale[i][foo]; j++)
-                        {
-
-                            if ( fpclassify(histogram[i][foo][j]) == FP_ZERO ) // if (histogram[i][foo][j] == 0.0) ...
-                                fprintf(hist_fp, "0.0%s", (j != (end_of_scale[i][foo] - 1))? ",":"");
-                            else
-                                fprintf(hist_fp, "%0.16f%s", histogram[i][foo][j],(j != (end_of_scale[i][foo] - 1))? ",":"");
-                        }
-                        fprintf(hist_fp, "\n");
-
-                        fclose(hist_fp);
                     }
                 }
             }
-        }
 
-        if (split_files == false)
-        {
-            hist_fp = fopen(histogram_filename, "a");
-
-            // Write the output //
-            if (hist_fp == NULL)
+            if (split_files == false)
             {
-                fprintf(stderr, "Could not write histogram output path: %s.\n", histogram_filename);
-                exit (EXIT_FAILURE);
-            }
-            // fwrite(normalize ? (void *)histogram_normalized : (void *)histogram, 8, end_of_scale, hist_fp); // ps: sizeof(double) == sizeof(uint64_t) == 8 // binary write
+                hist_fp = fopen(histogram_filename, "a");
 
-            for (int i = 0; i < MAX_NR_METRICS; i++)
-            {
-                if (metric_enabled[i] != 0)
+                // Write the output //
+                if (hist_fp == NULL)
                 {
-                    for (int foo = 0; foo < neiborhood_list_size; foo++)
+                    fprintf(stderr, "Could not write histogram output path: %s.\n", histogram_filename);
+                    exit (EXIT_FAILURE);
+                }
+                // fwrite(normalize ? (void *)histogram_normalized : (void *)histogram, 8, end_of_scale, hist_fp); // ps: sizeof(double) == sizeof(uint64_t) == 8 // binary write
+
+                for (int i = 0; i < MAX_NR_METRICS; i++)
+                {
+                    if (metric_enabled[i] != 0)
                     {
-                        fprintf(hist_fp, "%s,metric_%d,n_%d,", input_filename, i, neiborhood_size[foo]);
-                        for (int j = 0; j < end_of_scale[i][foo]; j++)
+                        for (int foo = 0; foo < neiborhood_list_size; foo++)
                         {
-
-                            if ( fpclassify(histogram[i][foo][j]) == FP_ZERO ) // if (histogram[i][foo][j] == 0.0) ...
-                                fprintf(hist_fp, "0.0%s", (j != (end_of_scale[i][foo] - 1))? ",":"");
-                            else
-                                fprintf(hist_fp, "%0.16f%s", histogram[i][foo][j],(j != (end_of_scale[i][foo] - 1))? ",":"");
+                            fprintf(hist_fp, "%s,metric_%d,n_%d,", input_filename, i, neiborhood_size[foo]);
+                            for (int j = 0; j < end_of_scale[i][foo]; j++)
+                            {
+
+                                if ( fpclassify(histogram[i][foo][j]) == FP_ZERO ) // if (histogram[i][foo][j] == 0.0) ...
+                                    fprintf(hist_fp, "0.0%s", (j != (end_of_scale[i][foo] - 1))? ",":"");
+                                else
+                                    fprintf(hist_fp, "%0.16f%s", histogram[i][foo][j],(j != (end_of_scale[i][foo] - 1))? ",":"");
+                            }
+                            fprintf(hist_fp, "\n");
                         }
-                        fprintf(hist_fp, "\n");
                     }
                 }
-            }
 
 
-            fclose(hist_fp);
+                fclose(hist_fp);
+            }
         }
     }
 
-
     return EXIT_SUCCESS;
 }
@@ -27,6 +27,8 @@
 
 #include <Open3D.h>
 
+#include "spacing_estimator.h"
+
 using namespace open3d;
 using namespace std;
 
@@ -50,37 +52,13 @@ int main(int argc, char *argv[])
     geometry::KDTreeFlann kdtree;
     kdtree.SetGeometry(*pc);
 
-    double average_dist = 0;
-
     int knn = 9; // 8 nearest neighbor
 
-#pragma omp parallel for num_threads(32) reduction(+:average_dist) schedule(dynamic,1000)
-    for (size_t i = 0; i < pc->points_.size(); i++)
-    {
-        std::vector<int> indices_vec(knn);
-        std::vector<double> dists_vec(knn);
-
-        kdtree.SearchKNN(pc->points_[i], knn, indices_vec, dists_vec);
-
-        Eigen::Vector3d points[knn];
-        for (int j = 0; j < knn; j++)
-        {
-            points[j] = pc->points_[indices_vec[j]];
-        }
-
-        double dist = 0;
-        for (int j = 1; j < knn; j++)
-        {
-            dist += sqrt ( (pow((points[j][0] - points[0][0]), 2)) +
-                           (pow((points[j][1] - points[0][1]), 2)) +
-                           (pow((points[j][2] - points[0][2]), 2)) );
-        }
-        dist /= (knn - 1);
-
-        average_dist += dist;
-    }
-    average_dist /= pc->points_.size();
+    spacing_estimate est = estimate_mean_spacing(*pc, kdtree, knn);
+    double average_dist = est.mean;
 
+    fprintf(stderr, "average 8-NN distance = %0.16f (95%% CI [%0.16f, %0.16f], %zu of %zu points queried)\n",
+            est.mean, est.ci_low, est.ci_high, est.samples, pc->points_.size());
 
     pc->EstimateNormals(geometry::KDTreeSearchParamHybrid(average_dist * 6, 16)); // radius, max_nn
 
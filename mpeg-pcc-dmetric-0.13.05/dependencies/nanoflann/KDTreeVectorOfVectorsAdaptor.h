@@ -67,6 +67,25 @@ struct KDTreeVectorOfVectorsAdaptor
 		index->buildIndex();
 	}
 
+	/// Constructor: takes a const ref to the same data points as the index saved in the stream
+	/// (see saveIndex()), and loads this index rather than building it
+	KDTreeVectorOfVectorsAdaptor(const int dimensionality, const VectorOfVectorsType &mat, FILE *stream, const int leaf_max_size = 10) : m_data(mat)
+	{
+		index = new index_t( dimensionality, *this /* adaptor */, nanoflann::KDTreeSingleIndexAdaptorParams(leaf_max_size ) );
+		try {
+			index->loadIndex(stream);
+		}
+		catch (...) {
+			delete index;
+			throw;
+		}
+	}
+
+	/// Stores the index in a binary file, without the data points
+	void saveIndex(FILE *stream) const {
+		index->saveIndex(stream);
+	}
+
 	~KDTreeVectorOfVectorsAdaptor() {
 		delete index;
 	}
@@ -85,6 +104,21 @@ struct KDTreeVectorOfVectorsAdaptor
 		return index->findNeighbors(resultSet, query_point, nanoflann::SearchParams());
 	}
 
+	/** Query for the closest point to a given point followed by the points at the same squared
+	  *  distance, each one within \a eps of the previous one, in a single search
+	  *  (see nanoflann::NearestTiesResultSet). The output arrays must hold \a capacity points.
+	  *  The search is approximate if \a params has a positive eps or max_leaves.
+	  * \return The number of tied points (at least 1 for a non-empty cloud).
+	  */
+	size_t queryTies(const num_t *query_point, const size_t capacity, const DistanceType eps, IndexType *out_indices, DistanceType *out_distances_sq,
+					 const nanoflann::SearchParams &params = nanoflann::SearchParams()) const
+	{
+		nanoflann::NearestTiesResultSet<DistanceType,IndexType> resultSet(capacity, eps);
+		resultSet.init(out_indices, out_distances_sq);
+		index->findNeighbors(resultSet, query_point, params);
+		return resultSet.size();
+	}
+
 	/** @name Interface expected by KDTreeSingleIndexAdaptor
 	  * @{ */
 
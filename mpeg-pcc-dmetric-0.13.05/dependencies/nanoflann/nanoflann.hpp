@@ -54,6 +54,9 @@
 #include <cmath>   // for abs()
 #include <cstdlib> // for abs()
 #include <limits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // Avoid conflicting declaration of min/max macros in windows headers
 #if !defined(NOMINMAX) && (defined(_WIN32) || defined(_WIN32_)  || defined(WIN32) || defined(_WIN64))
@@ -72,6 +75,11 @@ namespace nanoflann
   	/** Library version: 0xMmP (M=Major,m=minor,P=patch) */
 	#define NANOFLANN_VERSION 0x123
 
+	/** Subtrees with more points than this are built as separate OpenMP tasks */
+	#ifndef NANOFLANN_PARALLEL_BUILD_MIN_SIZE
+	#define NANOFLANN_PARALLEL_BUILD_MIN_SIZE 32768
+	#endif
+
 	/** @addtogroup result_sets_grp Result set classes
 	  *  @{ */
 	template <typename DistanceType, typename IndexType = size_t, typename CountType = size_t>
@@ -137,6 +145,83 @@ namespace nanoflann
 	};
 
 
+	/**
+	 * A result-set class returning the nearest point followed by the points at
+	 * the same distance, in a single search. The points are the "capacity"
+	 * smallest ones in (distance, index) order, cut after the first one whose
+	 * distance differs by more than "eps" from the previous one. Ordering the
+	 * equal distances by index makes the result independent of the order in
+	 * which the points are visited, i.e. of the search structure. The search
+	 * is pruned beyond the longest possible chain of such ties,
+	 * (capacity-1)*eps (plus a small relative slack).
+	 */
+	template <typename DistanceType, typename IndexType = size_t, typename CountType = size_t>
+	class NearestTiesResultSet
+	{
+		IndexType * indices;
+		DistanceType* dists;
+		CountType capacity;
+		CountType count;
+		DistanceType eps;
+
+	public:
+		inline NearestTiesResultSet(CountType capacity_, DistanceType eps_ = 0) : indices(0), dists(0), capacity(capacity_), count(0), eps(eps_)
+		{
+		}
+
+		inline void init(IndexType* indices_, DistanceType* dists_)
+		{
+			indices = indices_;
+			dists = dists_;
+			count = 0;
+		}
+
+		/** Number of tied points, at the beginning of the output arrays */
+		inline CountType size() const
+		{
+			CountType n = (count > 0) ? 1 : 0;
+			while (n < count && dists[n] - dists[n-1] <= eps) n++;
+			return n;
+		}
+
+		inline bool full() const
+		{
+			return count == capacity;
+		}
+
+		inline void addPoint(DistanceType dist, IndexType index)
+		{
+			CountType i;
+			for (i=count; i>0; --i) {
+				if (dists[i-1]>dist || (dists[i-1]==dist && indices[i-1]>index)) {
+					if (i<capacity) {
+						dists[i] = dists[i-1];
+						indices[i] = indices[i-1];
+					}
+				}
+				else break;
+			}
+			if (i<capacity) {
+				dists[i] = dist;
+				indices[i] = index;
+			}
+			if (count<capacity) count++;
+		}
+
+		inline DistanceType worstDist() const
+		{
+			if (count == 0) return (std::numeric_limits<DistanceType>::max)();
+			// relative slack: the distances to the cells are updated incrementally
+			// while searching, and rounding must not prune a cell holding a tie.
+			// When full, a point at the last distance is still needed if its
+			// index is smaller.
+			const DistanceType tieDist = std::nextafter((dists[0] + (capacity-1)*eps) * static_cast<DistanceType>(1.000001), (std::numeric_limits<DistanceType>::max)());
+			if (count < capacity) return tieDist;
+			const DistanceType lastDist = std::nextafter(dists[capacity-1] * static_cast<DistanceType>(1.000001), (std::numeric_limits<DistanceType>::max)());
+			return (std::min)(tieDist, lastDist);
+		}
+	};
+
 	/**
 	 * A result-set class used when performing a radius based search.
 	 */
@@ -413,12 +498,13 @@ namespace nanoflann
 	struct SearchParams
 	{
 		/** Note: The first argument (checks_IGNORED_) is ignored, but kept for compatibility with the FLANN interface */
-		SearchParams(int checks_IGNORED_ = 32, float eps_ = 0, bool sorted_ = true ) :
-			checks(checks_IGNORED_), eps(eps_), sorted(sorted_) {}
+		SearchParams(int checks_IGNORED_ = 32, float eps_ = 0, bool sorted_ = true, size_t max_leaves_ = 0 ) :
+			checks(checks_IGNORED_), eps(eps_), sorted(sorted_), max_leaves(max_leaves_) {}
 
 		int   checks;  //!< Ignored parameter (Kept for compatibility with the FLANN interface).
 		float eps;  //!< search for eps-approximate neighbours (default: 0)
 		bool sorted; //!< only for radius search, require neighbours sorted by distance (default: true)
+		size_t max_leaves; //!< approximate search: stop after checking this number of leaves, the nearest one first (default: 0, no limit)
 	};
 	/** @} */
 
@@ -557,6 +643,33 @@ namespace nanoflann
 			return rloc;
 		}
 
+		/**
+		 * Moves all the memory blocks of another pool into this one, which
+		 * then owns (and frees) them. The other pool is left empty. This lets
+		 * concurrent tasks allocate from their own pool, merged afterwards.
+		 */
+		void splice(PooledAllocator &other)
+		{
+			if (other.base == NULL) return;
+			if (base == NULL) {
+				base = other.base;
+				loc = other.loc;
+				remaining = other.remaining;
+			}
+			else {
+				/* Insert the blocks of "other" after the current block. */
+				void *last = other.base;
+				while (*(static_cast<void**>(last)) != NULL)
+					last = *(static_cast<void**>(last));
+				*(static_cast<void**>(last)) = *(static_cast<void**>(base));
+				*(static_cast<void**>(base)) = other.base;
+				wastedMemory += other.remaining;
+			}
+			usedMemory += other.usedMemory;
+			wastedMemory += other.wastedMemory;
+			other.internal_init();
+		}
+
 		/**
 		 * Allocates (using this pool) a generic type T.
 		 *
@@ -862,7 +975,17 @@ namespace nanoflann
 			m_size_at_index_build = m_size;
 			if(m_size == 0) return;
 			computeBoundingBox(root_bbox);
-			root_node = divideTree(0, m_size, root_bbox );   // construct the tree
+#ifdef _OPENMP
+			// Large subtrees are built by OpenMP tasks: reuse the current team if
+			// any (its idle threads run the tasks), otherwise start one.
+			if (m_size > NANOFLANN_PARALLEL_BUILD_MIN_SIZE && !omp_in_parallel() && omp_get_max_threads() > 1) {
+				#pragma omp parallel
+				#pragma omp single
+				root_node = divideTree(pool, 0, m_size, root_bbox );   // construct the tree
+				return;
+			}
+#endif
+			root_node = divideTree(pool, 0, m_size, root_bbox );   // construct the tree
 		}
 
 		/** Returns number of points in dataset  */
@@ -910,7 +1033,8 @@ namespace nanoflann
 			distance_vector_t dists; // fixed or variable-sized container (depending on DIM)
 			dists.assign((DIM>0 ? DIM : dim) ,0); // Fill it with zeros.
 			DistanceType distsq = computeInitialDistances(vec, dists);
-			searchLevel(result, vec, root_node, distsq, dists, epsError);  // "count_leaf" parameter removed since was neither used nor returned to the user.
+			size_t leaves = 0;
+			searchLevel(result, vec, root_node, distsq, dists, epsError, leaves, searchParams.max_leaves);
             return result.full();
 		}
 
@@ -1035,12 +1159,18 @@ namespace nanoflann
 		 * Create a tree node that subdivides the list of vecs from vind[first]
 		 * to vind[last].  The routine is called recursively on each sublist.
 		 *
+		 * Subtrees larger than NANOFLANN_PARALLEL_BUILD_MIN_SIZE are built as
+		 * OpenMP tasks, the first child getting its own node pool, spliced into
+		 * "nodePool" once done. They work on disjoint ranges of vind, so the tree is the
+		 * same as the one built serially.
+		 *
+		 * @param nodePool pool the nodes are allocated from
 		 * @param left index of the first vector
 		 * @param right index of the last vector
 		 */
-		NodePtr divideTree(const IndexType left, const IndexType right, BoundingBox& bbox)
+		NodePtr divideTree(PooledAllocator &nodePool, const IndexType left, const IndexType right, BoundingBox& bbox)
 		{
-			NodePtr node = pool.allocate<Node>(); // allocate memory
+			NodePtr node = nodePool.allocate<Node>(); // allocate memory
 
 			/* If too few exemplars remain, then make this a leaf node. */
 			if ( (right-left) <= static_cast<IndexType>(m_leaf_max_size) ) {
@@ -1070,11 +1200,25 @@ namespace nanoflann
 
 				BoundingBox left_bbox(bbox);
 				left_bbox[cutfeat].high = cutval;
-				node->child1 = divideTree(left, left+idx, left_bbox);
 
 				BoundingBox right_bbox(bbox);
 				right_bbox[cutfeat].low = cutval;
-				node->child2 = divideTree(left+idx, right, right_bbox);
+
+#ifdef _OPENMP
+				if ( (right-left) > static_cast<IndexType>(NANOFLANN_PARALLEL_BUILD_MIN_SIZE) && omp_in_parallel() ) {
+					PooledAllocator pool1;
+					#pragma omp task shared(node, pool1, left_bbox) firstprivate(left, idx)
+					node->child1 = divideTree(pool1, left, left+idx, left_bbox);
+					node->child2 = divideTree(nodePool, left+idx, right, right_bbox);
+					#pragma omp taskwait
+					nodePool.splice(pool1);
+				}
+				else
+#endif
+				{
+					node->child1 = divideTree(nodePool, left, left+idx, left_bbox);
+					node->child2 = divideTree(nodePool, left+idx, right, right_bbox);
+				}
 
 				node->node_type.sub.divlow = left_bbox[cutfeat].high;
 				node->node_type.sub.divhigh = right_bbox[cutfeat].low;
@@ -1200,16 +1344,20 @@ namespace nanoflann
 		}
 
 		/**
-		 * Performs an exact search in the tree starting from a node.
+		 * Performs an exact search in the tree starting from a node, unless epsError > 1 or
+		 * max_leaves > 0: \a leaves counts the leaves checked, the search stops at max_leaves.
 		 * \tparam RESULTSET Should be any ResultSet<DistanceType>
 		 */
 		template <class RESULTSET>
 		void searchLevel(RESULTSET& result_set, const ElementType* vec, const NodePtr node, DistanceType mindistsq,
-						 distance_vector_t& dists, const float epsError) const
+						 distance_vector_t& dists, const float epsError, size_t& leaves, const size_t max_leaves) const
 		{
+			if (max_leaves > 0 && leaves >= max_leaves)
+				return;
+
 			/* If this is a leaf node, then do check and return. */
 			if ((node->child1 == NULL)&&(node->child2 == NULL)) {
-				//count_leaf += (node->lr.right-node->lr.left);  // Removed since was neither used nor returned to the user.
+				++leaves;
 				DistanceType worst_dist = result_set.worstDist();
 				for (IndexType i=node->node_type.lr.left; i<node->node_type.lr.right; ++i) {
 					const IndexType index = vind[i];// reorder... : i;
@@ -1242,13 +1390,13 @@ namespace nanoflann
 			}
 
 			/* Call recursively to search next level down. */
-			searchLevel(result_set, vec, bestChild, mindistsq, dists, epsError);
+			searchLevel(result_set, vec, bestChild, mindistsq, dists, epsError, leaves, max_leaves);
 
 			DistanceType dst = dists[idx];
 			mindistsq = mindistsq + cut_dist - dst;
 			dists[idx] = cut_dist;
 			if (mindistsq*epsError<=result_set.worstDist()) {
-				searchLevel(result_set, vec, otherChild, mindistsq, dists, epsError);
+				searchLevel(result_set, vec, otherChild, mindistsq, dists, epsError, leaves, max_leaves);
 			}
 			dists[idx] = dst;
 		}
@@ -1271,15 +1419,21 @@ namespace nanoflann
 		/**  Loads a previous index from a binary file.
 		  *   IMPORTANT NOTE: The set of data points is NOT stored in the file, so the index object must be constructed associated to the same source of data points used while building the index.
 		  * See the example: examples/saveload_example.cpp
+		  * Throws if the index read does not match the number of points and the dimensionality of the data points.
 		  * \sa loadIndex  */
 		void loadIndex(FILE* stream)
 		{
+			const int dim_ = dim;
 			load_value(stream, m_size);
 			load_value(stream, dim);
 			load_value(stream, root_bbox);
 			load_value(stream, m_leaf_max_size);
 			load_value(stream, vind);
 			load_tree(stream, root_node);
+			m_size_at_index_build = m_size;
+			if (m_size != dataset.kdtree_get_point_count() || vind.size() != m_size || dim != dim_ ||
+			    std::any_of(vind.begin(), vind.end(), [this](IndexType i) { return static_cast<size_t>(i) >= m_size; }))
+				throw std::runtime_error("The index does not match the data points");
 		}
 
 	};   // class KDTree
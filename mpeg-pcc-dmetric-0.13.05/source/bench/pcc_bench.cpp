@@ -0,0 +1,561 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "pcc_processing.hpp"
+#include "pcc_distortion.hpp"
+#include "pcc_report.hpp"
+
+#ifdef OPENMP_FOUND
+#include <omp.h>
+#endif
+
+#include "program-options-lite/program_options_lite.h"
+
+using namespace std;
+using namespace pcc_quality;
+using namespace pcc_processing;
+namespace po = df::program_options_lite;
+
+#define BENCH_PI 3.14159265358979323846
+
+/**!
+ * \brief
+ *  splitmix64: the same sequence on every platform, unlike the
+ *  distributions of <random>
+ */
+class benchRandom
+{
+public:
+  explicit benchRandom( uint64_t seed ) : state( seed ) {}
+  uint64_t next()
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+  double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); } //! [0, 1)
+  int below( int n ) { return int( next() % uint64_t( n ) ); }             //! [0, n)
+
+private:
+  uint64_t state;
+};
+
+struct benchPoint
+{
+  float x, y, z;
+  float nx, ny, nz;
+  unsigned char r, g, b;
+  unsigned short reflectance;
+};
+
+typedef function<void( const benchPoint & )> benchEmit;
+
+/**!
+ * \brief
+ *  A synthetic point cloud: the original (A) or the decoded (B) version,
+ *  of about the given number of points
+ */
+struct benchCloud
+{
+  string name;
+  bool bNormals;                  //! nx, ny, nz written
+  bool bColors;                   //! red, green, blue written
+  bool bReflectance;              //! reflectance written (lidar)
+  void (*generate)( long points, bool bDecoded, uint64_t seed, const benchEmit &emit );
+};
+
+static unsigned char clampColor( double v )
+{
+  return (unsigned char)( v < 0 ? 0 : v > 255 ? 255 : lround( v ) );
+}
+
+/**!
+ * \brief
+ *  Voxelized surface: the shell of a sphere, one voxel per cell of the plane
+ *  of the dominant axis of the normal, with smooth colors. The decoded
+ *  version has about 10% less points, 25% of them moved by one voxel, and
+ *  noisy colors
+ */
+static void surfaceCloud( long points, bool bDecoded, uint64_t seed, const benchEmit &emit )
+{
+  // The projections cover 4 pi R^2 E[max |n_i|] cells, E[max |n_i|] ~ 0.77
+  const int R = max( 4, int( sqrt( points / (4.0 * BENCH_PI * 0.77) ) ) );
+  benchRandom rnd( seed );
+  for (int axis = 0; axis < 3; axis++)
+    for (int sign = -1; sign <= 1; sign += 2)
+      for (int u = -R; u <= R; u++)
+        for (int v = -R; v <= R; v++)
+        {
+          const double h2 = double( R ) * R - double( u ) * u - double( v ) * v;
+          if (h2 < 0)
+            continue;
+          const int w = int( lround( sqrt( h2 ) ) );
+          if (w < max( abs( u ), abs( v ) ))
+            continue;                   // another axis is dominant
+          int c[3];
+          c[axis] = sign * w;
+          c[(axis + 1) % 3] = u;
+          c[(axis + 2) % 3] = v;
+          const double len = sqrt( double( c[0] ) * c[0] + double( c[1] ) * c[1] + double( c[2] ) * c[2] );
+
+          benchPoint p;
+          p.nx = float( c[0] / len ); p.ny = float( c[1] / len ); p.nz = float( c[2] / len );
+          p.r = clampColor( 128 + 120 * sin( c[0] * 0.05 ) );
+          p.g = clampColor( 128 + 120 * cos( c[1] * 0.07 ) );
+          p.b = clampColor( 255.0 * (c[2] + R) / (2 * R) );
+          p.reflectance = 0;
+          if (bDecoded)
+          {
+            const bool bDrop = rnd.uniform() < 0.1;
+            const bool bMove = rnd.uniform() < 0.25;
+            const int moveAxis = rnd.below( 3 );
+            const int moveSign = rnd.below( 2 ) * 2 - 1;
+            const int noise = rnd.below( 17 ) - 8;
+            if (bDrop)
+              continue;
+            if (bMove)
+              c[moveAxis] += moveSign;
+            p.r = clampColor( p.r + noise );
+            p.g = clampColor( p.g - noise );
+            p.b = clampColor( p.b + noise / 2 );
+          }
+          // Positive coordinates, as the voxelized contents
+          p.x = float( c[0] + R + 1 ); p.y = float( c[1] + R + 1 ); p.z = float( c[2] + R + 1 );
+          emit( p );
+        }
+}
+
+/**!
+ * \brief
+ *  Sparse scan of a spinning LiDAR with 64 beams, from -25 to +3 degrees of
+ *  elevation, in a street: ground 1.8 m below the sensor, walls at 7.5 m on
+ *  both sides and 60 m ahead and behind. Float coordinates, in meters. The
+ *  decoded version has 1 cm of range noise, 5% of the returns dropped and
+ *  noisy reflectances
+ */
+static void lidarCloud( long points, bool bDecoded, uint64_t seed, const benchEmit &emit )
+{
+  const int beams = 64;
+  const long steps = max<long>( 1, points / beams );
+  benchRandom rnd( seed );
+  for (long s = 0; s < steps; s++)
+  {
+    const double azimuth = 2 * BENCH_PI * s / steps;
+    for (int beam = 0; beam < beams; beam++)
+    {
+      const double elevation = (-25.0 + 28.0 * beam / (beams - 1)) * BENCH_PI / 180;
+      const double dx = cos( elevation ) * cos( azimuth );
+      const double dy = cos( elevation ) * sin( azimuth );
+      const double dz = sin( elevation );
+      double range = 120;
+      if (dz < 0)
+        range = min( range, -1.8 / dz );
+      if (fabs( dy ) > 1e-9)
+        range = min( range, 7.5 / fabs( dy ) );
+      if (fabs( dx ) > 1e-9)
+        range = min( range, 60 / fabs( dx ) );
+
+      int noise = 0;
+      if (bDecoded)
+      {
+        const bool bDrop = rnd.uniform() < 0.05;
+        range += (rnd.uniform() - 0.5) * 0.02;
+        noise = rnd.below( 401 ) - 200;
+        if (bDrop)
+          continue;
+      }
+      benchPoint p;
+      p.x = float( range * dx ); p.y = float( range * dy ); p.z = float( range * dz );
+      p.nx = p.ny = p.nz = 0;
+      p.r = p.g = p.b = 0;
+      p.reflectance = (unsigned short)( 2000 + 20000 * fabs( dz ) + 10000 / (1 + range) + noise );
+      emit( p );
+    }
+  }
+}
+
+/**!
+ * \brief
+ *  Duplicates and ties: a lattice of step 2 where every point of the
+ *  original is repeated 3 times (with different colors), and every point of
+ *  the decoded version twice, shifted by one along x, so that every point
+ *  has two nearest neighbors at the same distance
+ */
+static void tiesCloud( long points, bool bDecoded, uint64_t seed, const benchEmit &emit )
+{
+  const int side = max( 2, int( cbrt( points / 3.0 ) ) );
+  const int copies = bDecoded ? 2 : 3;
+  benchRandom rnd( seed );
+  for (int i = 0; i < side; i++)
+    for (int j = 0; j < side; j++)
+      for (int k = 0; k < side; k++)
+      {
+        // Odd offsets from the center, never zero
+        const double cx = 2 * i - side + 1, cy = 2 * j - side + 1, cz = 2 * k - side + 1;
+        const double len = sqrt( cx * cx + cy * cy + cz * cz );
+        for (int c = 0; c < copies; c++)
+        {
+          benchPoint p;
+          p.x = float( 2 * i + (bDecoded ? 1 : 0) ); p.y = float( 2 * j ); p.z = float( 2 * k );
+          p.nx = float( cx / len ); p.ny = float( cy / len ); p.nz = float( cz / len );
+          p.r = (unsigned char)rnd.below( 256 );
+          p.g = (unsigned char)( i * 8 );
+          p.b = (unsigned char)( j * 8 + c * 32 );
+          p.reflectance = 0;
+          emit( p );
+        }
+      }
+}
+
+static const benchCloud benchClouds[] = {
+  { "surface", true,  true,  false, surfaceCloud },
+  { "lidar",   false, false, true,  lidarCloud   },
+  { "dups",    true,  true,  false, tiesCloud    },
+};
+
+/**!
+ * \brief
+ *  Write a cloud to a binary ply file, generated twice: to count the points
+ *  for the header, then to write them. Returns the number of points, -1 if
+ *  the file can not be written
+ */
+static long writeCloud( const benchCloud &cloud, long points, bool bDecoded, uint64_t seed, const string &fileName )
+{
+  long count = 0;
+  cloud.generate( points, bDecoded, seed, [&count]( const benchPoint & ) { count++; } );
+
+  ofstream out( fileName, ios::binary );
+  if (!out)
+    return -1;
+  out << "ply\nformat binary_little_endian 1.0\n";
+  out << "element vertex " << count << "\n";
+  out << "property float x\nproperty float y\nproperty float z\n";
+  if (cloud.bNormals)
+    out << "property float nx\nproperty float ny\nproperty float nz\n";
+  if (cloud.bColors)
+    out << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+  if (cloud.bReflectance)
+    out << "property ushort reflectance\n";
+  out << "end_header\n";
+
+  // Little endian host assumed, as the readers of pc_error
+  vector<char> buffer;
+  buffer.reserve( 1 << 20 );
+  cloud.generate( points, bDecoded, seed, [&]( const benchPoint &p ) {
+    const float xyz[6] = { p.x, p.y, p.z, p.nx, p.ny, p.nz };
+    const char *pXyz = (const char *)xyz;
+    buffer.insert( buffer.end(), pXyz, pXyz + (cloud.bNormals ? 6 : 3) * sizeof( float ) );
+    if (cloud.bColors)
+    {
+      buffer.push_back( char( p.r ) );
+      buffer.push_back( char( p.g ) );
+      buffer.push_back( char( p.b ) );
+    }
+    if (cloud.bReflectance)
+    {
+      const char *pRef = (const char *)&p.reflectance;
+      buffer.insert( buffer.end(), pRef, pRef + sizeof( p.reflectance ) );
+    }
+    if (buffer.size() >= (1 << 20) - 64)
+    {
+      out.write( buffer.data(), buffer.size() );
+      buffer.clear();
+    }
+  } );
+  out.write( buffer.data(), buffer.size() );
+  return out ? count : -1;
+}
+
+/**!
+ * \brief
+ *  One measure: the minimum time of every phase over the repetitions,
+ *  in processing order, and the numbers of points it applies to
+ */
+struct benchRun
+{
+  vector<pair<string, double>> timings;
+  map<string, long> points;
+  qMetric metric;
+};
+
+static void keepMinimum( benchRun &run, const string &phase, double seconds )
+{
+  for (auto &t : run.timings)
+    if (t.first == phase)
+    {
+      t.second = min( t.second, seconds );
+      return;
+    }
+  run.timings.push_back( make_pair( phase, seconds ) );
+}
+
+/**!
+ * \brief
+ *  Load and evaluate the pair of files, as pc_error with -c 1 for the
+ *  colors and -l 1 for the reflectances: returns 0 if succeed
+ */
+static int runOnce( const benchCloud &cloud, const string &fileA, const string &fileB, int threads, bool bVoxelGrid, benchRun &run )
+{
+  PccPointCloud cloudA, cloudB;
+  cloudA.bVerbose = cloudB.bVerbose = false;
+  const int attributes = (cloud.bColors ? PccPointCloud::COLORS : 0) | (cloud.bNormals ? PccPointCloud::NORMALS : 0) |
+                         (cloud.bReflectance ? PccPointCloud::REFLECTANCES : 0);
+  if (cloudA.load( fileA, false, 2, 1, attributes ) || cloudB.load( fileB, false, 2, 1, attributes ))
+    return -1;
+
+  commandPar cPar;
+  cPar.file1 = fileA;
+  cPar.file2 = fileB;
+  cPar.bColor = cloud.bColors;
+  cPar.bLidar = cloud.bReflectance;
+  cPar.dropDuplicates = 2;
+  cPar.neighborsProc = 1;
+  cPar.mseSpace = 1;
+  cPar.bAverageNormals = true;
+  cPar.nbThreads = threads;
+  cPar.bVoxelGrid = bVoxelGrid;
+
+  qReport report;
+  report.addTiming( "load", cloudA.timeLoad + cloudB.timeLoad );
+  report.addTiming( "sortDedup", cloudA.timeDedup + cloudB.timeDedup );
+
+  qMetric metric;
+  if (computeQualityMetric( cloudA, cloudB, cPar, metric, &report ))
+    return -1;
+
+  for (const auto &t : report.timings)
+    keepMinimum( run, t.first, t.second );
+  run.metric = report.metricF;
+
+  // Points processed by every phase, after deduplication (see main for load and sortDedup)
+  const long sizeAB = cloudA.size + cloudB.size;
+  run.points["sameGeometry"] = cloudA.size;
+  run.points["kdtree"] = sizeAB;
+  run.points["peak"] = cloudA.size;
+  run.points["normals"] = sizeAB;
+  run.points["A2B"] = cloudA.size;
+  run.points["B2A"] = cloudB.size;
+  return 0;
+}
+
+/**!
+ * \brief
+ *  Benchmark of pc_error on synthetic point clouds, generated from a seed
+ *  so that every run measures the same data. The time of every phase is
+ *  written as csv, one row per (cloud, size, threads, phase), to be diffed
+ *  between commits.
+ */
+
+int main( int argc, char *argv[] )
+{
+  vector<string> clouds;
+  vector<long> sizes;
+  vector<int> threads;
+  int repeat;
+  int seed;
+  string dir;
+  string output;
+  bool bVoxelGrid;
+  bool bKeepFiles;
+
+  bool print_help = false;
+  po::Options opts;
+  po::ErrorReporter err;
+  opts.addOptions()
+     ("help",      print_help, false,                 "This help text")
+     ("clouds",    clouds,     vector<string>( { "surface", "lidar", "dups" } ),
+                                                      "Synthetic clouds, separated by commas: surface, lidar, dups" )
+     ("points",    sizes,      vector<long>( { 10000, 100000, 1000000 } ),
+                                                      "Approximate sizes of the clouds, separated by commas" )
+     ("threads",   threads,    vector<int>(),         "Numbers of threads, separated by commas (default: 1, 2, 4, ... "
+                                                      "up to the number of processors)" )
+     ("repeat",    repeat,     1,                     "Runs of every measure, the minimum time of each phase is kept" )
+     ("seed",      seed,       1,                     "Seed of the generators" )
+     ("dir",       dir,        string( "." ),         "Directory of the generated ply files" )
+     ("keepFiles", bKeepFiles, false,                 "Keep the generated ply files" )
+     ("voxelGrid", bVoxelGrid, true,                  "Search the nearest neighbors in voxel grids rather than "
+                                                      "kd-trees when all the coordinates are integers" )
+     ("output",    output,     string( "" ),          "Csv file of the timings (default: standard output)" );
+
+  setDefaults( opts );
+  const list<const char *> &argv_unhandled = scanArgv( opts, argc, (const char **)argv, err );
+  if (err.is_errored)
+    print_help = true;
+  for (const auto arg : argv_unhandled)
+  {
+    err.warn() << "Unhandled argument ignored: " << arg << "\n";
+    print_help = true;
+  }
+  for (const auto &name : clouds)
+    if (none_of( begin( benchClouds ), end( benchClouds ), [&]( const benchCloud &c ) { return c.name == name; } ))
+    {
+      err.error() << "Unknown cloud: " << name << "\n";
+      print_help = true;
+    }
+  if (repeat < 1 || any_of( sizes.begin(), sizes.end(), []( long n ) { return n < 1; } ) ||
+      any_of( threads.begin(), threads.end(), []( int n ) { return n < 1; } ))
+  {
+    err.error() << "repeat, points and threads must be positive \n";
+    print_help = true;
+  }
+  if (print_help)
+  {
+    cout << endl << "Usage: pc_error_bench [options] " << endl << endl << "Options: " << endl;
+    doHelp( cout, opts, 78 );
+    return 0;
+  }
+
+  if (threads.empty())
+  {
+#ifdef OPENMP_FOUND
+    const int procs = omp_get_num_procs();
+#else
+    const int procs = 1;
+#endif
+    for (int n = 1; n < procs; n *= 2)
+      threads.push_back( n );
+    threads.push_back( procs );
+  }
+#ifndef OPENMP_FOUND
+  if (threads != vector<int>( threads.size(), 1 ))
+    cerr << "Warning: OpenMP is not found, multi-threading is disabled." << endl;
+#endif
+
+  ofstream outFile;
+  if (output != "")
+  {
+    outFile.open( output );
+    if (!outFile)
+    {
+      cerr << "Error: can not write " << output << endl;
+      return -1;
+    }
+  }
+  ostream &out = output != "" ? outFile : cout;
+
+  out << "# pc_error_bench, version " << PCC_QUALITY_VERSION << ", seed " << seed
+      << ", voxelGrid " << bVoxelGrid << ", repeat " << repeat << endl;
+  out << "cloud,points,threads,phase,seconds,mpoints_per_s,speedup" << endl;
+
+  for (const auto &name : clouds)
+  {
+    const benchCloud &cloud = *find_if( begin( benchClouds ), end( benchClouds ),
+                                        [&]( const benchCloud &c ) { return c.name == name; } );
+    for (long size : sizes)
+    {
+      const string base = dir + "/pc_error_bench_" + name + "_" + to_string( size );
+      const string fileA = base + "_A.ply", fileB = base + "_B.ply";
+      const long recordsA = writeCloud( cloud, size, false, uint64_t( seed ), fileA );
+      const long recordsB = writeCloud( cloud, size, true, uint64_t( seed ) + 1, fileB );
+      if (recordsA < 0 || recordsB < 0)
+      {
+        cerr << "Error: can not write " << fileA << " and " << fileB << endl;
+        return -1;
+      }
+
+      // The metrics change when the behavior does, not when the timings do
+      map<string, double> reference;
+      for (int nbThreads : threads)
+      {
+#ifdef OPENMP_FOUND
+        omp_set_dynamic( 0 );
+        omp_set_num_threads( nbThreads );
+#endif
+        benchRun run;
+        for (int r = 0; r < repeat; r++)
+          if (runOnce( cloud, fileA, fileB, nbThreads, bVoxelGrid, run ))
+          {
+            cerr << "Error: can not read " << fileA << " or " << fileB << endl;
+            return -1;
+          }
+        run.points["load"] = recordsA + recordsB;
+        run.points["sortDedup"] = recordsA + recordsB;
+
+        if (nbThreads == threads.front())
+        {
+          char line[256];
+          snprintf( line, sizeof( line ), "# %s,%ld: %ld and %ld points, c2c %.4f dB, c2p %.4f dB, %s %.4f dB",
+                    name.c_str(), size, recordsA, recordsB, run.metric.c2c_psnr, cloud.bNormals ? run.metric.c2p_psnr : 0.0f,
+                    cloud.bReflectance ? "reflectance" : "c[0]",
+                    cloud.bReflectance ? run.metric.reflectance_psnr : run.metric.color_psnr[0] );
+          out << line << endl;
+        }
+
+        double total = 0;
+        for (const auto &t : run.timings)
+          total += t.second;
+        run.timings.push_back( make_pair( string( "total" ), total ) );
+        run.points["total"] = recordsA + recordsB;
+
+        for (const auto &t : run.timings)
+        {
+          if (nbThreads == threads.front())
+            reference[t.first] = t.second;
+          const long points = run.points.count( t.first ) ? run.points[t.first] : recordsA + recordsB;
+          char line[256];
+          snprintf( line, sizeof( line ), "%s,%ld,%d,%s,%.6f,%.3f,%.2f", name.c_str(), size, nbThreads, t.first.c_str(),
+                    t.second, t.second > 0 ? points / t.second * 1e-6 : 0.0,
+                    t.second > 0 ? reference[t.first] / t.second : 1.0 );
+          out << line << endl;
+        }
+      }
+      if (!bKeepFiles)
+      {
+        remove( fileA.c_str() );
+        remove( fileB.c_str() );
+      }
+    }
+  }
+  return 0;
+}
@@ -1,3 +1,4 @@
+#include <chrono>
 #include "clockcom.hpp"
 
 #ifndef _WIN32
@@ -10,3 +11,8 @@ unsigned long GetTickCount()
   return (tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
 #endif
+
+double GetWallClock()
+{
+  return std::chrono::duration<double>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
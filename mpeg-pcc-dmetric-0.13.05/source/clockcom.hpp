@@ -12,5 +12,8 @@
 unsigned long GetTickCount();
 #endif
 
+//! Wall clock time in seconds, to measure durations
+double GetWallClock();
+
 
 #endif
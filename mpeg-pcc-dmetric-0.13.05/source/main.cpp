@@ -38,10 +38,19 @@
  *
  */
 
+#include <climits>
+#include <cstdio>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "pcc_processing.hpp"
+#include "pcc_cache.hpp"
 #include "pcc_distortion.hpp"
+#include "pcc_report.hpp"
 #include "clockcom.hpp"
 
 #ifdef OPENMP_FOUND
@@ -90,6 +99,33 @@ void printUsage( //int ac, char * av[],
 
 }
 
+/**!
+ * \brief
+ *  File name of a frame of a sequence: the pattern, in printf style, with
+ *  the frame number (e.g. "frame_%04d.ply"). A name without conversion is
+ *  used for all the frames. Empty if the pattern is not valid.
+ */
+static string frameFileName( const string &pattern, int frame )
+{
+  // At most one integer conversion, besides "%%"
+  int nbConversions = 0;
+  for (size_t i = pattern.find( '%' ); i != string::npos; i = pattern.find( '%', i + 1 ))
+  {
+    if (i + 1 < pattern.size() && pattern[i + 1] == '%')
+    {
+      i++;
+      continue;
+    }
+    const size_t j = pattern.find_first_not_of( "0123456789-+ #", i + 1 );
+    if (j == string::npos || pattern[j] != 'd' || ++nbConversions > 1)
+      return "";
+  }
+  const int length = snprintf( nullptr, 0, pattern.c_str(), frame );
+  vector<char> name( length + 1 );
+  snprintf( name.data(), name.size(), pattern.c_str(), frame );
+  return string( name.data() );
+}
+
 int parseCommand( int ac, char * av[], commandPar &cPar )
 {
   bool print_help = ac == 1;
@@ -101,12 +137,18 @@ int parseCommand( int ac, char * av[], commandPar &cPar )
 
        ("a,fileA",        cPar.file1,           string(""), "Input file 1, original version" )
        ("b,fileB",        cPar.file2,           string(""), "Input file 2, processed version" )
+       ("fileBList",      cPar.fileBList,       vector<string>(), "Processed versions of file 1, separated by commas, "
+                                                            "each one evaluated against the same reference (replaces fileB)" )
        ("n,inputNorm",    cPar.normIn,          string(""), "File name to import the normals of original point "
                                                             "cloud, if different from original file 1n" )
 
        ("s,singlePass",   cPar.singlePass,      false,      "Force running a single pass, where the loop "
                                                             "is over the original point cloud" )
        ("d,hausdorff",    cPar.hausdorff,       false,      "Send the Haursdorff metric as well" )
+       ("hausdorffOnly",  cPar.hausdorffOnly,   false,      "Only compute the point-to-point Hausdorff metric, "
+                                                            "with an early break search" )
+       ("quantiles",      cPar.bQuantiles,      false,      "Send the p50, p90, p99 and p99.9 quantiles of the point "
+                                                            "errors as well" )
        ("c,color",        cPar.bColor,          false,      "Check color distortion as well" )
        ("l,lidar",        cPar.bLidar,          false,      "Check lidar reflectance as well" )
        ("r,resolution",   cPar.resolution,      0.0f,       "Specify the intrinsic resolution" )
@@ -118,7 +160,32 @@ int parseCommand( int ac, char * av[], commandPar &cPar )
                                                             "with same geometric distance)" )
        ("mseSpace",       cPar.mseSpace,        1,          "Colour space used for PSNR calculation\n"
                                                             "0: none (identity) 1: ITU-R BT.709 8: YCgCo-R")
-       ("nbThreads",      cPar.nbThreads,       1,          "Number of threads used for parallel processing" );
+       ("nbThreads",      cPar.nbThreads,       1,          "Number of threads used for parallel processing" )
+       ("concurrentPasses", cPar.concurrentPasses, false,   "Run the A->B and B->A passes concurrently, sharing "
+                                                            "the threads" )
+       ("voxelGrid",      cPar.bVoxelGrid,      true,       "Search the nearest neighbors in voxel grids rather "
+                                                            "than kd-trees when all the coordinates are integers" )
+       ("approxEps",      cPar.approxEps,       0.0f,       "Approximate kd-tree search: the neighbors found are within "
+                                                            "(1 + approxEps) times the distance of the nearest ones (0: exact)" )
+       ("approxLeaves",   cPar.approxLeaves,    0,          "Approximate kd-tree search: maximum number of leaves checked "
+                                                            "per query (0: no limit)" )
+       ("approxSamples",  cPar.approxSamples,   1000,       "Number of points searched exactly to estimate the bias of "
+                                                            "the metrics of the approximate search" )
+       ("memoryBudget",   cPar.memoryBudget,    0,          "Memory for the point clouds in MB: evaluate them by tiles "
+                                                            "along x, with tileHalo (0: load them in memory)" )
+       ("tileHalo",       cPar.tileHalo,        0.0f,       "Largest nearest neighbor distance expected between the point "
+                                                            "clouds, the margin of the tiles (checked)" )
+       ("tileDir",        cPar.tileDir,         string(""), "Directory of the temporary files of the tiles (default: "
+                                                            "the system temporary directory)" )
+       ("firstFrame",     cPar.firstFrame,      0,          "First frame number of the sequence (see frameCount)" )
+       ("frameCount",     cPar.frameCount,      0,          "Number of frames of a sequence: fileA, fileB and inputNorm "
+                                                            "are then patterns of the frame number, e.g. frame_%04d.ply" )
+       ("cacheDir",       cPar.cacheDir,        string(""), "Directory of the sidecar files of the reference (fileA and "
+                                                            "inputNorm): preprocessed point cloud, peak value and kd-tree, "
+                                                            "read by the next runs on the same files" )
+       ("resultFile",     cPar.resultFile,      string(""), "Write all the metrics and the time of each processing "
+                                                            "phase to this file" )
+       ("resultFormat",   cPar.resultFormat,    string("json"), "Format of resultFile: json or csv" );
 
     setDefaults(opts);
     const list<const char *> &argv_unhandled = scanArgv(opts, ac, (const char **)av, err);
@@ -128,7 +195,18 @@ int parseCommand( int ac, char * av[], commandPar &cPar )
       print_help = true;
     }
     if( cPar.file1 == "" ) { err.error() << "File 1 parameters not correct \n"; print_help = true; }
-    if( cPar.file2 == "" ) { err.error() << "File 2 parameters not correct \n"; print_help = true; }
+    if( cPar.file2 == "" && cPar.fileBList.empty() ) { err.error() << "File 2 parameters not correct \n"; print_help = true; }
+    if( cPar.file2 != "" && !cPar.fileBList.empty() ) { err.error() << "fileB and fileBList can not be used together \n"; print_help = true; }
+    if( cPar.hausdorffOnly && (cPar.bColor || cPar.bLidar || cPar.bQuantiles) ) { err.error() << "hausdorffOnly can not be used with color, lidar or quantiles \n"; print_help = true; }
+    if( cPar.memoryBudget < 0 || (cPar.memoryBudget > 0 && cPar.tileHalo <= 0) ) { err.error() << "memoryBudget needs a positive tileHalo \n"; print_help = true; }
+    if( cPar.memoryBudget > 0 && (!cPar.fileBList.empty() || cPar.hausdorffOnly) ) { err.error() << "memoryBudget can not be used with fileBList or hausdorffOnly \n"; print_help = true; }
+    if( cPar.approxEps < 0 || cPar.approxLeaves < 0 || cPar.approxSamples < 0 ) { err.error() << "approxEps, approxLeaves and approxSamples can not be negative \n"; print_help = true; }
+    if( (cPar.approxEps > 0 || cPar.approxLeaves > 0) && (cPar.memoryBudget > 0 || cPar.hausdorffOnly) ) { err.error() << "approxEps and approxLeaves can not be used with memoryBudget or hausdorffOnly \n"; print_help = true; }
+    if( cPar.cacheDir != "" && (cPar.memoryBudget > 0 || cPar.frameCount > 0) ) { err.error() << "cacheDir can not be used with memoryBudget or frameCount \n"; print_help = true; }
+    if( cPar.frameCount < 0 || (cPar.frameCount > 0 && (!cPar.fileBList.empty() || cPar.memoryBudget > 0)) ) { err.error() << "frameCount can not be used with fileBList or memoryBudget \n"; print_help = true; }
+    if( cPar.frameCount > 0 && (frameFileName( cPar.file1, 0 ) == "" || frameFileName( cPar.file2, 0 ) == "" ||
+                                (cPar.normIn != "" && frameFileName( cPar.normIn, 0 ) == "")) ) { err.error() << "The frame patterns take one integer, e.g. %04d \n"; print_help = true; }
+    if( cPar.resultFormat != "json" && cPar.resultFormat != "csv" ) { err.error() << "resultFormat must be json or csv \n"; print_help = true; }
   }
   catch(std::exception& e) {
     cout << e.what() << "\n";
@@ -138,6 +216,11 @@ int parseCommand( int ac, char * av[], commandPar &cPar )
     printUsage( opts );
     return false;
   }
+  // The voxel grid searches are always exact: the approximate searches need the kd-trees
+  if( (cPar.approxEps > 0 || cPar.approxLeaves > 0) && cPar.bVoxelGrid ) {
+    cout << "Notice: approxEps and approxLeaves disable the voxel grid (voxelGrid=0)" << endl;
+    cPar.bVoxelGrid = false;
+  }
   // Check whether your system is compatible with my assumptions
   int szFloat  = sizeof(float)*8;
   int szDouble = sizeof(double)*8;
@@ -164,10 +247,17 @@ int parseCommand( int ac, char * av[], commandPar &cPar )
 void printCommand( commandPar &cPar )
 {
   cout << "infile1:        " << cPar.file1            << endl;
-  cout << "infile2:        " << cPar.file2            << endl;
+  if (cPar.fileBList.empty())
+    cout << "infile2:        " << cPar.file2            << endl;
+  for (size_t k = 0; k < cPar.fileBList.size(); k++)
+    cout << "infile2[" << k << "]:     " << cPar.fileBList[k] << endl;
   cout << "normal1:        " << cPar.normIn           << endl;
   cout << "singlePass:     " << cPar.singlePass       << endl;
   cout << "hausdorff:      " << cPar.hausdorff        << endl;
+  if (cPar.hausdorffOnly)
+    cout << "hausdorffOnly:  " << cPar.hausdorffOnly    << endl;
+  if (cPar.bQuantiles)
+    cout << "quantiles:      " << cPar.bQuantiles       << endl;
   cout << "color:          " << cPar.bColor           << endl;
   cout << "lidar:          " << cPar.bLidar           << endl;
   cout << "resolution:     " << cPar.resolution       << endl;
@@ -176,12 +266,320 @@ void printCommand( commandPar &cPar )
   cout << "averageNormals: " << cPar.bAverageNormals  << endl;
   cout << "mseSpace:       " << cPar.mseSpace         << endl;
   cout << "nbThreads:      " << cPar.nbThreads        << endl;
+  cout << "concurrentPasses: " << cPar.concurrentPasses << endl;
+  cout << "voxelGrid:      " << cPar.bVoxelGrid       << endl;
+  if (cPar.approxEps > 0 || cPar.approxLeaves > 0)
+  {
+    cout << "approxEps:      " << cPar.approxEps        << endl;
+    cout << "approxLeaves:   " << cPar.approxLeaves     << endl;
+    cout << "approxSamples:  " << cPar.approxSamples    << endl;
+  }
+  if (cPar.memoryBudget > 0)
+  {
+    cout << "memoryBudget:   " << cPar.memoryBudget     << endl;
+    cout << "tileHalo:       " << cPar.tileHalo         << endl;
+    if (cPar.tileDir != "")
+      cout << "tileDir:        " << cPar.tileDir          << endl;
+  }
+  if (cPar.frameCount > 0)
+  {
+    cout << "firstFrame:     " << cPar.firstFrame       << endl;
+    cout << "frameCount:     " << cPar.frameCount       << endl;
+  }
+  if (cPar.cacheDir != "")
+    cout << "cacheDir:       " << cPar.cacheDir         << endl;
+  if (cPar.resultFile != "")
+    cout << "resultFile:     " << cPar.resultFile << " (" << cPar.resultFormat << ")" << endl;
   if (cPar.singlePass) {
     cout << "force running a single pass" << endl;
   }
   cout << endl;
 }
 
+/**!
+ * \brief
+ *  The attributes to load in the point clouds (PccPointCloud::Attributes):
+ *  the colors and reflectances, if measured
+ */
+static int measuredAttributes( const commandPar &cPar )
+{
+  return (cPar.bColor ? PccPointCloud::COLORS : 0) |
+         (cPar.bLidar ? PccPointCloud::REFLECTANCES : 0);
+}
+
+/**!
+ * \brief
+ *  Write the sidecars of the reference, once its peak value and kd-tree
+ *  are computed. A failure only costs the next run the preprocessing
+ */
+static void saveCaches( PccCache &cache1, const PccPointCloud &inCloud1, PccCache &cacheNormal1, const PccPointCloud &inNormal1 )
+{
+  if (cache1.save( inCloud1 ) != 0)
+    cout << "Warning: could not write the sidecar: " << cache1.fileName() << endl;
+  if (inNormal1.size > 0 && cacheNormal1.save( inNormal1 ) != 0)
+    cout << "Warning: could not write the sidecar: " << cacheNormal1.fileName() << endl;
+}
+
+/**!
+ * \brief
+ *  Run the parallel regions of a background loader with a single thread:
+ *  the evaluation running meanwhile already uses nbThreads
+ */
+static void setBackgroundThreads()
+{
+#ifdef OPENMP_FOUND
+  omp_set_dynamic(0);
+  omp_set_num_threads(1);
+#endif
+}
+
+/**!
+ * \brief
+ *  A candidate of fileBList, loaded in background: the messages of its
+ *  loading are kept until it is evaluated
+ */
+struct candidateCloud
+{
+  PccPointCloud cloud;
+  ostringstream messages;
+  int status;                   //! PccPointCloud::load() result
+};
+
+static std::future<unique_ptr<candidateCloud>> loadCandidateAsync( const commandPar &cPar, size_t k )
+{
+  return std::async( std::launch::async, [&cPar, k]()
+  {
+    setBackgroundThreads();
+    unique_ptr<candidateCloud> cand( new candidateCloud );
+    cand->cloud.log = &cand->messages;
+    cand->status = cand->cloud.load( cPar.fileBList[k], false, cPar.dropDuplicates, cPar.neighborsProc, measuredAttributes( cPar ) );
+    return cand;
+  } );
+}
+
+/**!
+ * \brief
+ *  Evaluate every cloud of fileBList against the same reference: the
+ *  reference is loaded, deduplicated and indexed once, its peak value is
+ *  computed once, and the next candidate is loaded by a background thread
+ *  while the current one is evaluated. The timings of the reference side
+ *  steps are reported with the first candidate.
+ */
+int evaluateCandidates( PccPointCloud &inCloud1, PccPointCloud &inNormal1, const commandPar &cPar, const qReport &reference )
+{
+  const int t0 = GetTickCount();
+  std::future<unique_ptr<candidateCloud>> next = loadCandidateAsync( cPar, 0 );
+  qReport report = reference;
+  double t = GetWallClock();
+  const float pPSNR = computePeakValue( inCloud1, cPar );
+  report.addTiming( "peak", GetWallClock() - t );
+  vector<qReport> reports;
+  int ret = 0;
+
+  for (size_t k = 0; k < cPar.fileBList.size(); k++)
+  {
+    t = GetWallClock();
+    unique_ptr<candidateCloud> cand = next.get();
+    const double tWait = GetWallClock() - t;
+    if (k + 1 < cPar.fileBList.size())
+      next = loadCandidateAsync( cPar, k + 1 );
+
+    cout << endl << "Candidate " << k << ": " << cPar.fileBList[k] << endl << cand->messages.str();
+    if (cand->status)
+    {
+      cout << "Error reading the second point cloud: " << cPar.fileBList[k] << endl;
+      ret = -1;
+      continue;
+    }
+    PccPointCloud &inCloud2 = cand->cloud;
+    cout << "Reading file 2 done." << endl;
+    report.addTiming( "loadB", inCloud2.timeLoad );
+    report.addTiming( "dedupB", inCloud2.timeDedup );
+    report.addTiming( "loadWait", tWait );
+
+    // computeQualityMetric may disable the color/reflectance metrics
+    commandPar candPar = cPar;
+    candPar.file2 = cPar.fileBList[k];
+    qMetric qm;
+    computeQualityMetric(inCloud1, inNormal1, inCloud2, candPar, pPSNR, qm, &report);
+    reports.push_back( report );
+    report = qReport();
+  }
+
+  const int t1 = GetTickCount();
+  cout << "Job done! " << (t1 - t0) * 1e-3 << " seconds elapsed (including the time to load the processed point clouds)." << endl;
+  if (cPar.resultFile != "" && writeReports( cPar.resultFile, cPar.resultFormat, reports ))
+    ret = -1;
+  return ret;
+}
+
+/**!
+ * \brief
+ *  Point clouds of a frame of a sequence, with the parameters of the frame
+ *  (its file names)
+ */
+struct sequenceFrame
+{
+  commandPar cPar;
+  PccPointCloud cloudA;
+  PccPointCloud cloudB;
+  PccPointCloud normalsA;       //! normals of A, if read from another file
+  PccPointCloud *pNormalsA;
+  string failedFile;            //! file that could not be read, if any
+};
+
+/**!
+ * \brief
+ *  Load the point clouds of frame "n" of a sequence, as main() loads the
+ *  ones of a single evaluation, without messages as it runs in background
+ */
+static void loadFrame( sequenceFrame &frame, const commandPar &cPar, int n )
+{
+  frame.cPar = cPar;
+  frame.cPar.file1 = frameFileName( cPar.file1, n );
+  frame.cPar.file2 = frameFileName( cPar.file2, n );
+  frame.cPar.normIn = frameFileName( cPar.normIn, n );
+  frame.cloudA.bVerbose = frame.cloudB.bVerbose = frame.normalsA.bVerbose = false;
+  frame.pNormalsA = &frame.cloudA;
+
+  const int attributesB = measuredAttributes( cPar );
+  const bool bNormalsA = frame.cPar.normIn == "" || frame.cPar.normIn == frame.cPar.file1;
+  if (frame.cloudA.load( frame.cPar.file1, false, cPar.dropDuplicates, cPar.neighborsProc,
+                         attributesB | (bNormalsA ? PccPointCloud::NORMALS : 0) ))
+    frame.failedFile = frame.cPar.file1;
+  else if (!bNormalsA && frame.normalsA.load( frame.cPar.normIn, true, cPar.dropDuplicates ))
+    frame.failedFile = frame.cPar.normIn;
+  else if (frame.cloudB.load( frame.cPar.file2, false, cPar.dropDuplicates, cPar.neighborsProc, attributesB ))
+    frame.failedFile = frame.cPar.file2;
+  if (!bNormalsA)
+    frame.pNormalsA = &frame.normalsA;
+  frame.cPar.c2c_only = !frame.pNormalsA->bNormal || cPar.hausdorffOnly;
+}
+
+/**!
+ * \brief
+ *  Print the average of the final metrics of the frames of a sequence
+ */
+static void printAverage( const qReport &average, int nbFrames )
+{
+  const commandPar &cPar = average.cPar;
+  const qMetric &m = cPar.singlePass ? average.metricA : average.metricF;
+  cout << endl << "Sequence average over " << nbFrames << " frames" << (cPar.singlePass ? " (A->B).\n" : " (symmetric).\n");
+  if (!cPar.hausdorffOnly)
+  {
+    cout << "   mseF      (p2point): " << m.c2c_mse << endl;
+    cout << "   mseF,PSNR (p2point): " << m.c2c_psnr << endl;
+    if (!cPar.c2c_only)
+    {
+      cout << "   mseF      (p2plane): " << m.c2p_mse << endl;
+      cout << "   mseF,PSNR (p2plane): " << m.c2p_psnr << endl;
+    }
+  }
+  if (cPar.hausdorff)
+  {
+    cout << "   h.        (p2point): " << m.c2c_hausdorff << endl;
+    cout << "   h.,PSNR   (p2point): " << m.c2c_hausdorff_psnr << endl;
+    if (!cPar.c2c_only)
+    {
+      cout << "   h.        (p2plane): " << m.c2p_hausdorff << endl;
+      cout << "   h.,PSNR   (p2plane): " << m.c2p_hausdorff_psnr << endl;
+    }
+  }
+  if (cPar.bColor)
+  {
+    for (int c = 0; c < 3; c++)
+      cout << "   c[" << c << "],    F         : " << m.color_mse[c] << endl;
+    for (int c = 0; c < 3; c++)
+      cout << "   c[" << c << "],PSNRF         : " << m.color_psnr[c] << endl;
+  }
+  if (cPar.bLidar)
+  {
+    cout << "   r,       F         : " << m.reflectance_mse << endl;
+    cout << "   r,PSNR   F         : " << m.reflectance_psnr << endl;
+  }
+}
+
+/**!
+ * \brief
+ *  Evaluate the frames of a sequence (frameCount): the point clouds of the
+ *  next frame are loaded by a background thread while the current frame is
+ *  evaluated. The metrics of every frame are reported, then their average
+ *  (the last report of resultFile, with the file name patterns).
+ */
+int evaluateSequence( commandPar &cPar )
+{
+#ifdef __GLIBC__
+  // Keep the memory freed by a frame in the heap for the next frames, rather
+  // than unmapping the buffers and faulting them in again every frame. glibc
+  // caps the mmap threshold at 32 MB (64-bit): larger buffers, e.g. the
+  // points of clouds of more than about 2.8M points, are still mapped anew
+  mallopt( M_MMAP_THRESHOLD, 32 << 20 );
+  mallopt( M_TRIM_THRESHOLD, INT_MAX );
+#endif
+  if (cPar.hausdorffOnly)
+    cPar.hausdorff = true;
+
+  const int t0 = GetTickCount();
+  auto loadAsync = [&cPar]( int n )
+  {
+    return std::async( std::launch::async, [&cPar, n]()
+    {
+      setBackgroundThreads();
+      unique_ptr<sequenceFrame> frame( new sequenceFrame );
+      loadFrame( *frame, cPar, n );
+      return frame;
+    } );
+  };
+
+  vector<qReport> reports;
+  std::future<unique_ptr<sequenceFrame>> next = loadAsync( cPar.firstFrame );
+  for (int k = 0; k < cPar.frameCount; k++)
+  {
+    const int n = cPar.firstFrame + k;
+    const double t = GetWallClock();
+    unique_ptr<sequenceFrame> frame = next.get();
+    const double tWait = GetWallClock() - t;
+    cout << endl << "Frame " << n << ": " << frame->cPar.file1 << ", " << frame->cPar.file2 << endl;
+    if (frame->failedFile != "")
+    {
+      cout << "Error reading the point cloud of frame " << n << ": " << frame->failedFile << endl;
+      return -1;
+    }
+    if (k + 1 < cPar.frameCount)
+      next = loadAsync( n + 1 );
+    qReport report;
+    report.addTiming( "loadA", frame->cloudA.timeLoad );
+    report.addTiming( "dedupA", frame->cloudA.timeDedup );
+    if (frame->pNormalsA != &frame->cloudA)
+    {
+      report.addTiming( "loadNormalsA", frame->normalsA.timeLoad );
+      report.addTiming( "dedupNormalsA", frame->normalsA.timeDedup );
+    }
+    report.addTiming( "loadB", frame->cloudB.timeLoad );
+    report.addTiming( "dedupB", frame->cloudB.timeDedup );
+    report.addTiming( "loadWait", tWait );
+
+    qMetric qm;
+    computeQualityMetric( frame->cloudA, *frame->pNormalsA, frame->cloudB, frame->cPar, qm, &report );
+    reports.push_back( report );
+    cout << "Frame " << n << " done: " << GetWallClock() - t << " seconds, including " << tWait
+         << " waiting for the point clouds." << endl;
+  }
+
+  qReport average = averageReports( reports );
+  average.cPar.file1 = cPar.file1;
+  average.cPar.file2 = cPar.file2;
+  average.cPar.normIn = cPar.normIn;
+  printAverage( average, cPar.frameCount );
+  reports.push_back( average );
+
+  const int t1 = GetTickCount();
+  cout << "Job done! " << (t1 - t0) * 1e-3 << " seconds elapsed (including the time to load the point clouds)." << endl;
+  if (cPar.resultFile != "" && writeReports( cPar.resultFile, cPar.resultFormat, reports ))
+    return -1;
+  return 0;
+}
+
 int main (int argc, char *argv[])
 {
   // Print the version information
@@ -203,6 +601,25 @@ int main (int argc, char *argv[])
 #else
   printf("Warning: OpenMP is not found, multi-threading is disabled. \n");
 #endif
+
+  if (cPar.frameCount > 0)
+    return evaluateSequence( cPar );
+
+  // Clouds larger than the memory budget: evaluation by tiles, from the files
+  if (cPar.memoryBudget > 0)
+  {
+    const int t0 = GetTickCount();
+    qReport report;
+    qMetric qm;
+    if (computeTiledQualityMetric( cPar, qm, &report ))
+      return -1;
+    const int t1 = GetTickCount();
+    cout << "Job done! " << (t1 - t0) * 1e-3 << " seconds elapsed (including the time to read the point clouds)." << endl;
+    if (cPar.resultFile != "" && writeReports( cPar.resultFile, cPar.resultFormat, vector<qReport>( 1, report ) ))
+      return -1;
+    return 0;
+  }
+
   PccPointCloud inCloud1;
   PccPointCloud inCloud2;
   PccPointCloud inNormal1;
@@ -210,12 +627,25 @@ int main (int argc, char *argv[])
   // Normals may come from either a seperate file, or from file1(a).
   PccPointCloud* pNormal1 = &inCloud1;
 
-  if (inCloud1.load(cPar.file1, false, cPar.dropDuplicates, cPar.neighborsProc))
+  // The normals of A are used unless read from another file
+  const int attributesB = measuredAttributes( cPar );
+  const bool bNormalsA = cPar.normIn == "" || cPar.normIn == cPar.file1;
+  const int attributesA = attributesB | (bNormalsA ? PccPointCloud::NORMALS : 0);
+  PccCache cache1( cPar.cacheDir, cPar.file1, false, cPar.dropDuplicates, cPar.neighborsProc, attributesA );
+  PccCache cacheNormal1( cPar.cacheDir, cPar.normIn, true, cPar.dropDuplicates, 0, PccPointCloud::ALL );
+  if (cache1.load( inCloud1 ) == 0)
+    cout << "Reading file 1 done, from the sidecar: " << cache1.fileName() << endl;
+  else if (inCloud1.load(cPar.file1, false, cPar.dropDuplicates, cPar.neighborsProc, attributesA))
   {
     cout << "Error reading reference point cloud:" << cPar.file1 << endl;
     return -1;
   }
-  cout << "Reading file 1 done." << endl;
+  else
+    cout << "Reading file 1 done." << endl;
+
+  qReport report;
+  report.addTiming( "loadA", inCloud1.timeLoad );
+  report.addTiming( "dedupA", inCloud1.timeDedup );
 
   // NB: no need to load the normals again if they will be loaded from a
   //     previously loaded file.
@@ -225,34 +655,50 @@ int main (int argc, char *argv[])
   }
   else if (cPar.normIn != "")
   {
-    if (inNormal1.load(cPar.normIn, true, cPar.dropDuplicates))
+    if (cacheNormal1.load( inNormal1 ) != 0 && inNormal1.load(cPar.normIn, true, cPar.dropDuplicates))
     {
       cout << "Error reading normal reference point cloud:" << cPar.normIn << endl;
       return -1;
     }
     cout << "Reading normal 1 done." << endl;
     pNormal1 = &inNormal1;
+    report.addTiming( "loadNormalsA", inNormal1.timeLoad );
+    report.addTiming( "dedupNormalsA", inNormal1.timeDedup );
   }
 
   // If no normals are available, can't do plane2plane
-  cPar.c2c_only = !pNormal1->bNormal;
+  cPar.c2c_only = !pNormal1->bNormal || cPar.hausdorffOnly;
+  if (cPar.hausdorffOnly)
+    cPar.hausdorff = true;
+
+  if (!cPar.fileBList.empty())
+  {
+    const int ret = evaluateCandidates( inCloud1, *pNormal1, cPar, report );
+    saveCaches( cache1, inCloud1, cacheNormal1, inNormal1 );
+    return ret;
+  }
 
   if (cPar.file2 != "")
   {
-    if (inCloud2.load(cPar.file2, false, cPar.dropDuplicates, cPar.neighborsProc))
+    if (inCloud2.load(cPar.file2, false, cPar.dropDuplicates, cPar.neighborsProc, attributesB))
     {
       cout << "Error reading the second point cloud: " << cPar.file2 << endl;
       return -1;
     }
     cout << "Reading file 2 done." << endl;
+    report.addTiming( "loadB", inCloud2.timeLoad );
+    report.addTiming( "dedupB", inCloud2.timeDedup );
   }
 
   // compute the point to plane distances, as well as point to point distances
   const int t0 = GetTickCount();
   qMetric qm;
-  computeQualityMetric(inCloud1, *pNormal1, inCloud2, cPar, qm);
+  computeQualityMetric(inCloud1, *pNormal1, inCloud2, cPar, qm, &report);
 
   const int t1 = GetTickCount();
   cout << "Job done! " << (t1 - t0) * 1e-3 << " seconds elapsed (excluding the time to load the point clouds)." << endl;
+  saveCaches( cache1, inCloud1, cacheNormal1, inNormal1 );
+  if (cPar.resultFile != "" && writeReports( cPar.resultFile, cPar.resultFormat, vector<qReport>( 1, report ) ))
+    return -1;
   return 0;
 }
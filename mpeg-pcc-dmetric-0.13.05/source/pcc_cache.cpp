@@ -0,0 +1,407 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sys/stat.h>
+
+#include "pcc_cache.hpp"
+#include "clockcom.hpp"
+
+#if _WIN32
+#define stat64 _stat64
+#define fseeko _fseeki64
+#endif
+
+using namespace std;
+using namespace pcc_processing;
+
+// Version of the layout of the sidecar files, to be increased whenever it
+// changes, or when the loading gives different arrays
+#define PCC_CACHE_VERSION 2
+
+// Bytes hashed by a single thread
+#define PCC_CACHE_HASH_BLOCK (1 << 20)
+
+/*
+ ***********************************************
+   Implementation of local functions
+ ***********************************************
+ */
+
+enum cacheFlags { CACHE_RGB = 1,
+                  CACHE_NORMALS = 2,
+                  CACHE_REFLECTANCES = 4,
+                  CACHE_NBDUP = 8,
+                  CACHE_VOXELIZED = 16,
+                  CACHE_XYZ16 = 32,     //! coordinates stored as int16 (see PointXYZSet::compact())
+                  CACHE_XYZ32 = 64 };   //! coordinates stored as int32
+
+/**!
+ * \brief
+ *  Header of a sidecar file, followed by the arrays (see cacheSections())
+ *  and by the kd-tree, if any
+ */
+struct cacheHeader
+{
+  char magic[8];                //! "PCCQSC\n"
+  uint32_t version;             //! PCC_CACHE_VERSION
+  uint32_t wordSize;            //! sizeof(size_t), of the kd-tree nodes
+  uint64_t sourceSize;          //! size of the source file
+  uint64_t sourceHash;          //! hash of the source file (see hashData())
+  int32_t normalsOnly;          //! parameters of PccPointCloud::load()
+  int32_t dropDuplicates;
+  int32_t neighborsProc;
+  int32_t attributes;
+  uint32_t flags;               //! cacheFlags
+  uint32_t reserved;
+  int64_t size;                 //! number of points
+  double minNNDist;             //! PccPointCloud::minNNDist and maxNNDist
+  double maxNNDist;
+  uint64_t kdtreeOffset;        //! offset of the kd-tree, 0 if none
+};
+
+static const char cacheMagic[8] = { 'P', 'C', 'C', 'Q', 'S', 'C', '\n', 0 };
+
+static inline uint64_t
+align8( uint64_t offset )
+{
+  return (offset + 7) & ~uint64_t( 7 );
+}
+
+/**!
+ * \brief
+ *  Offsets of the arrays of a sidecar file: xyz, nbdup, normals, colors
+ *  and reflectances, each one 8 bytes aligned (the absent ones are empty).
+ *  Returns the end of the arrays
+ */
+static uint64_t
+cacheSections( const cacheHeader &header, uint64_t offsets[5] )
+{
+  const uint64_t n = header.size;
+  const uint64_t xyzBytes = (header.flags & CACHE_XYZ16) ? sizeof(PointXYZSet::point16_type) :
+                            (header.flags & CACHE_XYZ32) ? sizeof(PointXYZSet::point32_type) :
+                            sizeof(PointXYZSet::point_type);
+  const uint64_t bytes[5] = { n * xyzBytes,
+                              (header.flags & CACHE_NBDUP) ? n * sizeof(int) : 0,
+                              (header.flags & CACHE_NORMALS) ? n * sizeof(NormalSet::value_type) : 0,
+                              (header.flags & CACHE_RGB) ? n * sizeof(RGBSet::value_type) : 0,
+                              (header.flags & CACHE_REFLECTANCES) ? n * sizeof(LidarSet::value_type) : 0 };
+  uint64_t offset = align8( sizeof(cacheHeader) );
+  for (int k = 0; k < 5; k++)
+  {
+    offsets[k] = offset;
+    offset = align8( offset + bytes[k] );
+  }
+  return offset;
+}
+
+static inline uint64_t
+mix64( uint64_t h )
+{
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+/**!
+ * \brief
+ *  64 bits hash of a buffer, not cryptographic: 8 bytes words multiplied
+ *  and rotated into the state
+ */
+static uint64_t
+hashData( const unsigned char *data, size_t size, uint64_t seed )
+{
+  uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ull);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    uint64_t v;
+    memcpy( &v, data + i, 8 );
+    h ^= v * 0xbf58476d1ce4e5b9ull;
+    h = ((h << 31) | (h >> 33)) * 0x94d049bb133111ebull;
+  }
+  if (i < size)
+  {
+    uint64_t v = 0;
+    memcpy( &v, data + i, size - i );
+    h ^= v * 0xbf58476d1ce4e5b9ull;
+  }
+  return mix64( h );
+}
+
+/*
+ ***********************************************
+   Implementation of exported functions and classes
+ ***********************************************
+ */
+
+PccCache::PccCache( const string &cacheDir, const string &inFile, bool normalsOnly, int dropDuplicates,
+                    int neighborsProc, int attributes )
+  : inFile( inFile ), normalsOnly( normalsOnly ), dropDuplicates( dropDuplicates ), neighborsProc( neighborsProc ),
+    attributes( attributes ), bHashed( false ), sourceSize( 0 ), sourceHash( 0 ),
+    bLoaded( false ), bLoadedPeak( false ), bLoadedKdtree( false )
+{
+  // neighborsProc only changes the arrays through nbdup (see PccPointCloud::load())
+  if (dropDuplicates != 2 || neighborsProc != 2)
+    this->neighborsProc = 0;
+  if (cacheDir == "" || inFile == "")
+    return;
+
+  // The name tells apart the files of the same name in other directories,
+  // and the other load parameters: basename.hash[.normals].pcq
+  string path = inFile;
+#if _WIN32
+  char *absolute = _fullpath( nullptr, inFile.c_str(), 0 );
+#else
+  char *absolute = realpath( inFile.c_str(), nullptr );
+#endif
+  if (absolute)
+  {
+    path = absolute;
+    free( absolute );
+  }
+  const int32_t params[3] = { this->dropDuplicates, this->neighborsProc, attributes };
+  const uint64_t pathHash = hashData( (const unsigned char *) path.data(), path.size(), 0 );
+  const uint64_t hash = hashData( (const unsigned char *) params, sizeof(params), pathHash );
+  char hex[17];
+  snprintf( hex, sizeof(hex), "%016llx", (unsigned long long) hash );
+  const size_t slash = inFile.find_last_of( "/\\" );
+  cacheFile = cacheDir + "/" + inFile.substr( slash == string::npos ? 0 : slash + 1 ) + "." + hex +
+              (normalsOnly ? ".normals" : "") + ".pcq";
+}
+
+/**!
+ * \brief
+ *  Size and hash of the source file: the hashes of blocks of
+ *  PCC_CACHE_HASH_BLOCK bytes, computed in parallel, hashed together
+ */
+int
+PccCache::hashSource()
+{
+  if (bHashed)
+    return 0;
+  MappedFile file;
+  if (file.open( inFile ) != 0)
+    return -1;
+
+  const long int nbBlocks = (long int)( (file.size + PCC_CACHE_HASH_BLOCK - 1) / PCC_CACHE_HASH_BLOCK );
+  vector<uint64_t> blockHash( nbBlocks );
+#pragma omp parallel for schedule(dynamic, 4)
+  for (long int b = 0; b < nbBlocks; b++)
+  {
+    const size_t first = (size_t) b * PCC_CACHE_HASH_BLOCK;
+    blockHash[b] = hashData( file.data + first, min<size_t>( PCC_CACHE_HASH_BLOCK, file.size - first ), b );
+  }
+  sourceSize = file.size;
+  sourceHash = hashData( (const unsigned char *) blockHash.data(), blockHash.size() * sizeof(uint64_t), file.size );
+  bHashed = true;
+  return 0;
+}
+
+/**!
+ * \brief
+ *  Copy the arrays of a valid sidecar into the point cloud, the attributes
+ *  that were not requested being left out, then read the kd-tree
+ */
+int
+PccCache::load( PccPointCloud &cloud )
+{
+  const double t0 = GetWallClock();
+  if (cacheFile == "")
+    return -1;
+
+  MappedFile file;
+  cacheHeader header;
+  if (file.open( cacheFile ) != 0 || file.size < sizeof(header))
+    return -1;
+  memcpy( &header, file.data, sizeof(header) );
+  if (memcmp( header.magic, cacheMagic, sizeof(cacheMagic) ) != 0 || header.version != PCC_CACHE_VERSION ||
+      header.wordSize != sizeof(size_t) || header.size < 0)
+    return -1;
+
+  // Same load parameters, with at least the requested attributes
+  if (header.normalsOnly != (normalsOnly ? 1 : 0) || header.dropDuplicates != dropDuplicates ||
+      header.neighborsProc != neighborsProc || (attributes & ~header.attributes) != 0)
+    return -1;
+
+  // Same source file: the size first, then the content
+  struct stat64 st;
+  if (stat64( inFile.c_str(), &st ) != 0 || (uint64_t) st.st_size != header.sourceSize)
+    return -1;
+  if (hashSource() != 0 || sourceSize != header.sourceSize || sourceHash != header.sourceHash)
+    return -1;
+
+  uint64_t offsets[5];
+  const uint64_t end = cacheSections( header, offsets );
+  if (end > file.size || header.kdtreeOffset > file.size)
+    return -1;
+
+  const size_t n = (size_t) header.size;
+  const bool bNormal = (header.flags & CACHE_NORMALS) && (normalsOnly || (attributes & PccPointCloud::NORMALS));
+  const bool bRgb = (header.flags & CACHE_RGB) && (attributes & PccPointCloud::COLORS);
+  const bool bLidar = (header.flags & CACHE_REFLECTANCES) && (attributes & PccPointCloud::REFLECTANCES);
+  cloud.size = (long int) n;
+  cloud.xyz.init( 0 );
+  if (header.flags & CACHE_XYZ16)
+  {
+    cloud.xyz.storage = PointXYZSet::INT16;
+    cloud.xyz.p16.resize( n );
+  }
+  else if (header.flags & CACHE_XYZ32)
+  {
+    cloud.xyz.storage = PointXYZSet::INT32;
+    cloud.xyz.p32.resize( n );
+  }
+  else
+    cloud.xyz.p.resize( n );
+  memcpy( (void *) cloud.xyz.data(), file.data + offsets[0], n * cloud.xyz.pointBytes() );
+  cloud.xyz.nbdup.resize( (header.flags & CACHE_NBDUP) ? n : 0 );
+  memcpy( cloud.xyz.nbdup.data(), file.data + offsets[1], cloud.xyz.nbdup.size() * sizeof(int) );
+  cloud.normal.n.resize( bNormal ? n : 0 );
+  memcpy( cloud.normal.n.data(), file.data + offsets[2], cloud.normal.n.size() * sizeof(NormalSet::value_type) );
+  cloud.rgb.c.resize( bRgb ? n : 0 );
+  memcpy( cloud.rgb.c.data(), file.data + offsets[3], cloud.rgb.c.size() * sizeof(RGBSet::value_type) );
+  cloud.lidar.reflectance.resize( bLidar ? n : 0 );
+  memcpy( cloud.lidar.reflectance.data(), file.data + offsets[4], cloud.lidar.reflectance.size() * sizeof(LidarSet::value_type) );
+  cloud.bXyz = true;
+  cloud.bNormal = bNormal;
+  cloud.bRgb = bRgb;
+  cloud.bLidar = bLidar;
+  cloud.bVoxelized = (header.flags & CACHE_VOXELIZED) != 0;
+  cloud.minNNDist = header.minNNDist;
+  cloud.maxNNDist = header.maxNNDist;
+  bLoaded = true;
+  bLoadedPeak = header.maxNNDist >= 0;
+
+  // The kd-tree is built on first use if it can not be read
+  if (header.kdtreeOffset != 0 && n > 0)
+  {
+    FILE *f = fopen( cacheFile.c_str(), "rb" );
+    if (f)
+    {
+      bLoadedKdtree = fseeko( f, header.kdtreeOffset, SEEK_SET ) == 0 && cloud.loadKdtree( f ) == 0;
+      fclose( f );
+    }
+  }
+
+  cloud.timeLoad = GetWallClock() - t0;
+  cloud.timeDedup = 0.0;
+  return 0;
+}
+
+/**!
+ * \brief
+ *  Write the sidecar to a temporary file of the cache directory, renamed
+ *  once complete: concurrent runs on the same file never read a partial
+ *  sidecar
+ */
+int
+PccCache::save( const PccPointCloud &cloud )
+{
+  if (cacheFile == "")
+    return 0;
+  if (bLoaded && (bLoadedPeak || cloud.maxNNDist < 0) && (bLoadedKdtree || !cloud.hasKdtree()))
+    return 0;
+  if (hashSource() != 0)
+    return -1;
+
+  cacheHeader header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, cacheMagic, sizeof(cacheMagic) );
+  header.version = PCC_CACHE_VERSION;
+  header.wordSize = sizeof(size_t);
+  header.sourceSize = sourceSize;
+  header.sourceHash = sourceHash;
+  header.normalsOnly = normalsOnly ? 1 : 0;
+  header.dropDuplicates = dropDuplicates;
+  header.neighborsProc = neighborsProc;
+  header.attributes = attributes;
+  header.flags = (cloud.bRgb ? CACHE_RGB : 0) | (cloud.bNormal ? CACHE_NORMALS : 0) |
+                 (cloud.bLidar ? CACHE_REFLECTANCES : 0) | (!cloud.xyz.nbdup.empty() ? CACHE_NBDUP : 0) |
+                 (cloud.bVoxelized ? CACHE_VOXELIZED : 0) |
+                 (cloud.xyz.storage == PointXYZSet::INT16 ? CACHE_XYZ16 : 0) |
+                 (cloud.xyz.storage == PointXYZSet::INT32 ? CACHE_XYZ32 : 0);
+  header.size = cloud.size;
+  header.minNNDist = cloud.minNNDist;
+  header.maxNNDist = cloud.maxNNDist;
+  uint64_t offsets[5];
+  const uint64_t end = cacheSections( header, offsets );
+  header.kdtreeOffset = cloud.hasKdtree() && cloud.size > 0 ? end : 0;
+
+  const string tmpFile = cacheFile + "." + to_string( random_device()() ) + ".tmp";
+  FILE *f = fopen( tmpFile.c_str(), "wb" );
+  if (!f)
+    return -1;
+  const size_t n = (size_t) cloud.size;
+  const void *arrays[5] = { cloud.xyz.data(), cloud.xyz.nbdup.data(), cloud.normal.n.data(), cloud.rgb.c.data(),
+                            cloud.lidar.reflectance.data() };
+  const size_t bytes[5] = { n * cloud.xyz.pointBytes(), cloud.xyz.nbdup.size() * sizeof(int),
+                            cloud.bNormal ? n * sizeof(NormalSet::value_type) : 0,
+                            cloud.bRgb ? n * sizeof(RGBSet::value_type) : 0,
+                            cloud.bLidar ? n * sizeof(LidarSet::value_type) : 0 };
+  const char padding[8] = { 0 };
+  bool bOk = fwrite( &header, sizeof(header), 1, f ) == 1;
+  uint64_t offset = sizeof(header);
+  for (int k = 0; k < 5 && bOk; k++)
+  {
+    bOk = fwrite( padding, 1, offsets[k] - offset, f ) == offsets[k] - offset &&
+          fwrite( arrays[k], 1, bytes[k], f ) == bytes[k];
+    offset = offsets[k] + bytes[k];
+  }
+  if (bOk && header.kdtreeOffset != 0)
+    bOk = fwrite( padding, 1, end - offset, f ) == end - offset && cloud.saveKdtree( f ) == 0;
+  bOk = fclose( f ) == 0 && bOk;
+
+#ifdef _WIN32
+  if (bOk)
+    remove( cacheFile.c_str() );
+#endif
+  if (!bOk || rename( tmpFile.c_str(), cacheFile.c_str() ) != 0)
+  {
+    remove( tmpFile.c_str() );
+    return -1;
+  }
+  return 0;
+}
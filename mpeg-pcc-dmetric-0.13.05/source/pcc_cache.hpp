@@ -0,0 +1,98 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef PCC_CACHE_HPP
+#define PCC_CACHE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "pcc_processing.hpp"
+
+namespace pcc_processing {
+
+  /**!
+   * \brief
+   *  Binary sidecar of a reference point cloud in a cache directory: the
+   *  sorted and deduplicated arrays, the parameters they were loaded with,
+   *  the nearest neighbor distances of the peak search and the kd-tree,
+   *  once computed. Later runs map it in memory rather than loading the
+   *  file again, as long as the size and the hash of the file match.
+   */
+  class PccCache
+  {
+  public:
+    //! Sidecar of inFile in cacheDir (no cache if cacheDir is empty), for the parameters of PccPointCloud::load()
+    PccCache( const string &cacheDir, const string &inFile, bool normalsOnly, int dropDuplicates, int neighborsProc,
+              int attributes );
+
+    //! Load the point cloud from the sidecar: 0 if it is valid, non-zero otherwise (point cloud untouched)
+    int load( PccPointCloud &cloud );
+
+    //! Write the sidecar, unless it is valid and already holds what has been computed on the point cloud
+    int save( const PccPointCloud &cloud );
+
+    const string &fileName() const { return cacheFile; }
+
+  private:
+    string cacheFile;             //! file name of the sidecar, empty if no cache
+    string inFile;
+    bool normalsOnly;
+    int dropDuplicates;
+    int neighborsProc;
+    int attributes;
+
+    bool bHashed;                 //! sourceSize and sourceHash computed
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+
+    bool bLoaded;                 //! the point cloud comes from the sidecar
+    bool bLoadedPeak;             //! ... with the nearest neighbor distances
+    bool bLoadedKdtree;           //! ... and the kd-tree
+
+    int hashSource();
+  };
+
+};
+
+#endif
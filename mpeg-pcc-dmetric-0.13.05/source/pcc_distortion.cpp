@@ -40,45 +40,48 @@
  *
  */
 
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <limits.h>
+#include <algorithm>
+#include <atomic>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "pcc_processing.hpp"
 #include "pcc_distortion.hpp"
+#include "pcc_report.hpp"
+#include "pcc_tiling.hpp"
+#include "clockcom.hpp"
 
 using namespace std;
 using namespace pcc_quality;
 using namespace nanoflann;
 
-// Representation of linear point cloud indexes in kd-tree
-typedef uint32_t index_type;
+#define PRINT_TIMING 0
 
-// Representation of distance metric during kd-tree search
-typedef double distance_type;
+// Number of consecutive points processed by the same thread in findMetric()
+// and scaleNormals(). The per-block results are then merged in a fixed order,
+// so that the results do not depend on the number of threads.
+#define METRIC_BLOCK_SIZE 4096
 
-// A version of nanoflann::metric_L2 that forces metric (distance)
-// calculations to be performed using double precision floats.
-// NB: by default nanoflann::metric_L2 will be used with the metric
-//     type of T = num_t (the coordinate type).
-struct metric_L2_double {
-  template<class T, class DataSource>
-  struct traits {
-    typedef nanoflann::L2_Adaptor<T,DataSource,double> distance_t;
-  };
-};
+// Maximum number of neighbors at the same distance searched in findMetric()
+#define METRIC_NEIGHBORS_MAX 30
 
-typedef KDTreeVectorOfVectorsAdaptor<
-    vector<PointXYZSet::point_type>,     // array type
-    PointXYZSet::point_type::value_type, // coordinate type
-    3,                                   // num dimensions
-    metric_L2_double,                    // distance class
-    index_type                           // index type (eg size_t)
-    > my_kd_tree_t;
+// Number of bins of the x histogram used to cut the point clouds into tiles
+#define TILE_BINS 65536
 
-#define PRINT_TIMING 0
+// Maximum number of buckets (lists of segments of a temporary file) of every point cloud
+#define TILE_MAX_BUCKETS 256
+
+// Estimated memory of a point of a tile, in bytes: coordinates, attributes,
+// normals, search index, sort buffers and converted colors
+#define TILE_POINT_BYTES 160
 
 /*
  ***********************************************
@@ -86,12 +89,94 @@ typedef KDTreeVectorOfVectorsAdaptor<
  ***********************************************
  */
 
+/**!
+ * \brief
+ *  Run body(i) for i in [first, last), by chunks of consecutive indexes
+ *  (multiples of "chunk" being the chunk boundaries), each chunk being
+ *  processed in order by a single thread. It is a parallel for, or a
+ *  taskloop when called from a task of a parallel region (concurrent
+ *  passes), so that the threads are shared with the other tasks.
+ */
+template <typename Body>
+static void
+parallelChunks(long first, long last, long chunk, const Body &body)
+{
+  const long c0 = first / chunk;
+  const long c1 = (last + chunk - 1) / chunk;
+#ifdef _OPENMP
+  if (omp_in_parallel())
+  {
+#pragma omp taskloop grainsize(1)
+    for (long c = c0; c < c1; c++)
+      for (long i = max( first, c * chunk ); i < min( last, (c + 1) * chunk ); i++)
+        body( i );
+    return;
+  }
+#endif
+#pragma omp parallel for schedule(dynamic)
+  for (long c = c0; c < c1; c++)
+    for (long i = max( first, c * chunk ); i < min( last, (c + 1) * chunk ); i++)
+      body( i );
+}
+
+template <typename Body>
+static void
+parallelChunks(long n, long chunk, const Body &body)
+{
+  parallelChunks( 0, n, chunk, body );
+}
+
+/**!
+ * \brief
+ *  Standard output, or a stream discarding everything if cPar.bQuiet
+ */
+static ostream&
+output(const commandPar &cPar)
+{
+  static thread_local ostream quiet( nullptr );
+  return cPar.bQuiet ? quiet : cout;
+}
+
+// Whether the kd-tree searches of findMetric() are approximate
+static bool
+isApproximate(const commandPar &cPar)
+{
+  return cPar.approxEps > 0 || cPar.approxLeaves > 0;
+}
+
+/**!
+ * \brief
+ *  Whether the nearest neighbors of the points of "query" in "index" are
+ *  searched in the voxel grid of "index", rather than in its kd-tree. The
+ *  results are the same. The grid searches are exact, the approximate
+ *  searches use the kd-trees.
+ */
+static bool
+useVoxelGrid(const PccPointCloud &query, const PccPointCloud &index, const commandPar &cPar)
+{
+  return cPar.bVoxelGrid && !cPar.hausdorffOnly && !isApproximate( cPar ) && query.bVoxelized && index.bVoxelized;
+}
+
+/**!
+ * \brief
+ *  Build the voxel grid or the kd-tree of a point cloud
+ */
+static void
+buildSearchIndex(PccPointCloud &cloud, bool bGrid)
+{
+  if (bGrid)
+    cloud.voxelGrid();
+  else
+    cloud.buildKdtree();
+}
+
 /**!
  * \function
  *   Compute the minimum and maximum NN distances, find out the
  *   intrinsic resolutions
  * \parameters
  *   @param cloudA: point cloud
+ *   @param first, last: range of the points of cloudA to search
  *   @param minDist: output
  *   @param maxDist: output
  * \note
@@ -100,17 +185,15 @@ typedef KDTreeVectorOfVectorsAdaptor<
  *   Dong Tian, MERL
  */
 void
-findNNdistances(PccPointCloud &cloudA, double &minDist, double &maxDist)
+findNNdistances(PccPointCloud &cloudA, long first, long last, double &minDist, double &maxDist)
 {
   maxDist =  numeric_limits<double>::min();
   minDist =  numeric_limits<double>::max();
   double distTmp = 0;
   mutex myMutex;
 
-  my_kd_tree_t mat_index(3, cloudA.xyz.p, 10); // dim, cloud, max leaf
-
 #pragma omp parallel for
-  for (long i = 0; i < cloudA.size; ++i)
+  for (long i = first; i < last; ++i)
   {
     // cout << "*** " << i << endl;
     // do a knn search
@@ -118,7 +201,8 @@ findNNdistances(PccPointCloud &cloudA, double &minDist, double &maxDist)
     std::array<index_type,num_results> indices;
     std::array<distance_type,num_results> sqrDist;
 
-    mat_index.query(&cloudA.xyz.p[i][0], num_results, &indices[0], &sqrDist[0]);
+    const PointXYZSet::point_type pa = cloudA.xyz.point( i );
+    cloudA.queryKnn(&pa[0], num_results, &indices[0], &sqrDist[0]);
 
     if (indices[0] != i || sqrDist[1] <= 0.0000000001)
     {
@@ -165,6 +249,123 @@ getPSNR(float dist2, float p, float factor = 1.0)
   return psnr;
 }
 
+/**!
+ * \brief
+ *  Sums and maximums of the point errors of one block of findMetric()
+ */
+struct metricAccumulator
+{
+  long   num;
+  double sse_dist_b_c2c;
+  double max_dist_b_c2c;
+  double sse_dist_b_c2p;
+  double max_dist_b_c2p;
+  double sse_color[3];
+  double max_colorRGB[3];
+  double sse_reflectance;
+  double max_reflectance;
+
+  metricAccumulator()
+  {
+    num = 0;
+    sse_dist_b_c2c = sse_dist_b_c2p = sse_reflectance = 0;
+    max_dist_b_c2c = max_dist_b_c2p = max_reflectance = std::numeric_limits<double>::min();
+    for (int d = 0; d < 3; d++)
+    {
+      sse_color[d] = 0.0;
+      max_colorRGB[d] = std::numeric_limits<double>::min();
+    }
+  }
+
+  void merge( const metricAccumulator &other )
+  {
+    num += other.num;
+    sse_dist_b_c2c += other.sse_dist_b_c2c;
+    sse_dist_b_c2p += other.sse_dist_b_c2p;
+    sse_reflectance += other.sse_reflectance;
+    max_dist_b_c2c = max(max_dist_b_c2c, other.max_dist_b_c2c);
+    max_dist_b_c2p = max(max_dist_b_c2p, other.max_dist_b_c2p);
+    max_reflectance = max(max_reflectance, other.max_reflectance);
+    for (int d = 0; d < 3; d++)
+    {
+      sse_color[d] += other.sse_color[d];
+      max_colorRGB[d] = max(max_colorRGB[d], other.max_colorRGB[d]);
+    }
+  }
+};
+
+/**!
+ * \function
+ *   Merge the block accumulators pairwise, in a fixed order
+ * \parameters
+ *   @param blocks: one accumulator per block, overwritten
+ * \return
+ *   accumulator of all the blocks
+ */
+metricAccumulator
+mergeBlocks(vector<metricAccumulator> &blocks)
+{
+  if (blocks.empty())
+    return metricAccumulator();
+
+  for (size_t stride = 1; stride < blocks.size(); stride *= 2)
+    for (size_t b = 0; b + stride < blocks.size(); b += 2 * stride)
+      blocks[b].merge( blocks[b + stride] );
+
+  return blocks[0];
+}
+
+/**!
+ * \brief
+ *  Quantile sketches of the point errors accumulated by one thread in
+ *  findMetric() (see commandPar::bQuantiles): the same errors as the sums
+ *  of metricAccumulator, the colors in the mse space
+ */
+struct metricSketches
+{
+  QuantileSketch c2c;
+  QuantileSketch c2p;
+  QuantileSketch color[3];
+  QuantileSketch reflectance;
+
+  void merge( const metricSketches &other )
+  {
+    c2c.merge( other.c2c );
+    c2p.merge( other.c2p );
+    for (int d = 0; d < 3; d++)
+      color[d].merge( other.color[d] );
+    reflectance.merge( other.reflectance );
+  }
+};
+
+/**!
+ * \function
+ *   One sketch set per thread of the team running a pass, empty if the
+ *   quantiles are not computed. The sketches are indexed by the thread
+ *   number: a block of the pass is processed by a single thread, and the
+ *   merged counts do not depend on which one.
+ */
+static vector<metricSketches>
+threadSketches(const commandPar &cPar)
+{
+  if (!cPar.bQuantiles)
+    return vector<metricSketches>();
+#ifdef _OPENMP
+  return vector<metricSketches>( omp_in_parallel() ? omp_get_num_threads() : omp_get_max_threads() );
+#else
+  return vector<metricSketches>( 1 );
+#endif
+}
+
+static metricSketches
+mergeSketches(const vector<metricSketches> &sketches)
+{
+  metricSketches total;
+  for (const auto &sketch : sketches)
+    total.merge( sketch );
+  return total;
+}
+
 /**!
  * \function
  *   Derive the normals for the decoded point cloud based on the
@@ -175,13 +376,14 @@ getPSNR(float dist2, float p, float factor = 1.0)
  *   @param cloudB:  the decoded point cloud
  *   @param cloudNormalsB: the normals in the original point
  *     cloud. Output parameter
+ *   @param bGrid: search the nearest neighbors in the voxel grids
  * \note
  *   PointT typename of point used in point cloud
  * \author
  *   Dong Tian, MERL
  */
 void
-scaleNormals(PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, PccPointCloud &cloudNormalsB, bool bAverageNormals)
+scaleNormals(PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, PccPointCloud &cloudNormalsB, bool bAverageNormals, bool bGrid)
 {
   // Prepare the buffer to compute the average normals
 #if PRINT_TIMING
@@ -192,28 +394,23 @@ scaleNormals(PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, PccPointCloud
   vector<int> counts(cloudB.size);
 
   if (1) {
-    my_kd_tree_t mat_indexB(3, cloudB.xyz.p, 10); // dim, cloud, max leaf
-    for (long i = 0; i < cloudNormalsA.size; i++)
+    // Each normal of A is added to its nearest point(s) in B. The (source,
+    // target) pairs are collected in parallel and grouped by target, each
+    // group being summed in increasing source order, as a serial loop would.
+    vector< vector< pair<index_type, index_type> > > blockPairs( (cloudNormalsA.size + METRIC_BLOCK_SIZE - 1) / METRIC_BLOCK_SIZE );
+
+    parallelChunks( cloudNormalsA.size, METRIC_BLOCK_SIZE, [&]( long i )
     {
+      vector< pair<index_type, index_type> > &pairs = blockPairs[i / METRIC_BLOCK_SIZE];
       if( bAverageNormals ) {
         const size_t num_results_max = 30;
-        const size_t num_results_incr = 5;
-        size_t num_results = 0;
 
         std::array<index_type,num_results_max> indices;
         std::array<distance_type,num_results_max> sqrDist;
-        do {
-          num_results  += num_results_incr;
-          mat_indexB.query(&cloudNormalsA.xyz.p[i][0], num_results, &indices[0], &sqrDist[0]);
-        } while( sqrDist[0] == sqrDist[num_results-1] && num_results + num_results_incr <= num_results_max );
-        for( size_t j=0;j<num_results;j++){
-          if( sqrDist[0] == sqrDist[j] ) {
-            cloudNormalsB.normal.n[indices[j]][0] += cloudNormalsA.normal.n[i][0];
-            cloudNormalsB.normal.n[indices[j]][1] += cloudNormalsA.normal.n[i][1];
-            cloudNormalsB.normal.n[indices[j]][2] += cloudNormalsA.normal.n[i][2];
-            counts[indices[j]]++;
-          }
-        }
+        const PointXYZSet::point_type pa = cloudNormalsA.xyz.point( i );
+        const size_t num_results = cloudB.queryTies(&pa[0], num_results_max, 0, &indices[0], &sqrDist[0], bGrid);
+        for( size_t j=0;j<num_results;j++)
+          pairs.push_back( make_pair( index_type(i), indices[j] ) );
       }
       else
       {
@@ -221,19 +418,55 @@ scaleNormals(PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, PccPointCloud
         std::array<index_type,num_results> indices;
         std::array<distance_type,num_results> sqrDist;
 
-        mat_indexB.query(&cloudNormalsA.xyz.p[i][0], num_results, &indices[0], &sqrDist[0]);
+        const PointXYZSet::point_type pa = cloudNormalsA.xyz.point( i );
+        cloudB.queryTies(&pa[0], num_results, 0, &indices[0], &sqrDist[0], bGrid);
+        pairs.push_back( make_pair( index_type(i), indices[0] ) );
+      }
+    } );
 
-        cloudNormalsB.normal.n[indices[0]][0] += cloudNormalsA.normal.n[i][0];
-        cloudNormalsB.normal.n[indices[0]][1] += cloudNormalsA.normal.n[i][1];
-        cloudNormalsB.normal.n[indices[0]][2] += cloudNormalsA.normal.n[i][2];
-        counts[indices[0]]++;
+    // Group the sources by target: counts, offsets, then scatter
+    const long nBlocks = blockPairs.size();
+    parallelChunks( nBlocks, 1, [&]( long b )
+    {
+      for (auto &pr : blockPairs[b])
+      {
+#pragma omp atomic
+        counts[pr.second]++;
       }
-    }
+    } );
+
+    vector<size_t> offsets(cloudB.size + 1, 0);
+    for (long i = 0; i < cloudB.size; i++)
+      offsets[i + 1] = offsets[i] + counts[i];
+
+    vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    vector<index_type> sources(offsets[cloudB.size]);
+    parallelChunks( nBlocks, 1, [&]( long b )
+    {
+      for (auto &pr : blockPairs[b])
+      {
+        size_t pos;
+#pragma omp atomic capture
+        pos = fill[pr.second]++;
+        sources[pos] = pr.first;
+      }
+    } );
+    vector< vector< pair<index_type, index_type> > >().swap(blockPairs);
+
+    parallelChunks( cloudB.size, METRIC_BLOCK_SIZE, [&]( long i )
+    {
+      std::sort(sources.begin() + offsets[i], sources.begin() + offsets[i + 1]);
+      for (size_t k = offsets[i]; k < offsets[i + 1]; k++)
+      {
+        cloudNormalsB.normal.n[i][0] += cloudNormalsA.normal.n[sources[k]][0];
+        cloudNormalsB.normal.n[i][1] += cloudNormalsA.normal.n[sources[k]][1];
+        cloudNormalsB.normal.n[i][2] += cloudNormalsA.normal.n[sources[k]][2];
+      }
+    } );
   }
 
   // average now
-  my_kd_tree_t mat_indexA(3, cloudNormalsA.xyz.p, 10); // dim, cloud, max leaf
-  for (long i = 0; i < cloudB.size; i++)
+  parallelChunks( cloudB.size, METRIC_BLOCK_SIZE, [&]( long i )
   {
     int nCount = counts[i];
     if (nCount > 0)      // main branch
@@ -247,22 +480,14 @@ scaleNormals(PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, PccPointCloud
       if( bAverageNormals ) 
       {
         const size_t num_results_max = 30;
-        const size_t num_results_incr = 5;
-        size_t num_results = 0;
         std::array<index_type,num_results_max> indices;
         std::array<distance_type,num_results_max> sqrDist;
-        do {
-          num_results  += num_results_incr;
-          mat_indexA.query(&cloudB.xyz.p[i][0], num_results, &indices[0], &sqrDist[0]);
-        } while( sqrDist[0] == sqrDist[num_results-1] && num_results + num_results_incr <= num_results_max );
-        size_t num = 0;
-        for( size_t j=0;j<num_results;j++){
-          if( sqrDist[0] == sqrDist[j] ) {
-            cloudNormalsB.normal.n[i][0] += cloudNormalsA.normal.n[indices[j]][0];
-            cloudNormalsB.normal.n[i][1] += cloudNormalsA.normal.n[indices[j]][1];
-            cloudNormalsB.normal.n[i][2] += cloudNormalsA.normal.n[indices[j]][2];
-            num++;
-          }
+        const PointXYZSet::point_type pb = cloudB.xyz.point( i );
+        const size_t num = cloudNormalsA.queryTies(&pb[0], num_results_max, 0, &indices[0], &sqrDist[0], bGrid);
+        for( size_t j=0;j<num;j++){
+          cloudNormalsB.normal.n[i][0] += cloudNormalsA.normal.n[indices[j]][0];
+          cloudNormalsB.normal.n[i][1] += cloudNormalsA.normal.n[indices[j]][1];
+          cloudNormalsB.normal.n[i][2] += cloudNormalsA.normal.n[indices[j]][2];
         }
         cloudNormalsB.normal.n[i][0] /= num;
         cloudNormalsB.normal.n[i][1] /= num;
@@ -274,14 +499,15 @@ scaleNormals(PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, PccPointCloud
         std::array<index_type,num_results> indices;
         std::array<distance_type,num_results> sqrDist;
 
-        mat_indexA.query(&cloudB.xyz.p[i][0], num_results, &indices[0], &sqrDist[0]);
+        const PointXYZSet::point_type pb = cloudB.xyz.point( i );
+        cloudNormalsA.queryTies(&pb[0], num_results, 0, &indices[0], &sqrDist[0], bGrid);
 
         cloudNormalsB.normal.n[i][0] = cloudNormalsA.normal.n[indices[0]][0];
         cloudNormalsB.normal.n[i][1] = cloudNormalsA.normal.n[indices[0]][1];
         cloudNormalsB.normal.n[i][2] = cloudNormalsA.normal.n[indices[0]][2];
       }
     }
-  }
+  } );
 
   // Set the flag
   cloudNormalsB.bNormal = true;
@@ -330,271 +556,447 @@ void convertRGBtoYUV(int type, const std::array<unsigned char, 3> &in_rgb,
 }
 
 /**!
- * \function
- *   To compute "one-way" quality metric: Point-to-Point, Point-to-Plane
- *   and RGB. Loop over each point in A. Normals in B to be used
- *
- *   1) For each point in A, find a corresponding point in B.
- *   2) Form an error vector between the point pair.
- *   3) Use the length of the error vector as point-to-point measure
- *   4) Project the error vector along the normals in B, use the length
- *   of the projected error vector as point-to-plane measure
- *
- *   @param cloudA: Reference point cloud. e.g. the original cloud, on
- *     which normals would be estimated. It is the full set of point
- *     cloud. Multiple points in count
- *   @param cloudB: Processed point cloud. e.g. the decoded cloud
- *   @param cPar: Command line parameters
- *   @param cloudNormalsB: Normals for cloudB
- *   @param metric: updated quality metric, to be returned
- * \note
- *   PointT typename of point used in point cloud
- * \author
- *   Dong Tian, MERL
+ * \brief
+ *  Colors of a point cloud in the color space of the MSE computation,
+ *  converted once for all the passes, as float structure of arrays
  */
-void
-findMetric(PccPointCloud &cloudA, PccPointCloud &cloudB, commandPar &cPar, PccPointCloud &cloudNormalsB, qMetric &metric)
+struct mseColors
 {
-  mutex myMutex;
+  vector<float> c[3];
 
-#if PRINT_TIMING
-  clock_t t2 = clock();
-#endif
-  double max_dist_b_c2c = std::numeric_limits<double>::min();
-  double sse_dist_b_c2c = 0;
-  double max_dist_b_c2p = std::numeric_limits<double>::min();
-  double sse_dist_b_c2p = 0;
-  double max_reflectance = std::numeric_limits<double>::min();
-  double sse_reflectance = 0;
-  long num = 0;
+  void init(const PccPointCloud &cloud, int type);
 
-  double sse_color[3];
-  sse_color[0] = sse_color[1] = sse_color[2] = 0.0;
-  double max_colorRGB[3];
-  max_colorRGB[0] = max_colorRGB[1] = max_colorRGB[2] = std::numeric_limits<double>::min();
+  inline void get(size_t i, float *out) const
+  {
+    out[0] = c[0][i];
+    out[1] = c[1][i];
+    out[2] = c[2][i];
+  }
+};
 
-  my_kd_tree_t mat_indexB(3, cloudB.xyz.p, 10); // dim, cloud, max leaf
+/**!
+ * \brief
+ *  Batch version of convertRGBtoYUV(), with the same arithmetic (so the same
+ *  results), written as independent per point operations that vectorize
+ */
+void
+mseColors::init(const PccPointCloud &cloud, int type)
+{
+  const long n = cloud.size;
+  const std::array<unsigned char, 3> *rgb = cloud.rgb.c.data();
+  for (int d = 0; d < 3; d++)
+    c[d].resize( n );
+  float *c0 = c[0].data();
+  float *c1 = c[1].data();
+  float *c2 = c[2].data();
 
-  const size_t num_results_max  = 30;
-  const size_t num_results_incr = 5;
-#if DUPLICATECOLORS_DEBUG
-  long NbNeighborsDst[num_results_max] = {};
-#endif
+  if (type == 0)
+  {
+#pragma omp parallel for simd
+    for (long i = 0; i < n; i++)
+    {
+      c0[i] = float(rgb[i][0]);
+      c1[i] = float(rgb[i][1]);
+      c2[i] = float(rgb[i][2]);
+    }
+  }
+  else if (type == 8)
+  {
+    const int offset = 1 << 8;
+#pragma omp parallel for simd
+    for (long i = 0; i < n; i++)
+    {
+      const int co = rgb[i][0] - rgb[i][2];
+      const int t = rgb[i][2] + (co >> 1);
+      const int cg = rgb[i][1] - t;
+      c0[i] = t + (cg >> 1);
+      c1[i] = co + offset;
+      c2[i] = cg + offset;
+    }
+  }
+  else // type 1
+  {
+#pragma omp parallel for simd
+    for (long i = 0; i < n; i++)
+    {
+      c0[i] = float((0.2126 * rgb[i][0] + 0.7152 * rgb[i][1] + 0.0722 * rgb[i][2]) / 255.0);
+      c1[i] = float((-0.1146 * rgb[i][0] - 0.3854 * rgb[i][1] + 0.5000 * rgb[i][2]) / 255.0 + 0.5000);
+      c2[i] = float((0.5000 * rgb[i][0] - 0.4542 * rgb[i][1] - 0.0458 * rgb[i][2]) / 255.0 + 0.5000);
+    }
+  }
+}
 
-#pragma omp parallel for
-  for (long i = 0; i < cloudA.size; i++)
-  {
-    size_t num_results = num_results_incr;
-    // For point 'i' in A, find its nearest neighbor in B. store it in 'j'
-    std::array<index_type,num_results_max> indices;
-    std::array<distance_type,num_results_max> sqrDist;
-    do {
-      num_results += num_results_incr;
-      if (!mat_indexB.query(&cloudA.xyz.p[i][0], num_results, &indices[0], &sqrDist[0]))
-      {
-        cout << " WARNING: requested neighbors could not be found " << endl;
-      }
-    } while( sqrDist[0] == sqrDist[num_results-1] && cPar.bAverageNormals && num_results + num_results_incr <= num_results_max );
+/**!
+ * \function
+ *   Check whether two point clouds have exactly the same geometry, e.g.
+ *   with attribute coding and lossless geometry. Both clouds are sorted
+ *   by load(), so that the nearest neighbor of point 'i' of a cloud is then
+ *   point 'i' of the other one, at a null distance. It is also the only
+ *   point at this distance (see findMetric()) when there are no duplicate
+ *   points and all the coordinates are integers.
+ *   @param cloudA: point cloud
+ *   @param cloudB: point cloud
+ * \return
+ *   true if findMetric() can use the point indexes as nearest neighbors
+ */
+bool
+sameGeometry(const PccPointCloud &cloudA, const PccPointCloud &cloudB)
+{
+  if (cloudA.size != cloudB.size || cloudA.size == 0)
+    return false;
 
-    int j = indices[0];
-    if (j < 0)
+  const long nBlocks = (cloudA.size + METRIC_BLOCK_SIZE - 1) / METRIC_BLOCK_SIZE;
+  bool same = true;
+#pragma omp parallel for reduction(&&:same) schedule(dynamic)
+  for (long b = 0; b < nBlocks; b++)
+  {
+    if (!same)
       continue;
+    const long first = b * METRIC_BLOCK_SIZE;
+    const long last = min( cloudA.size, first + METRIC_BLOCK_SIZE );
+    if (cloudA.xyz.storage == cloudB.xyz.storage)
+      same = memcmp( cloudA.xyz.data( first ), cloudB.xyz.data( first ), (last - first) * cloudA.xyz.pointBytes() ) == 0;
+    else
+      for (long i = first; i < last && same; i++)
+        same = cloudA.xyz.point( i ) == cloudB.xyz.point( i );
+    for (long i = first; i < last && same; i++)
+    {
+      const PointXYZSet::point_type p = cloudA.xyz.point( i );
+      same = p[0] == trunc( p[0] ) && p[1] == trunc( p[1] ) && p[2] == trunc( p[2] ) &&
+             (i == 0 || p != cloudA.xyz.point( i - 1 ));
+    }
+  }
+  return same;
+}
+
+/**!
+ * \brief
+ *  Errors of a point of A with its nearest neighbors in B (see
+ *  getPointErrors())
+ */
+struct pointErrors
+{
+  double c2c;
+  double c2p;
+  double color[3];              //! in the mse space
+  double colorRGB[3];
+  double reflectance;
+};
 
-    std::vector<size_t> sameDistPoints;
-    if (cPar.bColor || (!cPar.c2c_only && cloudNormalsB.bNormal) ) {
-      sameDistPoints.push_back( indices[0] );
-      for (size_t n = 1; n < num_results; n++) {
-        if (fabs(sqrDist[n] - sqrDist[n - 1]) < 1e-8) {
-          sameDistPoints.push_back( indices[n] );
+/**!
+ * \function
+ *   To compute the errors of the point 'i' of A, with its nearest
+ *   neighbors in B searched with params (exact by default)
+ * \return
+ *   the number of neighbors at the same distance, 0 if none is found
+ */
+static size_t
+getPointErrors(long i, PccPointCloud &cloudA, PccPointCloud &cloudB, const mseColors &colorsA, const mseColors &colorsB,
+               const commandPar &cPar, PccPointCloud &cloudNormalsB, bool bSameGeometry, bool bGrid,
+               const nanoflann::SearchParams &params, pointErrors &err)
+{
+  // The nearest neighbor and the points at the same distance (each at most
+  // 1e-8 farther than the previous one, "<= eps" in NearestTiesResultSet, so
+  // that eps = 0 keeps the exact ties; the former test was "< 1e-8") are
+  // searched among the 30 nearest points when averaging normals, among the
+  // 10 nearest otherwise. The search is pruned with a small relative slack
+  // beyond the last possible tie, which does not change the points kept
+  const size_t num_results_max = METRIC_NEIGHBORS_MAX;
+  const size_t num_results = cPar.bAverageNormals ? num_results_max : 10;
+  const distance_type same_dist_eps = 1e-8;
+
+  // For point 'i' in A, find its nearest neighbor in B. store it in 'j'.
+  // The points at the same distance follow it in 'sameDistPoints'
+  std::array<index_type,num_results_max> sameDistPoints;
+  std::array<distance_type,num_results_max> sqrDist;
+  size_t nbSameDist = 1;
+  const PointXYZSet::point_type pa = cloudA.xyz.point( i );
+  if (bSameGeometry)
+  {
+    sameDistPoints[0] = index_type( i );
+    sqrDist[0] = 0;
+  }
+  else
+    nbSameDist = cloudB.queryTies(&pa[0], num_results, same_dist_eps, &sameDistPoints[0], &sqrDist[0], bGrid, params);
+  if (nbSameDist == 0)
+    return 0;
+
+  int j = sameDistPoints[0];
+
+  // Compute the error vector
+  std::array<double,3> errVector;
+  const PointXYZSet::point_type pb = cloudB.xyz.point( j );
+  errVector[0] = pa[0] - pb[0];
+  errVector[1] = pa[1] - pb[1];
+  errVector[2] = pa[2] - pb[2];
+
+  // Compute point-to-point, which should be equal to sqrt( sqrDist[0] )
+  double distProj_c2c = errVector[0] * errVector[0] + errVector[1] * errVector[1] + errVector[2] * errVector[2];
+
+  // Compute point-to-plane
+  // Normals in B will be used for point-to-plane
+  double distProj = 0.0;
+  if (!cPar.c2c_only && cloudNormalsB.bNormal) {
+    if( cPar.bAverageNormals ) {
+      for ( size_t n = 0; n < nbSameDist; n++ ) {
+        const size_t index = sameDistPoints[n];
+        const PointXYZSet::point_type pn = cloudB.xyz.point( index );
+        if ( !isnan( cloudNormalsB.normal.n[index][0] ) &&
+             !isnan( cloudNormalsB.normal.n[index][1] ) &&
+             !isnan( cloudNormalsB.normal.n[index][2] ) ) {
+          double dist = pow( ( pa[0] - pn[0] ) * cloudNormalsB.normal.n[index][0] +
+                             ( pa[1] - pn[1] ) * cloudNormalsB.normal.n[index][1] +
+                             ( pa[2] - pn[2] ) * cloudNormalsB.normal.n[index][2], 2.f );
+          distProj += dist;
         } else {
-          break;
+          distProj += pa[0] - pn[0] + 
+                      pa[1] - pn[1] +
+                      pa[2] - pn[2];
         }
       }
-    }
-
-    // Compute the error vector
-    std::array<double,3> errVector;
-    errVector[0] = cloudA.xyz.p[i][0] - cloudB.xyz.p[j][0];
-    errVector[1] = cloudA.xyz.p[i][1] - cloudB.xyz.p[j][1];
-    errVector[2] = cloudA.xyz.p[i][2] - cloudB.xyz.p[j][2];
-
-    // Compute point-to-point, which should be equal to sqrt( sqrDist[0] )
-    double distProj_c2c = errVector[0] * errVector[0] + errVector[1] * errVector[1] + errVector[2] * errVector[2];
-
-    // Compute point-to-plane
-    // Normals in B will be used for point-to-plane
-    double distProj = 0.0;
-    if (!cPar.c2c_only && cloudNormalsB.bNormal) {
-      if( cPar.bAverageNormals ) {
-        for ( auto& index : sameDistPoints ) {
-          if ( !isnan( cloudNormalsB.normal.n[index][0] ) &&
-               !isnan( cloudNormalsB.normal.n[index][1] ) &&
-               !isnan( cloudNormalsB.normal.n[index][2] ) ) {
-            double dist = pow( ( cloudA.xyz.p[i][0] - cloudB.xyz.p[index][0] ) * cloudNormalsB.normal.n[index][0] +
-                               ( cloudA.xyz.p[i][1] - cloudB.xyz.p[index][1] ) * cloudNormalsB.normal.n[index][1] +
-                               ( cloudA.xyz.p[i][2] - cloudB.xyz.p[index][2] ) * cloudNormalsB.normal.n[index][2], 2.f );
-            distProj += dist;
-          } else {
-            distProj += cloudA.xyz.p[i][0] - cloudB.xyz.p[index][0] + 
-                        cloudA.xyz.p[i][1] - cloudB.xyz.p[index][1] +
-                        cloudA.xyz.p[i][2] - cloudB.xyz.p[index][2];
-          }
-        }
-        distProj /= (double)sameDistPoints.size();
+      distProj /= (double)nbSameDist;
+    } else {
+      if ( !isnan( cloudNormalsB.normal.n[j][0] ) &&
+           !isnan( cloudNormalsB.normal.n[j][1] ) &&
+           !isnan( cloudNormalsB.normal.n[j][2] ) ) {
+        distProj = ( errVector[0] * cloudNormalsB.normal.n[j][0] +
+                     errVector[1] * cloudNormalsB.normal.n[j][1] +
+                     errVector[2] * cloudNormalsB.normal.n[j][2] );
+        distProj *= distProj;  // power 2 for MSE
       } else {
-        if ( !isnan( cloudNormalsB.normal.n[j][0] ) &&
-             !isnan( cloudNormalsB.normal.n[j][1] ) &&
-             !isnan( cloudNormalsB.normal.n[j][2] ) ) {
-          distProj = ( errVector[0] * cloudNormalsB.normal.n[j][0] +
-                       errVector[1] * cloudNormalsB.normal.n[j][1] +
-                       errVector[2] * cloudNormalsB.normal.n[j][2] );
-          distProj *= distProj;  // power 2 for MSE
-        } else {
-          distProj = distProj_c2c;
-        }
+        distProj = distProj_c2c;
       }
     }
+  }
 
-    double distColor[3];
-    distColor[0] = distColor[1] = distColor[2] = 0.0;
-    double distColorRGB[3];
-    distColorRGB[0] = distColorRGB[1] = distColorRGB[2] = std::numeric_limits<double>::min();
-    if (cPar.bColor && cloudA.bRgb && cloudB.bRgb)
-    {
-      float out[3];
-      float in[3];
-      convertRGBtoYUV(cPar.mseSpace, cloudA.rgb.c[i], in);
+  double distColor[3];
+  distColor[0] = distColor[1] = distColor[2] = 0.0;
+  double distColorRGB[3];
+  distColorRGB[0] = distColorRGB[1] = distColorRGB[2] = std::numeric_limits<double>::min();
+  if (cPar.bColor && cloudA.bRgb && cloudB.bRgb)
+  {
+    float out[3];
+    float in[3];
+    colorsA.get(i, in);
 
-      if (cPar.neighborsProc)
+    if (cPar.neighborsProc)
+    {
+      unsigned int r = 0, g = 0, b = 0;
+      std::array<unsigned char,3> color;
+      switch (cPar.neighborsProc)
       {
-        unsigned int r = 0, g = 0, b = 0;
-        std::array<unsigned char,3> color;
-        switch (cPar.neighborsProc)
+        default:  // Nearest neighbor only, as when neighborsProc is 0
+          color = cloudB.rgb.c[j];
+          colorsB.get(j, out);
+          break;
+        case 1:     // Average
+        case 2:     // Weighted average
         {
-          case 0:
-            break;
-          case 1:     // Average
-          case 2:     // Weighted average
-          {
-            int nbdupcumul = 0;
-            for ( auto& index : sameDistPoints ) {
-              int nbdup = cloudB.xyz.nbdup[ index ];
-              r += nbdup * cloudB.rgb.c[index][0];
-              g += nbdup * cloudB.rgb.c[index][1];
-              b += nbdup * cloudB.rgb.c[index][2];
-              nbdupcumul += nbdup;
-            }
-            assert(nbdupcumul);
-            color[0] = (unsigned char)round((double)r / nbdupcumul);
-            color[1] = (unsigned char)round((double)g / nbdupcumul);
-            color[2] = (unsigned char)round((double)b / nbdupcumul);
+          int nbdupcumul = 0;
+          for ( size_t n = 0; n < nbSameDist; n++ ) {
+            const size_t index = sameDistPoints[n];
+            int nbdup = cloudB.xyz.nbdup.empty() ? 1 : cloudB.xyz.nbdup[ index ];
+            r += nbdup * cloudB.rgb.c[index][0];
+            g += nbdup * cloudB.rgb.c[index][1];
+            b += nbdup * cloudB.rgb.c[index][2];
+            nbdupcumul += nbdup;
           }
-          break;
-          case 3:   // Min
-          {
-            unsigned int distColorMin = (std::numeric_limits<unsigned int>::max)();
-            size_t indexMin = 0;
-            for ( auto& index : sameDistPoints ) {
-              unsigned int distRGB = (cloudA.rgb.c[i][0] - cloudB.rgb.c[index][0]) * (cloudA.rgb.c[i][0] - cloudB.rgb.c[index][0])
-                                   + (cloudA.rgb.c[i][1] - cloudB.rgb.c[index][1]) * (cloudA.rgb.c[i][1] - cloudB.rgb.c[index][1])
-                                   + (cloudA.rgb.c[i][2] - cloudB.rgb.c[index][2]) * (cloudA.rgb.c[i][2] - cloudB.rgb.c[index][2]);
-              if ( distRGB < distColorMin) {
-                distColorMin = distRGB;
-                indexMin = index;
-              }
+          assert(nbdupcumul);
+          color[0] = (unsigned char)round((double)r / nbdupcumul);
+          color[1] = (unsigned char)round((double)g / nbdupcumul);
+          color[2] = (unsigned char)round((double)b / nbdupcumul);
+          convertRGBtoYUV(cPar.mseSpace, color, out);
+        }
+        break;
+        case 3:   // Min
+        {
+          unsigned int distColorMin = (std::numeric_limits<unsigned int>::max)();
+          size_t indexMin = 0;
+          for ( size_t n = 0; n < nbSameDist; n++ ) {
+            const size_t index = sameDistPoints[n];
+            unsigned int distRGB = (cloudA.rgb.c[i][0] - cloudB.rgb.c[index][0]) * (cloudA.rgb.c[i][0] - cloudB.rgb.c[index][0])
+                                 + (cloudA.rgb.c[i][1] - cloudB.rgb.c[index][1]) * (cloudA.rgb.c[i][1] - cloudB.rgb.c[index][1])
+                                 + (cloudA.rgb.c[i][2] - cloudB.rgb.c[index][2]) * (cloudA.rgb.c[i][2] - cloudB.rgb.c[index][2]);
+            if ( distRGB < distColorMin) {
+              distColorMin = distRGB;
+              indexMin = index;
             }
-            color = cloudB.rgb.c[indexMin];
           }
-          break;
-          case 4:   // Max
-          {
-            unsigned int distColorMax = 0;
-            size_t indexMax = 0;
-            for ( auto& index : sameDistPoints ) {
-              unsigned int distRGB = (cloudA.rgb.c[i][0] - cloudB.rgb.c[index][0]) * (cloudA.rgb.c[i][0] - cloudB.rgb.c[index][0])
-                                   + (cloudA.rgb.c[i][1] - cloudB.rgb.c[index][1]) * (cloudA.rgb.c[i][1] - cloudB.rgb.c[index][1])
-                                   + (cloudA.rgb.c[i][2] - cloudB.rgb.c[index][2]) * (cloudA.rgb.c[i][2] - cloudB.rgb.c[index][2]);
-              if (distRGB > distColorMax) {
-                distColorMax = distRGB;
-                indexMax = index;
-              }
+          color = cloudB.rgb.c[indexMin];
+          colorsB.get(indexMin, out);
+        }
+        break;
+        case 4:   // Max
+        {
+          unsigned int distColorMax = 0;
+          size_t indexMax = 0;
+          for ( size_t n = 0; n < nbSameDist; n++ ) {
+            const size_t index = sameDistPoints[n];
+            unsigned int distRGB = (cloudA.rgb.c[i][0] - cloudB.rgb.c[index][0]) * (cloudA.rgb.c[i][0] - cloudB.rgb.c[index][0])
+                                 + (cloudA.rgb.c[i][1] - cloudB.rgb.c[index][1]) * (cloudA.rgb.c[i][1] - cloudB.rgb.c[index][1])
+                                 + (cloudA.rgb.c[i][2] - cloudB.rgb.c[index][2]) * (cloudA.rgb.c[i][2] - cloudB.rgb.c[index][2]);
+            if (distRGB > distColorMax) {
+              distColorMax = distRGB;
+              indexMax = index;
             }
-            color = cloudB.rgb.c[indexMax];
           }
-          break;
+          color = cloudB.rgb.c[indexMax];
+          colorsB.get(indexMax, out);
         }
-
-        convertRGBtoYUV(cPar.mseSpace, color, out);
-        distColorRGB[0] = (cloudA.rgb.c[i][0] - color[0]) * (cloudA.rgb.c[i][0] - color[0]);
-        distColorRGB[1] = (cloudA.rgb.c[i][1] - color[1]) * (cloudA.rgb.c[i][1] - color[1]);
-        distColorRGB[2] = (cloudA.rgb.c[i][2] - color[2]) * (cloudA.rgb.c[i][2] - color[2]);
-      }
-      else
-      {
-        convertRGBtoYUV(cPar.mseSpace, cloudB.rgb.c[j], out);
-        distColorRGB[0] = (cloudA.rgb.c[i][0] - cloudB.rgb.c[j][0]) * (cloudA.rgb.c[i][0] - cloudB.rgb.c[j][0]);
-        distColorRGB[1] = (cloudA.rgb.c[i][1] - cloudB.rgb.c[j][1]) * (cloudA.rgb.c[i][1] - cloudB.rgb.c[j][1]);
-        distColorRGB[2] = (cloudA.rgb.c[i][2] - cloudB.rgb.c[j][2]) * (cloudA.rgb.c[i][2] - cloudB.rgb.c[j][2]);
+        break;
       }
 
-      distColor[0] = (in[0] - out[0]) * (in[0] - out[0]);
-      distColor[1] = (in[1] - out[1]) * (in[1] - out[1]);
-      distColor[2] = (in[2] - out[2]) * (in[2] - out[2]);
+      distColorRGB[0] = (cloudA.rgb.c[i][0] - color[0]) * (cloudA.rgb.c[i][0] - color[0]);
+      distColorRGB[1] = (cloudA.rgb.c[i][1] - color[1]) * (cloudA.rgb.c[i][1] - color[1]);
+      distColorRGB[2] = (cloudA.rgb.c[i][2] - color[2]) * (cloudA.rgb.c[i][2] - color[2]);
     }
-
-    double distReflectance;
-    distReflectance = 0.0;
-    if (cPar.bLidar && cloudA.bLidar && cloudB.bLidar)
+    else
     {
-      double diff = cloudA.lidar.reflectance[i] - cloudB.lidar.reflectance[j];
-      distReflectance = diff * diff;
+      colorsB.get(j, out);
+      distColorRGB[0] = (cloudA.rgb.c[i][0] - cloudB.rgb.c[j][0]) * (cloudA.rgb.c[i][0] - cloudB.rgb.c[j][0]);
+      distColorRGB[1] = (cloudA.rgb.c[i][1] - cloudB.rgb.c[j][1]) * (cloudA.rgb.c[i][1] - cloudB.rgb.c[j][1]);
+      distColorRGB[2] = (cloudA.rgb.c[i][2] - cloudB.rgb.c[j][2]) * (cloudA.rgb.c[i][2] - cloudB.rgb.c[j][2]);
     }
 
-    myMutex.lock();
+    distColor[0] = (in[0] - out[0]) * (in[0] - out[0]);
+    distColor[1] = (in[1] - out[1]) * (in[1] - out[1]);
+    distColor[2] = (in[2] - out[2]) * (in[2] - out[2]);
+  }
+
+  double distReflectance;
+  distReflectance = 0.0;
+  if (cPar.bLidar && cloudA.bLidar && cloudB.bLidar)
+  {
+    double diff = cloudA.lidar.reflectance[i] - cloudB.lidar.reflectance[j];
+    distReflectance = diff * diff;
+  }
+
+  err.c2c = distProj_c2c;
+  err.c2p = distProj;
+  for (int d = 0; d < 3; d++)
+  {
+    err.color[d] = distColor[d];
+    err.colorRGB[d] = distColorRGB[d];
+  }
+  err.reflectance = distReflectance;
+  return nbSameDist;
+}
+
+/**!
+ * \function
+ *   To accumulate the errors of the points [first, last) of A into the
+ *   block accumulators (see findMetric()). The point 'i' is the point
+ *   'i - first + offset' of the blocks: its errors are accumulated into
+ *   blockAcc[(i - first + offset) / METRIC_BLOCK_SIZE], in order, so that
+ *   the ranges of consecutive calls give the same sums as a single call.
+ *   The errors are also added to sketches[thread number], if not empty.
+ */
+static void
+accumulateMetric(PccPointCloud &cloudA, long first, long last, long offset, PccPointCloud &cloudB,
+                 const mseColors &colorsA, const mseColors &colorsB, commandPar &cPar, PccPointCloud &cloudNormalsB,
+                 bool bSameGeometry, vector<metricAccumulator> &blockAcc, vector<metricSketches> &sketches)
+{
+  const bool bGrid = useVoxelGrid( cloudA, cloudB, cPar );
+  const nanoflann::SearchParams searchParams( 32, cPar.approxEps, true, size_t( cPar.approxLeaves ) );
+#if DUPLICATECOLORS_DEBUG
+  long NbNeighborsDst[METRIC_NEIGHBORS_MAX] = {};
+#endif
+
+  // Chunks match the blocks: each block is accumulated by a single thread, in order
+  parallelChunks( offset, offset + last - first, METRIC_BLOCK_SIZE, [&]( long k )
+  {
+    const long i = k - offset + first;
+    metricAccumulator &acc = blockAcc[k / METRIC_BLOCK_SIZE];
+    pointErrors err;
+    const size_t nbSameDist = getPointErrors( i, cloudA, cloudB, colorsA, colorsB, cPar, cloudNormalsB, bSameGeometry, bGrid,
+                                              searchParams, err );
+    if (nbSameDist == 0)
+    {
+      output( cPar ) << " WARNING: requested neighbors could not be found " << endl;
+      return;
+    }
 
-    num++;
+    acc.num++;
     // mean square distance
-    sse_dist_b_c2c += distProj_c2c;
-    if (distProj_c2c > max_dist_b_c2c)
-      max_dist_b_c2c = distProj_c2c;
+    acc.sse_dist_b_c2c += err.c2c;
+    if (err.c2c > acc.max_dist_b_c2c)
+      acc.max_dist_b_c2c = err.c2c;
     if (!cPar.c2c_only)
     {
-      sse_dist_b_c2p += distProj;
-      if (distProj > max_dist_b_c2p)
-        max_dist_b_c2p = distProj;
+      acc.sse_dist_b_c2p += err.c2p;
+      if (err.c2p > acc.max_dist_b_c2p)
+        acc.max_dist_b_c2p = err.c2p;
     }
     if (cPar.bColor)
     {
-      sse_color[0] += distColor[0];
-      sse_color[1] += distColor[1];
-      sse_color[2] += distColor[2];
+      acc.sse_color[0] += err.color[0];
+      acc.sse_color[1] += err.color[1];
+      acc.sse_color[2] += err.color[2];
 
-      max_colorRGB[0] = max(max_colorRGB[0], distColorRGB[0]);
-      max_colorRGB[1] = max(max_colorRGB[1], distColorRGB[1]);
-      max_colorRGB[2] = max(max_colorRGB[2], distColorRGB[2]);
+      acc.max_colorRGB[0] = max(acc.max_colorRGB[0], err.colorRGB[0]);
+      acc.max_colorRGB[1] = max(acc.max_colorRGB[1], err.colorRGB[1]);
+      acc.max_colorRGB[2] = max(acc.max_colorRGB[2], err.colorRGB[2]);
     }
     if (cPar.bLidar && cloudA.bLidar && cloudB.bLidar)
     {
-      sse_reflectance += distReflectance;
-      max_reflectance = max(max_reflectance, distReflectance);
+      acc.sse_reflectance += err.reflectance;
+      acc.max_reflectance = max(acc.max_reflectance, err.reflectance);
+    }
+
+    if (!sketches.empty())
+    {
+#ifdef _OPENMP
+      metricSketches &sketch = sketches[omp_get_thread_num()];
+#else
+      metricSketches &sketch = sketches[0];
+#endif
+      sketch.c2c.add( err.c2c );
+      if (!cPar.c2c_only)
+        sketch.c2p.add( err.c2p );
+      if (cPar.bColor)
+        for (int d = 0; d < 3; d++)
+          sketch.color[d].add( err.color[d] );
+      if (cPar.bLidar && cloudA.bLidar && cloudB.bLidar)
+        sketch.reflectance.add( err.reflectance );
     }
 
 #if DUPLICATECOLORS_DEBUG
-    for (long n = 0; n < num_results; n++)
-      if (rgb[n].size())
-        NbNeighborsDst[n]++;
+#pragma omp critical
+    for (size_t n = 0; n < nbSameDist; n++)
+      NbNeighborsDst[n]++;
 #endif
+  } );
 
-    myMutex.unlock();
-  }
 #if DUPLICATECOLORS_DEBUG
-  cout << " DEBUG: " << NbNeighborsDst[1] << " points (" << (float)NbNeighborsDst[1] * 100.0 / cloudA.size << "%) found with at least 2 neighbors at the same minimum distance" << endl;
+  cout << " DEBUG: " << NbNeighborsDst[1] << " points (" << (float)NbNeighborsDst[1] * 100.0 / (last - first) << "%) found with at least 2 neighbors at the same minimum distance" << endl;
 #endif
+}
+
+// Bias of the psnr of an mse with the given bias: psnr(mse) - psnr(mse - bias)
+static float
+getPSNRBias(float mse, float bias)
+{
+  if (mse <= 0)
+    return 0;
+  if (mse - bias <= 0)
+    return -std::numeric_limits<float>::infinity();
+  return float( 10 * log10( (mse - bias) / mse ) );
+}
+
+/**!
+ * \function
+ *   To derive the mean square errors, the maximums and their PSNR from the
+ *   sums of all the blocks, and the quantiles from the merged sketches
+ */
+static void
+setMetric(const metricAccumulator &total, const metricSketches &sketches, const commandPar &cPar, qMetric &metric)
+{
+  const long num = total.num;
 
-  metric.c2p_mse = float( sse_dist_b_c2p / num );
-  metric.c2c_mse = float( sse_dist_b_c2c / num );
-  metric.c2p_hausdorff = float( max_dist_b_c2p );
-  metric.c2c_hausdorff = float( max_dist_b_c2c );
+  metric.c2p_mse = float( total.sse_dist_b_c2p / num );
+  metric.c2c_mse = float( total.sse_dist_b_c2c / num );
+  metric.c2p_hausdorff = float( total.max_dist_b_c2p );
+  metric.c2c_hausdorff = float( total.max_dist_b_c2c );
 
   // from distance to PSNR. cloudA always the original
   metric.c2c_psnr = getPSNR( metric.c2c_mse, metric.pPSNR, 3 );
@@ -604,9 +1006,9 @@ findMetric(PccPointCloud &cloudA, PccPointCloud &cloudB, commandPar &cPar, PccPo
 
   if (cPar.bColor)
   {
-    metric.color_mse[0] = float( sse_color[0] / num );
-    metric.color_mse[1] = float( sse_color[1] / num );
-    metric.color_mse[2] = float( sse_color[2] / num );
+    metric.color_mse[0] = float( total.sse_color[0] / num );
+    metric.color_mse[1] = float( total.sse_color[1] / num );
+    metric.color_mse[2] = float( total.sse_color[2] / num );
 
     if (cPar.mseSpace == 1) //YCbCr
     {
@@ -627,9 +1029,9 @@ findMetric(PccPointCloud &cloudA, PccPointCloud &cloudB, commandPar &cPar, PccPo
       metric.color_psnr[2] = getPSNR(metric.color_mse[2], 511);
     }
 
-    metric.color_rgb_hausdorff[0] = float( max_colorRGB[0] );
-    metric.color_rgb_hausdorff[1] = float( max_colorRGB[1] );
-    metric.color_rgb_hausdorff[2] = float( max_colorRGB[2] );
+    metric.color_rgb_hausdorff[0] = float( total.max_colorRGB[0] );
+    metric.color_rgb_hausdorff[1] = float( total.max_colorRGB[1] );
+    metric.color_rgb_hausdorff[2] = float( total.max_colorRGB[2] );
 
     metric.color_rgb_hausdorff_psnr[0] = getPSNR( metric.color_rgb_hausdorff[0], 255.0 );
     metric.color_rgb_hausdorff_psnr[1] = getPSNR( metric.color_rgb_hausdorff[1], 255.0 );
@@ -638,16 +1040,222 @@ findMetric(PccPointCloud &cloudA, PccPointCloud &cloudB, commandPar &cPar, PccPo
 
   if (cPar.bLidar)
   {
-    metric.reflectance_mse = float( sse_reflectance / num );
+    metric.reflectance_mse = float( total.sse_reflectance / num );
     metric.reflectance_psnr = getPSNR( float( metric.reflectance_mse ), float( std::numeric_limits<unsigned short>::max() ) );
-    metric.reflectance_hausdorff = float( max_reflectance );
+    metric.reflectance_hausdorff = float( total.max_reflectance );
     metric.reflectance_hausdorff_psnr = getPSNR(metric.reflectance_hausdorff, std::numeric_limits<unsigned short>::max() );
   }
 
-#if PRINT_TIMING
-  clock_t t3 = clock();
-  cout << "   Error computing takes " << (t3-t2)/CLOCKS_PER_SEC << " seconds (in CPU time)." << endl;
-#endif
+  if (isApproximate( cPar ))
+  {
+    metric.c2c_psnr_bias = getPSNRBias( metric.c2c_mse, metric.c2c_mse_bias );
+    metric.c2p_psnr_bias = getPSNRBias( metric.c2p_mse, metric.c2p_mse_bias );
+    for (int d = 0; d < 3; d++)
+      metric.color_psnr_bias[d] = getPSNRBias( metric.color_mse[d], metric.color_mse_bias[d] );
+    metric.reflectance_psnr_bias = getPSNRBias( metric.reflectance_mse, metric.reflectance_mse_bias );
+  }
+
+  if (cPar.bQuantiles)
+  {
+    for (int q = 0; q < PCC_QUANTILE_NUM; q++)
+    {
+      metric.c2c_quantile[q] = float( sketches.c2c.quantile( quantileLevels[q] ) );
+      metric.c2p_quantile[q] = float( sketches.c2p.quantile( quantileLevels[q] ) );
+      for (int d = 0; d < 3; d++)
+        metric.color_quantile[d][q] = float( sketches.color[d].quantile( quantileLevels[q] ) );
+      metric.reflectance_quantile[q] = float( sketches.reflectance.quantile( quantileLevels[q] ) );
+    }
+  }
+}
+
+/**!
+ * \function
+ *   To estimate the bias of the mse of the approximate searches (see
+ *   commandPar::approxEps): the errors of a sample of the points of A are
+ *   computed with both the approximate and the exact searches. The bias is
+ *   the mean of the differences, with the half width of its 95% confidence
+ *   interval. The sample is drawn with a fixed seed, so that the estimates
+ *   are reproducible. The psnr biases are derived by setMetric()
+ */
+static void
+estimateBias(PccPointCloud &cloudA, PccPointCloud &cloudB, const mseColors &colorsA, const mseColors &colorsB,
+             const commandPar &cPar, PccPointCloud &cloudNormalsB, bool bSameGeometry, qMetric &metric)
+{
+  const long nbSamples = min( long( cPar.approxSamples ), cloudA.size );
+  if (nbSamples <= 0)
+    return;
+  const bool bGrid = useVoxelGrid( cloudA, cloudB, cPar );
+  const nanoflann::SearchParams approxParams( 32, cPar.approxEps, true, size_t( cPar.approxLeaves ) );
+
+  // Differences of the errors: c2c, c2p, color[3], reflectance
+  vector<std::array<double, 6>> diffs( nbSamples );
+  parallelChunks( 0, nbSamples, 64, [&]( long k )
+  {
+    // splitmix64 of the sample number
+    uint64_t z = uint64_t( k + 1 ) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    const long i = long( (z ^ (z >> 31)) % uint64_t( cloudA.size ) );
+
+    pointErrors approx, exact;
+    std::array<double, 6> &d = diffs[k];
+    d.fill( 0.0 );
+    if (!getPointErrors( i, cloudA, cloudB, colorsA, colorsB, cPar, cloudNormalsB, bSameGeometry, bGrid, approxParams, approx ) ||
+        !getPointErrors( i, cloudA, cloudB, colorsA, colorsB, cPar, cloudNormalsB, bSameGeometry, bGrid, nanoflann::SearchParams(), exact ))
+      return;
+    d[0] = approx.c2c - exact.c2c;
+    d[1] = approx.c2p - exact.c2p;
+    for (int c = 0; c < 3; c++)
+      d[2 + c] = approx.color[c] - exact.color[c];
+    d[5] = approx.reflectance - exact.reflectance;
+  } );
+
+  double bias[6];
+  double ci[6];
+  for (int e = 0; e < 6; e++)
+  {
+    double sum = 0;
+    for (const auto &d : diffs)
+      sum += d[e];
+    bias[e] = sum / nbSamples;
+    double sse = 0;
+    for (const auto &d : diffs)
+      sse += (d[e] - bias[e]) * (d[e] - bias[e]);
+    ci[e] = nbSamples > 1 ? 1.96 * sqrt( sse / (nbSamples - 1) / nbSamples ) : 0.0;
+  }
+  metric.c2c_mse_bias = float( bias[0] );
+  metric.c2c_mse_bias_ci = float( ci[0] );
+  metric.c2p_mse_bias = float( bias[1] );
+  metric.c2p_mse_bias_ci = float( ci[1] );
+  for (int c = 0; c < 3; c++)
+  {
+    metric.color_mse_bias[c] = float( bias[2 + c] );
+    metric.color_mse_bias_ci[c] = float( ci[2 + c] );
+  }
+  metric.reflectance_mse_bias = float( bias[5] );
+  metric.reflectance_mse_bias_ci = float( ci[5] );
+}
+
+/**!
+ * \function
+ *   To compute "one-way" quality metric: Point-to-Point, Point-to-Plane
+ *   and RGB. Loop over each point in A. Normals in B to be used
+ *
+ *   1) For each point in A, find a corresponding point in B.
+ *   2) Form an error vector between the point pair.
+ *   3) Use the length of the error vector as point-to-point measure
+ *   4) Project the error vector along the normals in B, use the length
+ *   of the projected error vector as point-to-plane measure
+ *
+ *   @param cloudA: Reference point cloud. e.g. the original cloud, on
+ *     which normals would be estimated. It is the full set of point
+ *     cloud. Multiple points in count
+ *   @param cloudB: Processed point cloud. e.g. the decoded cloud
+ *   @param cPar: Command line parameters
+ *   @param cloudNormalsB: Normals for cloudB
+ *   @param metric: updated quality metric, to be returned
+ *   @param bSameGeometry: A and B have the same geometry (see
+ *     sameGeometry()), the nearest neighbor of point 'i' is point 'i'
+ * \note
+ *   PointT typename of point used in point cloud
+ * \author
+ *   Dong Tian, MERL
+ */
+void
+findMetric(PccPointCloud &cloudA, PccPointCloud &cloudB, const mseColors &colorsA, const mseColors &colorsB, commandPar &cPar, PccPointCloud &cloudNormalsB, qMetric &metric,
+           bool bSameGeometry)
+{
+#if PRINT_TIMING
+  clock_t t2 = clock();
+#endif
+  vector<metricAccumulator> blockAcc( (cloudA.size + METRIC_BLOCK_SIZE - 1) / METRIC_BLOCK_SIZE );
+  vector<metricSketches> sketches = threadSketches( cPar );
+  accumulateMetric( cloudA, 0, cloudA.size, 0, cloudB, colorsA, colorsB, cPar, cloudNormalsB, bSameGeometry, blockAcc, sketches );
+  if (isApproximate( cPar ))
+    estimateBias( cloudA, cloudB, colorsA, colorsB, cPar, cloudNormalsB, bSameGeometry, metric );
+  setMetric( mergeBlocks( blockAcc ), mergeSketches( sketches ), cPar, metric );
+
+#if PRINT_TIMING
+  clock_t t3 = clock();
+  cout << "   Error computing takes " << (t3-t2)/CLOCKS_PER_SEC << " seconds (in CPU time)." << endl;
+#endif
+}
+
+/**!
+ * \brief
+ *  nanoflann result set for the early break directed Hausdorff distance:
+ *  the nearest neighbor distance is only needed when it is above the
+ *  current maximum. As soon as a point within this bound is found, the
+ *  worst distance becomes negative and all the remaining branches of the
+ *  kd-tree are pruned.
+ */
+class HausdorffResultSet
+{
+public:
+  distance_type bound;          //! current maximum, the search stops below it
+  distance_type dist;           //! nearest neighbor distance found so far
+
+  HausdorffResultSet(distance_type bound_) : bound( bound_ ), dist( numeric_limits<distance_type>::max() ) {}
+
+  size_t size() const { return 1; }
+  bool full() const { return true; }
+  void addPoint(distance_type d, index_type) { if (d < dist) dist = d; }
+  distance_type worstDist() const { return dist > bound ? dist : distance_type( -1 ); }
+};
+
+/**!
+ * \function
+ *   To compute the "one-way" point-to-point Hausdorff distance only, with
+ *   the early break algorithm: the search for the nearest neighbor of a
+ *   point is abandoned as soon as a point of B closer than the current
+ *   maximum is found, as this point can not raise the maximum. The result
+ *   is the same as the one of findMetric(), but most of the searches stop
+ *   after a few candidates when the errors are small.
+ *
+ *   The points of A are visited with a large stride modulo the size of
+ *   the cloud, so that the first points processed are spread over the
+ *   whole cloud and raise the maximum quickly.
+ *
+ *   @param cloudA: Reference point cloud
+ *   @param cloudB: Processed point cloud
+ *   @param metric: updated quality metric (point-to-point Hausdorff only)
+ *   @param bSameGeometry: A and B have the same geometry, the distance is null
+ */
+void
+findHausdorff(PccPointCloud &cloudA, PccPointCloud &cloudB, qMetric &metric, bool bSameGeometry)
+{
+  if (bSameGeometry)
+  {
+    metric.c2c_hausdorff = 0;
+    metric.c2c_hausdorff_psnr = getPSNR( metric.c2c_hausdorff, metric.pPSNR, 3 );
+    return;
+  }
+
+  cloudB.buildKdtree();
+  const nanoflann::SearchParams params( 10, 0.0f, false );
+
+  const uint64_t n = cloudA.size;
+  uint64_t stride = 2654435761u;  // prime, coprime with n unless n is a multiple
+  if (n == 0 || n % stride == 0)
+    stride = 1;
+
+  // Shared by all the threads. A stale value only makes a search longer
+  std::atomic<distance_type> maxDist( 0 );
+
+  parallelChunks( cloudA.size, METRIC_BLOCK_SIZE, [&]( long k )
+  {
+    const long i = long( uint64_t( k ) * stride % n );
+    HausdorffResultSet result( maxDist.load( std::memory_order_relaxed ) );
+    const PointXYZSet::point_type pa = cloudA.xyz.point( i );
+    cloudB.findNeighbors( result, &pa[0], params );
+    distance_type current = result.bound;
+    while (result.dist > current && result.dist != numeric_limits<distance_type>::max() &&
+           !maxDist.compare_exchange_weak( current, result.dist, std::memory_order_relaxed ))
+      ;
+  } );
+
+  metric.c2c_hausdorff = float( maxDist.load() );
+  metric.c2c_hausdorff_psnr = getPSNR( metric.c2c_hausdorff, metric.pPSNR, 3 );
 }
 
 /*
@@ -670,6 +1278,8 @@ commandPar::commandPar()
   normIn = "";
   singlePass = false;
   hausdorff = false;
+  hausdorffOnly = false;
+  bQuantiles = false;
   c2c_only = false;
   bColor = false;
   bLidar = false;
@@ -677,6 +1287,16 @@ commandPar::commandPar()
   resolution = 0.0;
   dropDuplicates = 0;
   neighborsProc = 0;
+  concurrentPasses = false;
+  bVoxelGrid = true;
+  approxEps = 0.0;
+  approxLeaves = 0;
+  approxSamples = 1000;
+  memoryBudget = 0;
+  tileHalo = 0.0;
+  firstFrame = 0;
+  frameCount = 0;
+  bQuiet = false;
 }
 
 /**!
@@ -700,6 +1320,18 @@ qMetric::qMetric()
 
   reflectance_hausdorff = 0.0;
   reflectance_hausdorff_psnr = 0.0;
+
+  for (int q = 0; q < PCC_QUANTILE_NUM; q++)
+  {
+    c2c_quantile[q] = c2p_quantile[q] = reflectance_quantile[q] = 0.0;
+    color_quantile[0][q] = color_quantile[1][q] = color_quantile[2][q] = 0.0;
+  }
+
+  c2c_mse_bias = c2c_mse_bias_ci = c2c_psnr_bias = 0.0;
+  c2p_mse_bias = c2p_mse_bias_ci = c2p_psnr_bias = 0.0;
+  for (int d = 0; d < 3; d++)
+    color_mse_bias[d] = color_mse_bias_ci[d] = color_psnr_bias[d] = 0.0;
+  reflectance_mse_bias = reflectance_mse_bias_ci = reflectance_psnr_bias = 0.0;
 }
 
 /**!
@@ -711,180 +1343,381 @@ qMetric::qMetric()
  */
 
 /**!
- * function to compute the symmetric quality metric: Point-to-Point and Point-to-Plane
+ * function to add the wall clock time since "start" to a phase of the
+ * report, if any. Returns the current time.
+ */
+static double
+addTiming(qReport *report, const char *phase, double start)
+{
+  const double now = GetWallClock();
+  if (report)
+    report->addTiming( phase, now - start );
+  return now;
+}
+
+/**!
+ * function to build the kd-trees (or voxel grids) needed by
+ * computeQualityMetric concurrently. Each one is built once and then shared
+ * by all the steps (and all the calls) using the same point cloud. With the
+ * same geometry in A and B, only the peak value may need one.
+ */
+static void
+buildSearchIndexes(PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, const commandPar &cPar, bool bSameGeometry)
+{
+  const bool bPasses = cPar.file2 != "" && !bSameGeometry;
+  const bool bNormals = bPasses && !cPar.c2c_only;
+  const bool bGrid = useVoxelGrid( cloudA, cloudB, cPar );
+  const bool bGridNormals = useVoxelGrid( cloudNormalsA, cloudB, cPar );
+#pragma omp parallel sections
+  {
+#pragma omp section
+    {
+      if (cPar.resolution == 0.0)
+        cloudA.buildKdtree();
+      if (bPasses && !cPar.singlePass)
+        buildSearchIndex( cloudA, bGrid );
+    }
+#pragma omp section
+    {
+      if (bPasses)
+        buildSearchIndex( cloudB, bGrid );
+      if (bNormals)
+        buildSearchIndex( cloudB, bGridNormals );
+    }
+#pragma omp section
+    if (bNormals)
+      buildSearchIndex( cloudNormalsA, bGridNormals );
+  }
+}
+
+/**!
+ * function to run the A->B and B->A passes concurrently, as two tasks of
+ * the same team. Each task builds the kd-trees it needs (A->B also scales
+ * the normals) and its parallel loops become taskloops, so that the idle
+ * threads of one pass run the work of the other one.
+ */
+static void
+computeConcurrentPasses(PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, PccPointCloud &cloudNormalsB,
+                        const mseColors &colorsA, const mseColors &colorsB,
+                        commandPar &cPar, qMetric &metricA, qMetric &metricB, qReport *report)
+{
+  const bool bGrid = useVoxelGrid( cloudA, cloudB, cPar );
+  const bool bGridNormals = useVoxelGrid( cloudNormalsA, cloudB, cPar );
+  double tTreesA2B = 0, tNormals = 0, tA2B = 0, tTreesB2A = 0, tB2A = 0;
+#pragma omp parallel
+#pragma omp single
+  {
+#pragma omp task
+    {
+      const double t0 = GetWallClock();
+      buildSearchIndex( cloudB, bGrid );
+      if (!cPar.c2c_only)
+      {
+        buildSearchIndex( cloudB, bGridNormals );
+        buildSearchIndex( cloudNormalsA, bGridNormals );
+      }
+      const double t1 = GetWallClock();
+      if (!cPar.c2c_only)
+        scaleNormals( cloudNormalsA, cloudB, cloudNormalsB, cPar.bAverageNormals, bGridNormals );
+      const double t2 = GetWallClock();
+      findMetric( cloudA, cloudB, colorsA, colorsB, cPar, cloudNormalsB, metricA, false );
+      tTreesA2B = t1 - t0;
+      tNormals = t2 - t1;
+      tA2B = GetWallClock() - t2;
+    }
+#pragma omp task
+    {
+      const double t0 = GetWallClock();
+      buildSearchIndex( cloudA, bGrid );
+      const double t1 = GetWallClock();
+      findMetric( cloudB, cloudA, colorsB, colorsA, cPar, cloudNormalsA, metricB, false );
+      tTreesB2A = t1 - t0;
+      tB2A = GetWallClock() - t1;
+    }
+  }
+
+  // The passes overlap: each time is the wall clock time of its own task
+  if (report)
+  {
+    report->addTiming( "kdtree", tTreesA2B + tTreesB2A );
+    report->addTiming( "normals", tNormals );
+    report->addTiming( "A2B", tA2B );
+    report->addTiming( "B2A", tB2A );
+  }
+}
+
+/**!
+ * function to compute and print the point-to-point Hausdorff metric only
+ * (hausdorffOnly), with the early break search in both directions
+ */
+static void
+computeHausdorffPasses(PccPointCloud &cloudA, PccPointCloud &cloudB, const commandPar &cPar, float pPSNR,
+                       bool bSameGeometry, qMetric &qual_metric, qReport *report)
+{
+  ostream &out = output( cPar );
+  qMetric metricA;
+  qMetric metricB;
+  metricA.pPSNR = pPSNR;
+  metricB.pPSNR = pPSNR;
+  double t = GetWallClock();
+  findHausdorff( cloudA, cloudB, metricA, bSameGeometry );
+  t = addTiming( report, "A2B", t );
+  if (!cPar.singlePass)
+  {
+    findHausdorff( cloudB, cloudA, metricB, bSameGeometry );
+    addTiming( report, "B2A", t );
+  }
+  if (report)
+  {
+    report->metricA = metricA;
+    report->metricB = metricB;
+  }
+  out << endl;
+
+  out << "1. Use infile1 (A) as reference, loop over A, use normals on B. (A->B).\n";
+  out << "   h.       1(p2point): " << metricA.c2c_hausdorff << endl;
+  out << "   h.,PSNR  1(p2point): " << metricA.c2c_hausdorff_psnr << endl;
+  if (cPar.singlePass)
+  {
+    qual_metric = metricA;
+    return;
+  }
+
+  out << "2. Use infile2 (B) as reference, loop over B, use normals on A. (B->A).\n";
+  out << "   h.       2(p2point): " << metricB.c2c_hausdorff << endl;
+  out << "   h.,PSNR  2(p2point): " << metricB.c2c_hausdorff_psnr << endl;
+
+  qual_metric.c2c_hausdorff = max( metricA.c2c_hausdorff, metricB.c2c_hausdorff );
+  qual_metric.c2c_hausdorff_psnr = min( metricA.c2c_hausdorff_psnr, metricB.c2c_hausdorff_psnr );
+  if (report)
+    report->metricF = qual_metric;
+  out << "3. Final (symmetric).\n";
+  out << "   h.        (p2point): " << qual_metric.c2c_hausdorff << endl;
+  out << "   h.,PSNR   (p2point): " << qual_metric.c2c_hausdorff_psnr << endl;
+}
+
+/**!
+ * function to get the peak value for PSNR computation: the intrinsic
+ * resolution if imported, or the maximum NN distance within the original
+ * point cloud
  *   @param cloudA: point cloud, original version
- *   @param cloudNormalA: point cloud normals, original version
- *   @param cloudB: point cloud, decoded/reconstructed version
  *   @param cPar: input parameters
- *   @param qual_metric: quality metric, to be returned
- *
- * \author
- *   Dong Tian, MERL
  */
-void
-pcc_quality::computeQualityMetric(PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, commandPar &cPar, qMetric &qual_metric)
+float
+pcc_quality::computePeakValue(PccPointCloud &cloudA, const commandPar &cPar)
 {
+  ostream &out = output( cPar );
   float pPSNR;
 
   if (cPar.resolution != 0.0)
   {
-    cout << "Imported intrinsic resoluiton: " << cPar.resolution << endl;
+    out << "Imported intrinsic resoluiton: " << cPar.resolution << endl;
     pPSNR = cPar.resolution;
   }
-  else                          // Compute the peak value on the fly
+  else                          // Compute the peak value on the fly, unless known (sidecar cache)
   {
-    double minDist;
-    double maxDist;
-    findNNdistances(cloudA, minDist, maxDist);
-    pPSNR = float( maxDist );
-    cout << "Minimum and maximum NN distances (intrinsic resolutions): " << minDist << ", " << maxDist << endl;
+    if (cloudA.maxNNDist < 0)
+      findNNdistances(cloudA, 0, cloudA.size, cloudA.minNNDist, cloudA.maxNNDist);
+    pPSNR = float( cloudA.maxNNDist );
+    out << "Minimum and maximum NN distances (intrinsic resolutions): " << cloudA.minNNDist << ", " << cloudA.maxNNDist << endl;
   }
 
-  cout << "Peak distance for PSNR: " << pPSNR << endl;
-  qual_metric.pPSNR = pPSNR;
+  out << "Peak distance for PSNR: " << pPSNR << endl;
+  return pPSNR;
+}
 
-  if (cPar.file2 != "")
+/**!
+ * function to print the quantiles of the point errors of a pass (see
+ * commandPar::bQuantiles)
+ *   @param pass: "1", "2" or "F"
+ */
+static void
+printQuantiles(ostream &out, const qMetric &metric, const commandPar &cPar, const string &pass)
+{
+  auto print = [&]( const string &label, const float *values )
   {
-    // Check cloud size
-    size_t orgSize = cloudA.size;
-    size_t newSize = cloudB.size;
-    float ratio = float(1.0) * newSize / orgSize;
-    cout << "Point cloud sizes for org version, dec version, and the scaling ratio: " << orgSize << ", " << newSize << ", " << ratio << endl;
-  }
-
-  if (cPar.file2 == "" ) // If no file2 provided, return just after checking the NN
-    return;
-
-  // Based on normals on original point cloud, derive normals on reconstructed point cloud
-  PccPointCloud cloudNormalsB;
+    out << label;
+    for (int q = 0; q < PCC_QUANTILE_NUM; q++)
+      out << (q ? ", " : "") << quantileNames[q] << " " << values[q];
+    out << endl;
+  };
+  const string geomPass = pass == "F" ? " " : pass;
+  print( "   q.       " + geomPass + "(p2point): ", metric.c2c_quantile );
   if (!cPar.c2c_only)
-    scaleNormals( cloudNormalsA, cloudB, cloudNormalsB, cPar.bAverageNormals );
-  cout << "Normals prepared." << endl;
-  cout << endl;
+    print( "   q.       " + geomPass + "(p2plane): ", metric.c2p_quantile );
+  if (cPar.bColor)
+    for (int d = 0; d < 3; d++)
+      print( " q.c[" + to_string( d ) + "],    " + pass + "         : ", metric.color_quantile[d] );
+  if (cPar.bLidar)
+    print( " q.r,       " + pass + "         : ", metric.reflectance_quantile );
+}
 
-  if (cPar.bColor && (!cloudA.bRgb || !cloudB.bRgb))
+/**!
+ * function to print the estimated biases of the mse and psnr of a pass with
+ * the approximate search (see estimateBias())
+ *   @param pass: "1", "2" or "F"
+ */
+static void
+printBias(ostream &out, const qMetric &metric, const commandPar &cPar, const string &pass)
+{
+  auto print = [&]( const string &label, float bias, float ci, float psnrBias )
   {
-    cout << "WARNING: no color properties in input files, disabling color metrics.\n";
-    cPar.bColor = false;
-  }
+    out << label << "mse " << bias << " +- " << ci << ", PSNR " << psnrBias << endl;
+  };
+  const string geomPass = pass == "F" ? " " : pass;
+  print( "   b.       " + geomPass + "(p2point): ", metric.c2c_mse_bias, metric.c2c_mse_bias_ci, metric.c2c_psnr_bias );
+  if (!cPar.c2c_only)
+    print( "   b.       " + geomPass + "(p2plane): ", metric.c2p_mse_bias, metric.c2p_mse_bias_ci, metric.c2p_psnr_bias );
+  if (cPar.bColor)
+    for (int d = 0; d < 3; d++)
+      print( " b.c[" + to_string( d ) + "],    " + pass + "         : ", metric.color_mse_bias[d], metric.color_mse_bias_ci[d],
+             metric.color_psnr_bias[d] );
+  if (cPar.bLidar)
+    print( " b.r,       " + pass + "         : ", metric.reflectance_mse_bias, metric.reflectance_mse_bias_ci,
+           metric.reflectance_psnr_bias );
+}
 
-  if (cPar.bLidar && (!cloudA.bLidar || !cloudB.bLidar))
+/**!
+ * function to print the metrics of both passes, derive the final
+ * (symmetric) ones and fill the report, if any
+ *   @param bNoColor, bNoLidar: requested metrics missing in the input files
+ */
+static void
+reportMetrics(const qMetric &metricA, const qMetric &metricB, const commandPar &cPar, bool bNoColor, bool bNoLidar,
+              qMetric &qual_metric, qReport *report)
+{
+  ostream &out = output( cPar );
+  if (report)
   {
-    cout << "WARNING: no reflectance property in input files, disabling reflectance metrics.\n";
-    cPar.bLidar = false;
+    report->metricA = metricA;
+    report->metricB = metricB;
   }
+  out << "Normals prepared." << endl;
+  out << endl;
+
+  if (bNoColor)
+    out << "WARNING: no color properties in input files, disabling color metrics.\n";
+
+  if (bNoLidar)
+    out << "WARNING: no reflectance property in input files, disabling reflectance metrics.\n";
 
   if (cPar.bLidar && cPar.neighborsProc)
   {
-    cout << "WARNING: reflectance metrics are computed without neighborsProc parameter.\n";
+    out << "WARNING: reflectance metrics are computed without neighborsProc parameter.\n";
   }
 
+  if (isApproximate( cPar ))
+    out << "WARNING: approximate nearest neighbor search, the biases (b.) are estimated on "
+        << cPar.approxSamples << " points per pass.\n";
+
   // Use "a" as reference
-  cout << "1. Use infile1 (A) as reference, loop over A, use normals on B. (A->B).\n";
-  qMetric metricA;
-  metricA.pPSNR = pPSNR;
-  findMetric( cloudA, cloudB, cPar, cloudNormalsB, metricA );
+  out << "1. Use infile1 (A) as reference, loop over A, use normals on B. (A->B).\n";
 
-  cout << "   mse1      (p2point): " << metricA.c2c_mse << endl;
-  cout << "   mse1,PSNR (p2point): " << metricA.c2c_psnr << endl;
+  out << "   mse1      (p2point): " << metricA.c2c_mse << endl;
+  out << "   mse1,PSNR (p2point): " << metricA.c2c_psnr << endl;
   if (!cPar.c2c_only)
   {
-    cout << "   mse1      (p2plane): " << metricA.c2p_mse << endl;
-    cout << "   mse1,PSNR (p2plane): " << metricA.c2p_psnr << endl;
+    out << "   mse1      (p2plane): " << metricA.c2p_mse << endl;
+    out << "   mse1,PSNR (p2plane): " << metricA.c2p_psnr << endl;
   }
   if ( cPar.hausdorff )
   {
-    cout << "   h.       1(p2point): " << metricA.c2c_hausdorff << endl;
-    cout << "   h.,PSNR  1(p2point): " << metricA.c2c_hausdorff_psnr << endl;
+    out << "   h.       1(p2point): " << metricA.c2c_hausdorff << endl;
+    out << "   h.,PSNR  1(p2point): " << metricA.c2c_hausdorff_psnr << endl;
     if (!cPar.c2c_only)
     {
-      cout << "   h.       1(p2plane): " << metricA.c2p_hausdorff << endl;
-      cout << "   h.,PSNR  1(p2plane): " << metricA.c2p_hausdorff_psnr << endl;
+      out << "   h.       1(p2plane): " << metricA.c2p_hausdorff << endl;
+      out << "   h.,PSNR  1(p2plane): " << metricA.c2p_hausdorff_psnr << endl;
     }
   }
   if ( cPar.bColor )
   {
-    cout << "   c[0],    1         : " << metricA.color_mse[0] << endl;
-    cout << "   c[1],    1         : " << metricA.color_mse[1] << endl;
-    cout << "   c[2],    1         : " << metricA.color_mse[2] << endl;
-    cout << "   c[0],PSNR1         : " << metricA.color_psnr[0] << endl;
-    cout << "   c[1],PSNR1         : " << metricA.color_psnr[1] << endl;
-    cout << "   c[2],PSNR1         : " << metricA.color_psnr[2] << endl;
+    out << "   c[0],    1         : " << metricA.color_mse[0] << endl;
+    out << "   c[1],    1         : " << metricA.color_mse[1] << endl;
+    out << "   c[2],    1         : " << metricA.color_mse[2] << endl;
+    out << "   c[0],PSNR1         : " << metricA.color_psnr[0] << endl;
+    out << "   c[1],PSNR1         : " << metricA.color_psnr[1] << endl;
+    out << "   c[2],PSNR1         : " << metricA.color_psnr[2] << endl;
     if ( cPar.hausdorff )
     {
-      cout << " h.c[0],    1         : " << metricA.color_rgb_hausdorff[0] << endl;
-      cout << " h.c[1],    1         : " << metricA.color_rgb_hausdorff[1] << endl;
-      cout << " h.c[2],    1         : " << metricA.color_rgb_hausdorff[2] << endl;
-      cout << " h.c[0],PSNR1         : " << metricA.color_rgb_hausdorff_psnr[0] << endl;
-      cout << " h.c[1],PSNR1         : " << metricA.color_rgb_hausdorff_psnr[1] << endl;
-      cout << " h.c[2],PSNR1         : " << metricA.color_rgb_hausdorff_psnr[2] << endl;
+      out << " h.c[0],    1         : " << metricA.color_rgb_hausdorff[0] << endl;
+      out << " h.c[1],    1         : " << metricA.color_rgb_hausdorff[1] << endl;
+      out << " h.c[2],    1         : " << metricA.color_rgb_hausdorff[2] << endl;
+      out << " h.c[0],PSNR1         : " << metricA.color_rgb_hausdorff_psnr[0] << endl;
+      out << " h.c[1],PSNR1         : " << metricA.color_rgb_hausdorff_psnr[1] << endl;
+      out << " h.c[2],PSNR1         : " << metricA.color_rgb_hausdorff_psnr[2] << endl;
     }
   }
   if ( cPar.bLidar )
   {
-    cout << "   r,       1         : " << metricA.reflectance_mse  << endl;
-    cout << "   r,PSNR   1         : " << metricA.reflectance_psnr << endl;
+    out << "   r,       1         : " << metricA.reflectance_mse  << endl;
+    out << "   r,PSNR   1         : " << metricA.reflectance_psnr << endl;
     if ( cPar.hausdorff )
     {
-      cout << " h.r,       1         : " << metricA.reflectance_hausdorff  << endl;
-      cout << " h.r,PSNR   1         : " << metricA.reflectance_hausdorff_psnr << endl;
+      out << " h.r,       1         : " << metricA.reflectance_hausdorff  << endl;
+      out << " h.r,PSNR   1         : " << metricA.reflectance_hausdorff_psnr << endl;
     }
   }
+  if ( cPar.bQuantiles )
+    printQuantiles( out, metricA, cPar, "1" );
+  if ( isApproximate( cPar ) )
+    printBias( out, metricA, cPar, "1" );
 
   if (!cPar.singlePass)
   {
     // Use "b" as reference
-    cout << "2. Use infile2 (B) as reference, loop over B, use normals on A. (B->A).\n";
-    qMetric metricB;
-    metricB.pPSNR = pPSNR;
-    findMetric( cloudB, cloudA, cPar, cloudNormalsA, metricB );
+    out << "2. Use infile2 (B) as reference, loop over B, use normals on A. (B->A).\n";
 
-    cout << "   mse2      (p2point): " << metricB.c2c_mse << endl;
-    cout << "   mse2,PSNR (p2point): " << metricB.c2c_psnr << endl;
+    out << "   mse2      (p2point): " << metricB.c2c_mse << endl;
+    out << "   mse2,PSNR (p2point): " << metricB.c2c_psnr << endl;
     if (!cPar.c2c_only)
     {
-      cout << "   mse2      (p2plane): " << metricB.c2p_mse << endl;
-      cout << "   mse2,PSNR (p2plane): " << metricB.c2p_psnr << endl;
+      out << "   mse2      (p2plane): " << metricB.c2p_mse << endl;
+      out << "   mse2,PSNR (p2plane): " << metricB.c2p_psnr << endl;
     }
     if ( cPar.hausdorff )
     {
-      cout << "   h.       2(p2point): " << metricB.c2c_hausdorff << endl;
-      cout << "   h.,PSNR  2(p2point): " << metricB.c2c_hausdorff_psnr << endl;
+      out << "   h.       2(p2point): " << metricB.c2c_hausdorff << endl;
+      out << "   h.,PSNR  2(p2point): " << metricB.c2c_hausdorff_psnr << endl;
       if (!cPar.c2c_only)
       {
-        cout << "   h.       2(p2plane): " << metricB.c2p_hausdorff << endl;
-        cout << "   h.,PSNR  2(p2plane): " << metricB.c2p_hausdorff_psnr << endl;
+        out << "   h.       2(p2plane): " << metricB.c2p_hausdorff << endl;
+        out << "   h.,PSNR  2(p2plane): " << metricB.c2p_hausdorff_psnr << endl;
       }
     }
     if ( cPar.bColor)
     {
-      cout << "   c[0],    2         : " << metricB.color_mse[0] << endl;
-      cout << "   c[1],    2         : " << metricB.color_mse[1] << endl;
-      cout << "   c[2],    2         : " << metricB.color_mse[2] << endl;
-      cout << "   c[0],PSNR2         : " << metricB.color_psnr[0] << endl;
-      cout << "   c[1],PSNR2         : " << metricB.color_psnr[1] << endl;
-      cout << "   c[2],PSNR2         : " << metricB.color_psnr[2] << endl;
+      out << "   c[0],    2         : " << metricB.color_mse[0] << endl;
+      out << "   c[1],    2         : " << metricB.color_mse[1] << endl;
+      out << "   c[2],    2         : " << metricB.color_mse[2] << endl;
+      out << "   c[0],PSNR2         : " << metricB.color_psnr[0] << endl;
+      out << "   c[1],PSNR2         : " << metricB.color_psnr[1] << endl;
+      out << "   c[2],PSNR2         : " << metricB.color_psnr[2] << endl;
       if ( cPar.hausdorff)
       {
-        cout << " h.c[0],    2         : " << metricB.color_rgb_hausdorff[0] << endl;
-        cout << " h.c[1],    2         : " << metricB.color_rgb_hausdorff[1] << endl;
-        cout << " h.c[2],    2         : " << metricB.color_rgb_hausdorff[2] << endl;
-        cout << " h.c[0],PSNR2         : " << metricB.color_rgb_hausdorff_psnr[0] << endl;
-        cout << " h.c[1],PSNR2         : " << metricB.color_rgb_hausdorff_psnr[1] << endl;
-        cout << " h.c[2],PSNR2         : " << metricB.color_rgb_hausdorff_psnr[2] << endl;
+        out << " h.c[0],    2         : " << metricB.color_rgb_hausdorff[0] << endl;
+        out << " h.c[1],    2         : " << metricB.color_rgb_hausdorff[1] << endl;
+        out << " h.c[2],    2         : " << metricB.color_rgb_hausdorff[2] << endl;
+        out << " h.c[0],PSNR2         : " << metricB.color_rgb_hausdorff_psnr[0] << endl;
+        out << " h.c[1],PSNR2         : " << metricB.color_rgb_hausdorff_psnr[1] << endl;
+        out << " h.c[2],PSNR2         : " << metricB.color_rgb_hausdorff_psnr[2] << endl;
       }
     }
     if ( cPar.bLidar )
     {
-      cout << "   r,       2         : " << metricB.reflectance_mse  << endl;
-      cout << "   r,PSNR   2         : " << metricB.reflectance_psnr << endl;
+      out << "   r,       2         : " << metricB.reflectance_mse  << endl;
+      out << "   r,PSNR   2         : " << metricB.reflectance_psnr << endl;
       if ( cPar.hausdorff )
       {
-        cout << " h.r,       2         : " << metricB.reflectance_hausdorff  << endl;
-        cout << " h.r,PSNR   2         : " << metricB.reflectance_hausdorff_psnr << endl;
+        out << " h.r,       2         : " << metricB.reflectance_hausdorff  << endl;
+        out << " h.r,PSNR   2         : " << metricB.reflectance_hausdorff_psnr << endl;
       }
 
     }
+    if ( cPar.bQuantiles )
+      printQuantiles( out, metricB, cPar, "2" );
+    if ( isApproximate( cPar ) )
+      printBias( out, metricB, cPar, "2" );
 
     // Derive the final symmetric metric
     qual_metric.c2c_mse = max( metricA.c2c_mse, metricB.c2c_mse );
@@ -922,52 +1755,556 @@ pcc_quality::computeQualityMetric(PccPointCloud &cloudA, PccPointCloud &cloudNor
       qual_metric.reflectance_hausdorff  = max( metricA.reflectance_hausdorff,  metricB.reflectance_hausdorff  );
       qual_metric.reflectance_hausdorff_psnr = min( metricA.reflectance_hausdorff_psnr, metricB.reflectance_hausdorff_psnr );
     }
+    if ( cPar.bQuantiles )
+    {
+      for (int q = 0; q < PCC_QUANTILE_NUM; q++)
+      {
+        qual_metric.c2c_quantile[q] = max( metricA.c2c_quantile[q], metricB.c2c_quantile[q] );
+        qual_metric.c2p_quantile[q] = max( metricA.c2p_quantile[q], metricB.c2p_quantile[q] );
+        for (int d = 0; d < 3; d++)
+          qual_metric.color_quantile[d][q] = max( metricA.color_quantile[d][q], metricB.color_quantile[d][q] );
+        qual_metric.reflectance_quantile[q] = max( metricA.reflectance_quantile[q], metricB.reflectance_quantile[q] );
+      }
+    }
+    if ( isApproximate( cPar ) )
+    {
+      // Biases of the pass of the final mse
+      const qMetric &c2c = metricA.c2c_mse >= metricB.c2c_mse ? metricA : metricB;
+      qual_metric.c2c_mse_bias = c2c.c2c_mse_bias;
+      qual_metric.c2c_mse_bias_ci = c2c.c2c_mse_bias_ci;
+      qual_metric.c2c_psnr_bias = c2c.c2c_psnr_bias;
+      const qMetric &c2p = metricA.c2p_mse >= metricB.c2p_mse ? metricA : metricB;
+      qual_metric.c2p_mse_bias = c2p.c2p_mse_bias;
+      qual_metric.c2p_mse_bias_ci = c2p.c2p_mse_bias_ci;
+      qual_metric.c2p_psnr_bias = c2p.c2p_psnr_bias;
+      for (int d = 0; d < 3; d++)
+      {
+        const qMetric &color = metricA.color_mse[d] >= metricB.color_mse[d] ? metricA : metricB;
+        qual_metric.color_mse_bias[d] = color.color_mse_bias[d];
+        qual_metric.color_mse_bias_ci[d] = color.color_mse_bias_ci[d];
+        qual_metric.color_psnr_bias[d] = color.color_psnr_bias[d];
+      }
+      const qMetric &reflectance = metricA.reflectance_mse >= metricB.reflectance_mse ? metricA : metricB;
+      qual_metric.reflectance_mse_bias = reflectance.reflectance_mse_bias;
+      qual_metric.reflectance_mse_bias_ci = reflectance.reflectance_mse_bias_ci;
+      qual_metric.reflectance_psnr_bias = reflectance.reflectance_psnr_bias;
+    }
 
-    cout << "3. Final (symmetric).\n";
-    cout << "   mseF      (p2point): " << qual_metric.c2c_mse << endl;
-    cout << "   mseF,PSNR (p2point): " << qual_metric.c2c_psnr << endl;
+    out << "3. Final (symmetric).\n";
+    out << "   mseF      (p2point): " << qual_metric.c2c_mse << endl;
+    out << "   mseF,PSNR (p2point): " << qual_metric.c2c_psnr << endl;
     if (!cPar.c2c_only)
     {
-      cout << "   mseF      (p2plane): " << qual_metric.c2p_mse << endl;
-      cout << "   mseF,PSNR (p2plane): " << qual_metric.c2p_psnr << endl;
+      out << "   mseF      (p2plane): " << qual_metric.c2p_mse << endl;
+      out << "   mseF,PSNR (p2plane): " << qual_metric.c2p_psnr << endl;
     }
     if ( cPar.hausdorff )
     {
-      cout << "   h.        (p2point): " << qual_metric.c2c_hausdorff << endl;
-      cout << "   h.,PSNR   (p2point): " << qual_metric.c2c_hausdorff_psnr << endl;
+      out << "   h.        (p2point): " << qual_metric.c2c_hausdorff << endl;
+      out << "   h.,PSNR   (p2point): " << qual_metric.c2c_hausdorff_psnr << endl;
       if (!cPar.c2c_only)
       {
-        cout << "   h.        (p2plane): " << qual_metric.c2p_hausdorff << endl;
-        cout << "   h.,PSNR   (p2plane): " << qual_metric.c2p_hausdorff_psnr << endl;
+        out << "   h.        (p2plane): " << qual_metric.c2p_hausdorff << endl;
+        out << "   h.,PSNR   (p2plane): " << qual_metric.c2p_hausdorff_psnr << endl;
       }
     }
     if ( cPar.bColor )
     {
-      cout << "   c[0],    F         : " << qual_metric.color_mse[0] << endl;
-      cout << "   c[1],    F         : " << qual_metric.color_mse[1] << endl;
-      cout << "   c[2],    F         : " << qual_metric.color_mse[2] << endl;
-      cout << "   c[0],PSNRF         : " << qual_metric.color_psnr[0] << endl;
-      cout << "   c[1],PSNRF         : " << qual_metric.color_psnr[1] << endl;
-      cout << "   c[2],PSNRF         : " << qual_metric.color_psnr[2] << endl;
+      out << "   c[0],    F         : " << qual_metric.color_mse[0] << endl;
+      out << "   c[1],    F         : " << qual_metric.color_mse[1] << endl;
+      out << "   c[2],    F         : " << qual_metric.color_mse[2] << endl;
+      out << "   c[0],PSNRF         : " << qual_metric.color_psnr[0] << endl;
+      out << "   c[1],PSNRF         : " << qual_metric.color_psnr[1] << endl;
+      out << "   c[2],PSNRF         : " << qual_metric.color_psnr[2] << endl;
       if ( cPar.hausdorff )
       {
-        cout << " h.c[0],    F         : " << qual_metric.color_rgb_hausdorff[0] << endl;
-        cout << " h.c[1],    F         : " << qual_metric.color_rgb_hausdorff[1] << endl;
-        cout << " h.c[2],    F         : " << qual_metric.color_rgb_hausdorff[2] << endl;
-        cout << " h.c[0],PSNRF         : " << qual_metric.color_rgb_hausdorff_psnr[0] << endl;
-        cout << " h.c[1],PSNRF         : " << qual_metric.color_rgb_hausdorff_psnr[1] << endl;
-        cout << " h.c[2],PSNRF         : " << qual_metric.color_rgb_hausdorff_psnr[2] << endl;
+        out << " h.c[0],    F         : " << qual_metric.color_rgb_hausdorff[0] << endl;
+        out << " h.c[1],    F         : " << qual_metric.color_rgb_hausdorff[1] << endl;
+        out << " h.c[2],    F         : " << qual_metric.color_rgb_hausdorff[2] << endl;
+        out << " h.c[0],PSNRF         : " << qual_metric.color_rgb_hausdorff_psnr[0] << endl;
+        out << " h.c[1],PSNRF         : " << qual_metric.color_rgb_hausdorff_psnr[1] << endl;
+        out << " h.c[2],PSNRF         : " << qual_metric.color_rgb_hausdorff_psnr[2] << endl;
       }
     }
     if ( cPar.bLidar )
     {
-      cout << "   r,       F         : " << qual_metric.reflectance_mse  << endl;
-      cout << "   r,PSNR   F         : " << qual_metric.reflectance_psnr << endl;
+      out << "   r,       F         : " << qual_metric.reflectance_mse  << endl;
+      out << "   r,PSNR   F         : " << qual_metric.reflectance_psnr << endl;
       if ( cPar.hausdorff )
       {
-        cout << " h.r,       F         : " << qual_metric.reflectance_hausdorff  << endl;
-        cout << " h.r,PSNR   F         : " << qual_metric.reflectance_hausdorff_psnr << endl;
+        out << " h.r,       F         : " << qual_metric.reflectance_hausdorff  << endl;
+        out << " h.r,PSNR   F         : " << qual_metric.reflectance_hausdorff_psnr << endl;
       }
     }
+    if ( cPar.bQuantiles )
+      printQuantiles( out, qual_metric, cPar, "F" );
+    if ( isApproximate( cPar ) )
+      printBias( out, qual_metric, cPar, "F" );
+  }
+
+  if (report)
+  {
+    report->metricF = qual_metric;
+    report->cPar = cPar;
+  }
+}
+
+/**!
+ * function to compute the symmetric quality metric once the geometries are
+ * compared and the search indexes built (see prepareClouds())
+ *   @param pPSNR: peak value, from computePeakValue()
+ *   @param bSameGeometry: from prepareClouds()
+ *   @param report: if not null, gets all the metrics and the phase timings
+ */
+static void
+computeSymmetricMetric(PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, commandPar &cPar, float pPSNR,
+                       bool bSameGeometry, qMetric &qual_metric, qReport *report)
+{
+  ostream &out = output( cPar );
+  double t = GetWallClock();
+  qual_metric.pPSNR = pPSNR;
+  if (report)
+  {
+    report->cPar = cPar;
+    report->pPSNR = pPSNR;
+  }
+
+  if (cPar.file2 != "")
+  {
+    // Check cloud size
+    size_t orgSize = cloudA.size;
+    size_t newSize = cloudB.size;
+    float ratio = float(1.0) * newSize / orgSize;
+    out << "Point cloud sizes for org version, dec version, and the scaling ratio: " << orgSize << ", " << newSize << ", " << ratio << endl;
+    if (bSameGeometry)
+      out << "Same geometry in both point clouds: nearest neighbors taken from the point indexes." << endl;
+  }
+
+  if (cPar.file2 == "" ) // If no file2 provided, return just after checking the NN
+    return;
+
+  if (cPar.hausdorffOnly)
+  {
+    computeHausdorffPasses( cloudA, cloudB, cPar, pPSNR, bSameGeometry, qual_metric, report );
+    return;
+  }
+
+  // Based on normals on original point cloud, derive normals on reconstructed point cloud
+  // Metrics that can not be computed from the input files (reported below)
+  const bool bNoColor = cPar.bColor && (!cloudA.bRgb || !cloudB.bRgb);
+  const bool bNoLidar = cPar.bLidar && (!cloudA.bLidar || !cloudB.bLidar);
+  if (bNoColor)
+    cPar.bColor = false;
+  if (bNoLidar)
+    cPar.bLidar = false;
+
+  // Colors in the MSE color space, shared by both passes
+  mseColors colorsA;
+  mseColors colorsB;
+  if (cPar.bColor)
+  {
+    colorsA.init( cloudA, cPar.mseSpace );
+    colorsB.init( cloudB, cPar.mseSpace );
+  }
+
+  PccPointCloud cloudNormalsB;
+  qMetric metricA;
+  qMetric metricB;
+  metricA.pPSNR = pPSNR;
+  metricB.pPSNR = pPSNR;
+  if (cPar.concurrentPasses && !cPar.singlePass && !bSameGeometry)
+    computeConcurrentPasses( cloudA, cloudNormalsA, cloudB, cloudNormalsB, colorsA, colorsB, cPar, metricA, metricB, report );
+  else
+  {
+    // With the same geometry, the point-to-plane errors are null whatever the normals
+    if (!cPar.c2c_only && !bSameGeometry)
+      scaleNormals( cloudNormalsA, cloudB, cloudNormalsB, cPar.bAverageNormals, useVoxelGrid( cloudNormalsA, cloudB, cPar ) );
+    t = addTiming( report, "normals", t );
+    findMetric( cloudA, cloudB, colorsA, colorsB, cPar, cloudNormalsB, metricA, bSameGeometry );
+    t = addTiming( report, "A2B", t );
+    if (!cPar.singlePass)
+    {
+      findMetric( cloudB, cloudA, colorsB, colorsA, cPar, cloudNormalsA, metricB, bSameGeometry );
+      addTiming( report, "B2A", t );
+    }
   }
+  reportMetrics( metricA, metricB, cPar, bNoColor, bNoLidar, qual_metric, report );
+}
+
+/**!
+ * function to compare the geometries of A and B, and to build the search
+ * indexes needed by computeSymmetricMetric(), once per evaluation
+ *   @return whether A and B have the same geometry (see sameGeometry())
+ */
+static bool
+prepareClouds(PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, const commandPar &cPar, qReport *report)
+{
+  double t = GetWallClock();
+  const bool bSameGeometry = cPar.file2 != "" && sameGeometry( cloudA, cloudB );
+  t = addTiming( report, "sameGeometry", t );
+  if (!cPar.concurrentPasses || cPar.singlePass || bSameGeometry)
+    buildSearchIndexes( cloudA, cloudNormalsA, cloudB, cPar, bSameGeometry );
+  addTiming( report, "kdtree", t );
+  return bSameGeometry;
+}
+
+/**!
+ * function to compute the symmetric quality metric with a known peak value,
+ * e.g. when evaluating several decoded versions of the same original
+ *   @param pPSNR: peak value, from computePeakValue()
+ *   @param report: if not null, gets all the metrics and the phase timings
+ */
+void
+pcc_quality::computeQualityMetric(PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, commandPar &cPar, float pPSNR, qMetric &qual_metric, qReport *report)
+{
+  const bool bSameGeometry = prepareClouds( cloudA, cloudNormalsA, cloudB, cPar, report );
+  computeSymmetricMetric( cloudA, cloudNormalsA, cloudB, cPar, pPSNR, bSameGeometry, qual_metric, report );
+}
+
+/**!
+ * function to compute the symmetric quality metric: Point-to-Point and Point-to-Plane
+ *   @param cloudA: point cloud, original version
+ *   @param cloudNormalA: point cloud normals, original version
+ *   @param cloudB: point cloud, decoded/reconstructed version
+ *   @param cPar: input parameters
+ *   @param qual_metric: quality metric, to be returned
+ *
+ * \author
+ *   Dong Tian, MERL
+ */
+void
+pcc_quality::computeQualityMetric(PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, commandPar &cPar, qMetric &qual_metric, qReport *report)
+{
+  const bool bSameGeometry = prepareClouds( cloudA, cloudNormalsA, cloudB, cPar, report );
+  double t = GetWallClock();
+  const float pPSNR = computePeakValue( cloudA, cPar );
+  addTiming( report, "peak", t );
+  computeSymmetricMetric( cloudA, cloudNormalsA, cloudB, cPar, pPSNR, bSameGeometry, qual_metric, report );
+}
+
+/**!
+ * function to compute the symmetric quality metric of point clouds loaded
+ * by the caller, without any output
+ *   @param cloudA: point cloud, original version, with its normals if any
+ *   @param cloudB: point cloud, decoded/reconstructed version
+ *   @param cPar: input parameters, file1 and file2 only naming the clouds
+ *   @param report: if not null, gets all the metrics and the phase timings
+ */
+int
+pcc_quality::computeQualityMetric(PccPointCloud &cloudA, PccPointCloud &cloudB, const commandPar &cPar, qMetric &qual_metric, qReport *report)
+{
+  if (cloudA.size == 0 || cloudB.size == 0)
+    return -1;
+
+  commandPar par = cPar;
+  par.bQuiet = true;
+  par.c2c_only = !cloudA.bNormal || par.hausdorffOnly;
+  // An empty file2 means that there is no cloud B
+  if (par.file1 == "")
+    par.file1 = "A";
+  if (par.file2 == "")
+    par.file2 = "B";
+  computeQualityMetric( cloudA, cloudA, cloudB, par, qual_metric, report );
+  return 0;
+}
+
+/**!
+ * \brief
+ *  Tile of computeTiledQualityMetric(): the points of the buckets
+ *  [first, last), i.e. of the bins [firstBin, endBin), evaluated with the
+ *  points of the buckets [regionFirst, regionLast) around them
+ */
+struct tileRange
+{
+  size_t first, last;
+  size_t firstBin, endBin;
+  size_t regionFirst, regionLast;
+  long   nbPoints;              //! points of the region, in all the files
+};
+
+/**!
+ * function to find the points of a tile, [first, last), in the point cloud
+ * of its region: the points of the bins [firstBin, endBin). They are
+ * consecutive, as load() sorts the points by x first.
+ */
+static void
+tileCore(const PccPointCloud &cloud, float xMin, float xMax, const tileRange &tile, long &first, long &last)
+{
+  // first point of a bin not below b, whatever the column of the coordinates
+  auto firstOf = [&]( size_t b ) {
+    long lo = 0, hi = cloud.size;
+    while (lo < hi)
+    {
+      const long mid = lo + (hi - lo) / 2;
+      if (PccTiledFile::binOf( cloud.xyz.point( mid )[0], xMin, xMax, TILE_BINS ) < b)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo;
+  };
+  first = firstOf( tile.firstBin );
+  last = firstOf( tile.endBin );
+}
+
+/**!
+ * function to compute the symmetric quality metric of files that may not
+ * fit in memory, by tiles along x. See pcc_distortion.hpp.
+ */
+int
+pcc_quality::computeTiledQualityMetric(commandPar &cPar, qMetric &qual_metric, qReport *report)
+{
+  ostream &out = output( cPar );
+  double t = GetWallClock();
+  const bool bNormalsA = cPar.normIn == "" || cPar.normIn == cPar.file1;
+  PccTiledFile fileA;
+  PccTiledFile fileB;
+  PccTiledFile fileN;
+  if (fileA.open( cPar.file1 ) || fileB.open( cPar.file2 ) || (!bNormalsA && fileN.open( cPar.normIn )))
+    return -1;
+
+  // If no normals are available, can't do plane2plane
+  cPar.c2c_only = !(bNormalsA ? fileA : fileN).hasNormals();
+  const bool bFileN = !bNormalsA && !cPar.c2c_only;
+  vector<PccTiledFile*> files = { &fileA, &fileB };
+  if (bFileN)
+    files.push_back( &fileN );
+
+  // Histogram of the points of all the files along x
+  float xMin = numeric_limits<float>::max();
+  float xMax = numeric_limits<float>::lowest();
+  for (PccTiledFile *file : files)
+    if (file->rangeX( xMin, xMax ))
+      return -1;
+  if (xMin > xMax)
+    xMin = xMax = 0;
+  vector<long int> counts( TILE_BINS, 0 );
+  for (PccTiledFile *file : files)
+    if (file->histogramX( xMin, xMax, counts ))
+      return -1;
+
+  // Buckets of consecutive bins, written to a temporary file per point cloud
+  long total = 0;
+  for (long c : counts)
+    total += c;
+  const long budgetPoints = max<long>( 1, long( double( cPar.memoryBudget ) * (1 << 20) / TILE_POINT_BYTES ) );
+  const long bucketTarget = max<long>( budgetPoints / 8, (total + TILE_MAX_BUCKETS - 1) / TILE_MAX_BUCKETS );
+  vector<uint32_t> binBucket( TILE_BINS );
+  vector<size_t> bucketBins( 1, 0 );    // first bin of every bucket, then TILE_BINS
+  vector<long> bucketPoints( 1, 0 );
+  for (size_t bin = 0; bin < TILE_BINS; bin++)
+  {
+    if (bucketPoints.back() >= bucketTarget)
+    {
+      bucketBins.push_back( bin );
+      bucketPoints.push_back( 0 );
+    }
+    binBucket[bin] = uint32_t( bucketBins.size() - 1 );
+    bucketPoints.back() += counts[bin];
+  }
+  bucketBins.push_back( TILE_BINS );
+  const size_t nbBuckets = bucketPoints.size();
+  for (PccTiledFile *file : files)
+    if (file->partition( xMin, xMax, binBucket, cPar.tileDir ))
+      return -1;
+
+  // The region of a tile extends by the halo on both sides, by three times
+  // the halo with normals: the normals of B come from points of A (within
+  // the halo of B), whose nearest neighbors in B are within the halo too
+  const double binWidth = (double( xMax ) - xMin) / TILE_BINS;
+  const double margin = cPar.c2c_only ? cPar.tileHalo : 3.0 * cPar.tileHalo;
+  const size_t marginBins = binWidth > 0 ? size_t( min<double>( TILE_BINS, ceil( margin / binWidth ) + 2 ) ) : TILE_BINS;
+  auto setRegion = [&]( tileRange &tile )
+  {
+    tile.firstBin = bucketBins[tile.first];
+    tile.endBin = bucketBins[tile.last];
+    tile.regionFirst = binBucket[tile.firstBin - min( tile.firstBin, marginBins )];
+    tile.regionLast = binBucket[min<size_t>( TILE_BINS, tile.endBin + marginBins ) - 1] + 1;
+    tile.nbPoints = 0;
+    for (size_t b = tile.regionFirst; b < tile.regionLast; b++)
+      tile.nbPoints += bucketPoints[b];
+  };
+
+  // Tiles as large as the memory budget allows. A tile larger than the
+  // budget (halo too large) still grows as long as its region does not
+  vector<tileRange> tiles;
+  long maxTilePoints = 0;
+  for (size_t b = 0; b < nbBuckets; )
+  {
+    tileRange tile;
+    tile.first = b;
+    tile.last = b + 1;
+    setRegion( tile );
+    while (tile.last < nbBuckets)
+    {
+      tileRange next = tile;
+      next.last++;
+      setRegion( next );
+      if (next.nbPoints > max( budgetPoints, tile.nbPoints ))
+        break;
+      tile = next;
+    }
+    tiles.push_back( tile );
+    maxTilePoints = max( maxTilePoints, tile.nbPoints );
+    b = tile.last;
+  }
+  out << "Evaluation by tiles: " << tiles.size() << " tiles along x, " << nbBuckets << " buckets, halo " << cPar.tileHalo
+       << ", at most " << maxTilePoints << " points per tile (budget " << budgetPoints << ")" << endl;
+  if (maxTilePoints > budgetPoints)
+    out << "WARNING: the memory budget is too small for the halo, the largest tile exceeds it." << endl;
+  t = addTiming( report, "tiling", t );
+
+  const int attributes = (cPar.bColor ? PccPointCloud::COLORS : 0) | (cPar.bLidar ? PccPointCloud::REFLECTANCES : 0);
+  bool bNoColor = false;
+  bool bNoLidar = false;
+  bool bSameGeometry = true;
+  long sizeA = 0;
+  long sizeB = 0;
+  long unmatched = 0;
+  double minDist = numeric_limits<double>::max();
+  double maxDist = numeric_limits<double>::min();
+
+  // B->A is computed for the check of the halo only with singlePass, as the
+  // normals of B may come from it
+  commandPar checkPar = cPar;
+  checkPar.c2c_only = true;
+  checkPar.bColor = checkPar.bLidar = checkPar.bQuantiles = false;
+  const bool bPassB = !cPar.singlePass || !cPar.c2c_only;
+
+  // The accumulators are indexed by the points of the whole clouds, at most
+  // the number of records of the files
+  long recordsA = 0;
+  long recordsB = 0;
+  for (size_t b = 0; b < nbBuckets; b++)
+  {
+    recordsA += fileA.bucketSize( b );
+    recordsB += fileB.bucketSize( b );
+  }
+  vector<metricAccumulator> blockAccA( (recordsA + METRIC_BLOCK_SIZE - 1) / METRIC_BLOCK_SIZE );
+  vector<metricAccumulator> blockAccB( bPassB ? (recordsB + METRIC_BLOCK_SIZE - 1) / METRIC_BLOCK_SIZE : 0 );
+  vector<metricSketches> sketchesA = threadSketches( cPar );
+  vector<metricSketches> sketchesB = threadSketches( cPar.singlePass ? checkPar : cPar );
+
+  for (size_t k = 0; k < tiles.size(); k++)
+  {
+    const tileRange &tile = tiles[k];
+    PccPointCloud cloudA;
+    PccPointCloud cloudB;
+    PccPointCloud cloudN;
+    if (fileA.loadBuckets( tile.regionFirst, tile.regionLast, cloudA, false, cPar.dropDuplicates, cPar.neighborsProc,
+                           attributes | (bNormalsA ? PccPointCloud::NORMALS : 0) ) ||
+        fileB.loadBuckets( tile.regionFirst, tile.regionLast, cloudB, false, cPar.dropDuplicates, cPar.neighborsProc, attributes ) ||
+        (bFileN && fileN.loadBuckets( tile.regionFirst, tile.regionLast, cloudN, true, cPar.dropDuplicates, 0, PccPointCloud::ALL )))
+      return -1;
+    PccPointCloud &cloudNormalsA = bFileN ? cloudN : cloudA;
+
+    // Metrics that can not be computed from the input files (reported below)
+    if (k == 0)
+    {
+      bNoColor = cPar.bColor && (!cloudA.bRgb || !cloudB.bRgb);
+      bNoLidar = cPar.bLidar && (!cloudA.bLidar || !cloudB.bLidar);
+      if (bNoColor)
+        cPar.bColor = false;
+      if (bNoLidar)
+        cPar.bLidar = false;
+    }
+
+    long firstA, lastA, firstB, lastB;
+    tileCore( cloudA, xMin, xMax, tile, firstA, lastA );
+    tileCore( cloudB, xMin, xMax, tile, firstB, lastB );
+    out << "Tile " << k << ": " << lastA - firstA << " + " << lastB - firstB << " points, "
+         << cloudA.size << " + " << cloudB.size << " with the halo" << endl;
+
+    mseColors colorsA;
+    mseColors colorsB;
+    if (cPar.bColor)
+    {
+      colorsA.init( cloudA, cPar.mseSpace );
+      colorsB.init( cloudB, cPar.mseSpace );
+    }
+
+    // The regions hold the same points when the whole clouds do
+    const bool bSame = sameGeometry( cloudA, cloudB );
+    bSameGeometry = bSameGeometry && (bSame || (lastA == firstA && lastB == firstB));
+    PccPointCloud cloudNormalsB;
+    if (!cPar.c2c_only && !bSame && cloudNormalsA.size > 0 && cloudB.size > 0)
+      scaleNormals( cloudNormalsA, cloudB, cloudNormalsB, cPar.bAverageNormals, useVoxelGrid( cloudNormalsA, cloudB, cPar ) );
+
+    if (cloudB.size > 0)
+      accumulateMetric( cloudA, firstA, lastA, sizeA, cloudB, colorsA, colorsB, cPar, cloudNormalsB, bSame, blockAccA, sketchesA );
+    else
+      unmatched += lastA - firstA;
+    if (bPassB && cloudA.size > 0)
+      accumulateMetric( cloudB, firstB, lastB, sizeB, cloudA, colorsB, colorsA, cPar.singlePass ? checkPar : cPar,
+                        cloudNormalsA, bSame, blockAccB, sketchesB );
+    else if (bPassB)
+      unmatched += lastB - firstB;
+
+    if (cPar.resolution == 0.0 && lastA > firstA)
+    {
+      double tileMin, tileMax;
+      findNNdistances( cloudA, firstA, lastA, tileMin, tileMax );
+      minDist = min( minDist, tileMin );
+      maxDist = max( maxDist, tileMax );
+    }
+    sizeA += lastA - firstA;
+    sizeB += lastB - firstB;
+  }
+  t = addTiming( report, "tiles", t );
+
+  // Merged in the same order as in memory
+  blockAccA.resize( (sizeA + METRIC_BLOCK_SIZE - 1) / METRIC_BLOCK_SIZE );
+  blockAccB.resize( bPassB ? (sizeB + METRIC_BLOCK_SIZE - 1) / METRIC_BLOCK_SIZE : 0 );
+  const metricAccumulator totalA = mergeBlocks( blockAccA );
+  const metricAccumulator totalB = mergeBlocks( blockAccB );
+
+  float pPSNR;
+  if (cPar.resolution != 0.0)
+  {
+    out << "Imported intrinsic resoluiton: " << cPar.resolution << endl;
+    pPSNR = cPar.resolution;
+  }
+  else
+  {
+    pPSNR = float( maxDist );
+    out << "Minimum and maximum NN distances (intrinsic resolutions): " << minDist << ", " << maxDist << endl;
+  }
+  out << "Peak distance for PSNR: " << pPSNR << endl;
+  qual_metric.pPSNR = pPSNR;
+  if (report)
+  {
+    report->cPar = cPar;
+    report->pPSNR = pPSNR;
+  }
+
+  float ratio = float(1.0) * sizeB / sizeA;
+  out << "Point cloud sizes for org version, dec version, and the scaling ratio: " << sizeA << ", " << sizeB << ", " << ratio << endl;
+  if (bSameGeometry && sizeA > 0)
+    out << "Same geometry in both point clouds: nearest neighbors taken from the point indexes." << endl;
+
+  // The metrics are the ones of the evaluation in memory if all the nearest
+  // neighbors are within the halo. Otherwise, the distances found within the
+  // regions are upper bounds of the actual ones.
+  const double maxSqrDist = max( totalA.max_dist_b_c2c, bPassB ? totalB.max_dist_b_c2c : 0.0 );
+  double maxNN = maxSqrDist > numeric_limits<double>::min() ? sqrt( maxSqrDist ) : 0.0;
+  if (cPar.resolution == 0.0 && sizeA > 0)
+    maxNN = max( maxNN, maxDist );
+  if (unmatched > 0)
+    out << "WARNING: " << unmatched << " points have no neighbor within the halo of their tile, "
+         << "the metrics differ from the evaluation in memory. Increase tileHalo." << endl;
+  else if (maxNN > cPar.tileHalo)
+    out << "WARNING: the largest nearest neighbor distance, " << maxNN << ", exceeds the halo of the tiles: "
+         << "the metrics may differ from the evaluation in memory. Evaluate again with --tileHalo=" << maxNN << endl;
+  else
+    out << "Largest nearest neighbor distance: " << maxNN << ", within the halo of the tiles." << endl;
+
+  qMetric metricA;
+  qMetric metricB;
+  metricA.pPSNR = pPSNR;
+  metricB.pPSNR = pPSNR;
+  setMetric( totalA, mergeSketches( sketchesA ), cPar, metricA );
+  if (!cPar.singlePass)
+    setMetric( totalB, mergeSketches( sketchesB ), cPar, metricB );
+  reportMetrics( metricA, metricB, cPar, bNoColor, bNoLidar, qual_metric, report );
+  return 0;
 }
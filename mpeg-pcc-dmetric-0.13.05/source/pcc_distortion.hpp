@@ -53,6 +53,7 @@ using namespace nanoflann;
 #include "nanoflann/KDTreeVectorOfVectorsAdaptor.h"
 
 #include "pcc_processing.hpp"
+#include "pcc_quantile.hpp"
 
 using namespace std;
 using namespace pcc_processing;
@@ -61,6 +62,8 @@ using namespace pcc_processing;
 
 namespace pcc_quality {
 
+  class qReport;
+
   /**!
    * \brief
    *  Command line parameters
@@ -72,12 +75,15 @@ namespace pcc_quality {
   public:
     string file1;
     string file2;
+    vector<string> fileBList; //! processed versions of file 1, evaluated against the same reference
 
     string normIn;            //! input file name for normals, if it is different from the input file 1
 
     bool   singlePass;        //! Force to run a single pass algorithm. where the loop is over the original point cloud
 
     bool   hausdorff;         //! true: output hausdorff metric as well
+    bool   hausdorffOnly;     //! true: only compute the point-to-point hausdorff metric, with early break
+    bool   bQuantiles;        //! true: output the quantiles of the point errors as well
 
     bool   c2c_only;          //! skip point-to-plane metric
     bool   bColor;            //! check color distortion as well
@@ -90,6 +96,23 @@ namespace pcc_quality {
     bool   bAverageNormals;   //! 0(undefined), 1(average normal based on neighbors with same geometric distance)
 
     int    nbThreads;         //! Number of threads used for parallel processing.
+    bool   concurrentPasses;  //! run the A->B and B->A passes concurrently
+    bool   bVoxelGrid;        //! search the nearest neighbors in voxel grids when the coordinates are integers
+    float  approxEps;         //! approximate kd-tree search: nanoflann eps (distance within 1 + eps of the nearest), 0 for exact
+    int    approxLeaves;      //! approximate kd-tree search: maximum number of leaves checked per query, 0 for no limit
+    int    approxSamples;     //! number of points searched exactly to estimate the bias of the approximate search
+
+    int    memoryBudget;      //! MB for the point clouds evaluated by tiles, 0 to load them in memory
+    float  tileHalo;          //! largest nearest neighbor distance expected, for the evaluation by tiles
+    string tileDir;           //! directory of the temporary files of the evaluation by tiles
+
+    int    firstFrame;        //! first frame number of the sequence
+    int    frameCount;        //! number of frames, file names being patterns of the frame number, 0 for single files
+
+    string cacheDir;          //! directory of the sidecar files of the reference, empty for none
+    string resultFile;        //! file name to write the metrics and timings to
+    string resultFormat;      //! json or csv
+    bool   bQuiet;            //! nothing printed on the standard output (library use)
     commandPar();
   };
 
@@ -126,6 +149,20 @@ namespace pcc_quality {
     float reflectance_hausdorff;
     float reflectance_hausdorff_psnr;
 
+    // quantiles of the point errors (quantileLevels), same units as the mse
+    float c2c_quantile[PCC_QUANTILE_NUM];
+    float c2p_quantile[PCC_QUANTILE_NUM];
+    float color_quantile[3][PCC_QUANTILE_NUM];
+    float reflectance_quantile[PCC_QUANTILE_NUM];
+
+    // approximate search (commandPar::approxEps, approxLeaves): bias of the
+    // mse estimated on a sample, half width of its 95% confidence interval,
+    // and the matching bias of the psnr
+    float c2c_mse_bias, c2c_mse_bias_ci, c2c_psnr_bias;
+    float c2p_mse_bias, c2p_mse_bias_ci, c2p_psnr_bias;
+    float color_mse_bias[3], color_mse_bias_ci[3], color_psnr_bias[3];
+    float reflectance_mse_bias, reflectance_mse_bias_ci, reflectance_psnr_bias;
+
     qMetric();
   };
 
@@ -136,7 +173,37 @@ namespace pcc_quality {
    *
    *  Dong Tian <tian@merl.com>
    */
-  void computeQualityMetric( PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, commandPar &cPar, qMetric &qual_metric );
+  void computeQualityMetric( PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, commandPar &cPar, qMetric &qual_metric, qReport *report = nullptr );
+
+  /**!
+   * \brief
+   *
+   *  Reference side steps of computeQualityMetric, to be run once when
+   *  several decoded versions of the same original are evaluated
+   */
+  float computePeakValue( PccPointCloud &cloudA, const commandPar &cPar );
+  void computeQualityMetric( PccPointCloud &cloudA, PccPointCloud &cloudNormalsA, PccPointCloud &cloudB, commandPar &cPar, float pPSNR, qMetric &qual_metric, qReport *report = nullptr );
+
+  /**!
+   * \brief
+   *  Library entry point: computeQualityMetric of point clouds loaded by the
+   *  caller, e.g. from memory (PccPointCloud::loadMemory, loadVectors), the
+   *  normals of A taken from A, without any output. Returns 0 if succeed,
+   *  non-zero if a point cloud is empty
+   */
+  int computeQualityMetric( PccPointCloud &cloudA, PccPointCloud &cloudB, const commandPar &cPar, qMetric &qual_metric, qReport *report = nullptr );
+
+  /**!
+   * \brief
+   *
+   *  computeQualityMetric of the files of cPar (binary ply only), loaded by
+   *  tiles along x within cPar.memoryBudget. Each tile is evaluated with the
+   *  points within cPar.tileHalo around it (three times the halo with
+   *  normals): the metrics are the ones computed in memory if the nearest
+   *  neighbor distances do not exceed the halo, which is checked and
+   *  reported. Returns 0 if succeed, non-zero otherwise
+   */
+  int computeTiledQualityMetric( commandPar &cPar, qMetric &qual_metric, qReport *report = nullptr );
 
 };
 
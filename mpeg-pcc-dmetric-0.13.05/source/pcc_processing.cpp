@@ -43,33 +43,55 @@
 #include <sstream>
 #include <memory.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include <algorithm>
+#include <cmath>
 #include <functional>
+#include <limits>
 #include <cctype>
 #include <locale>
 #include <map>
+#include <type_traits>
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
 
 #include "pcc_processing.hpp"
+#include "pcc_voxelgrid.hpp"
+#include "clockcom.hpp"
 
 #if _WIN32
 #define stat64 _stat64
 #endif
 
+// Parallel ascii parsing needs std::from_chars for floating point values
+#if defined(__cpp_lib_to_chars)
+#define PCC_FAST_ASCII 1
+#else
+#define PCC_FAST_ASCII 0
+#endif
+
 using namespace std;
 using namespace pcc_processing;
 
 // trim from start
 static inline std::string &ltrim(std::string &s) {
   s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-                                  std::not1(std::ptr_fun<int, int>(std::isspace))));
+                                  [](unsigned char c) { return !std::isspace(c); }));
   return s;
 }
 
 // trim from end
 static inline std::string &rtrim(std::string &s) {
   s.erase(std::find_if(s.rbegin(), s.rend(),
-                       std::not1(std::ptr_fun<int, int>(std::isspace))).base(), s.end());
+                       [](unsigned char c) { return !std::isspace(c); }).base(), s.end());
   return s;
 }
 
@@ -78,6 +100,190 @@ static inline std::string &trim(std::string &s) {
   return ltrim(rtrim(s));
 }
 
+/**!
+ * **************************************
+ *  Class MappedFile
+ * **************************************
+ */
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+  if (data)
+    munmap( (void*) data, size );
+#endif
+}
+
+int
+MappedFile::open( const string &fileName )
+{
+#ifndef _WIN32
+  int fd = ::open( fileName.c_str(), O_RDONLY );
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat( fd, &st ) != 0 || st.st_size == 0)
+  {
+    ::close( fd );
+    return -1;
+  }
+  size = st.st_size;
+  void *mem = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  ::close( fd );
+  if (mem == MAP_FAILED)
+    return -1;
+  madvise( mem, size, MADV_WILLNEED );
+  data = (const unsigned char*) mem;
+#else
+  ifstream in( fileName, ifstream::in | ifstream::binary | ifstream::ate );
+  if (!in)
+    return -1;
+  buffer.resize( in.tellg() );
+  in.seekg( 0 );
+  if (buffer.empty() || !in.read( (char*) buffer.data(), buffer.size() ))
+    return -1;
+  data = buffer.data();
+  size = buffer.size();
+#endif
+  return 0;
+}
+
+/*
+ * \brief
+ *   Ask the system to start reading a file in the background, so that a
+ *   later load() of the file does not wait for the disk
+ */
+void
+pcc_processing::prefetchFile( const string &inFile )
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+  int fd = ::open( inFile.c_str(), O_RDONLY );
+  if (fd < 0)
+    return;
+  posix_fadvise( fd, 0, 0, POSIX_FADV_WILLNEED );
+  ::close( fd );
+#endif
+}
+
+/**!
+ * \brief
+ *  Convert one field of the records of points [first, last) of a binary
+ *  vertex block, starting at the record of point "first". "store(i, value)"
+ *  writes the value of point i
+ */
+template <typename T, typename Store>
+static inline void
+loadColumn( const unsigned char *src, int recordSize, long int first, long int last, Store store )
+{
+  for (long int i = first; i < last; i++, src += recordSize)
+  {
+    T value;
+    memcpy( &value, src, sizeof(T) );
+    store( i, double(value) );
+  }
+}
+
+template <typename Store>
+static void
+loadColumn( const PccPointCloud *pPcc, int field, const unsigned char *data, long int first, long int last, Store store )
+{
+  const unsigned char *src = data + pPcc->fieldPos[field];
+  switch (pPcc->fieldType[field])
+  {
+  case PccPointCloud::PointFieldTypes::UINT8:
+    loadColumn<uint8_t>( src, pPcc->fieldSize, first, last, store );
+    break;
+  case PccPointCloud::PointFieldTypes::INT8:
+    loadColumn<int8_t>( src, pPcc->fieldSize, first, last, store );
+    break;
+  case PccPointCloud::PointFieldTypes::UINT16:
+    loadColumn<uint16_t>( src, pPcc->fieldSize, first, last, store );
+    break;
+  case PccPointCloud::PointFieldTypes::INT16:
+    loadColumn<int16_t>( src, pPcc->fieldSize, first, last, store );
+    break;
+  case PccPointCloud::PointFieldTypes::UINT32:
+    loadColumn<uint32_t>( src, pPcc->fieldSize, first, last, store );
+    break;
+  case PccPointCloud::PointFieldTypes::INT32:
+    loadColumn<int32_t>( src, pPcc->fieldSize, first, last, store );
+    break;
+  case PccPointCloud::PointFieldTypes::FLOAT32:
+    loadColumn<float>( src, pPcc->fieldSize, first, last, store );
+    break;
+  case PccPointCloud::PointFieldTypes::FLOAT64:
+    loadColumn<double>( src, pPcc->fieldSize, first, last, store );
+    break;
+  }
+}
+
+#if PCC_FAST_ASCII
+/**!
+ * \brief
+ *  Parse the ascii value [first, last) into "out", as the stream operator >>
+ *  would do for type T. Return false for anything that the two parsers may
+ *  read differently: the caller then falls back to the stream parser.
+ */
+template <typename T>
+static inline bool
+parseAscii( const char *first, const char *last, T &out )
+{
+  if ( first < last && *first == '+' )   // accepted by streams, not by from_chars
+  {
+    first++;
+    if ( first < last && (*first == '-' || *first == '+') )
+      return false;
+  }
+  if ( first == last )
+    return false;
+  if ( std::is_unsigned<T>::value && *first == '-' )   // wraps around with streams
+    return false;
+  const char c = (*first == '-' && first + 1 < last) ? first[1] : *first;
+  if ( !std::isdigit( (unsigned char) c ) && c != '.' ) // no inf, nan, hex, ...
+    return false;
+  auto res = std::from_chars( first, last, out );
+  return res.ec == std::errc() && res.ptr == last;
+}
+
+// Parse as S, like loadLine(), and store as T in the binary record
+template <typename S, typename T = S>
+static inline bool
+parseAsciiField( const char *first, const char *last, unsigned char *dst )
+{
+  S value;
+  if ( !parseAscii( first, last, value ) )
+    return false;
+  const T stored = (T) value;
+  memcpy( dst, &stored, sizeof(T) );
+  return true;
+}
+
+static inline bool
+isBlank( char c )
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Number of non blank lines in [first, last)
+static long int
+countRecords( const char *first, const char *last )
+{
+  long int count = 0;
+  bool bRecord = false;
+  for (const char *p = first; p < last; p++)
+  {
+    if ( *p == '\n' )
+    {
+      count += bRecord;
+      bRecord = false;
+    }
+    else if ( !isBlank( *p ) )
+      bRecord = true;
+  }
+  return count + bRecord;
+}
+#endif
+
 /**!
  * **************************************
  *  Class PointXYZSet
@@ -100,9 +306,97 @@ PointXYZSet::init( long int size, int i0, int i1, int i2 )
   if (i2 >= 0)
     idxInLine[2] = i2;
 
+  storage = FLOAT32;
   p.resize( size );
-  nbdup.resize( size );
-  std::fill(nbdup.begin(), nbdup.end(), 1);
+  vector<point16_type>().swap( p16 );
+  vector<point32_type>().swap( p32 );
+  nbdup.clear();
+}
+
+/**!
+ * \brief
+ *  compact
+ *
+ *  Move the coordinates from p to p16, if they are all within the range of
+ *  int16, or to p32, if they are all within the range of int32, and free
+ *  p. The coordinates must be integers, in [minCoord, maxCoord].
+ */
+void
+PointXYZSet::compact( float minCoord, float maxCoord )
+{
+  if (storage != FLOAT32)
+    return;
+  const long int n = p.size();
+  if (minCoord >= numeric_limits<int16_t>::min() && maxCoord <= numeric_limits<int16_t>::max())
+  {
+    p16.resize( n );
+#pragma omp parallel for
+    for (long int i = 0; i < n; i++)
+      for (int k = 0; k < 3; k++)
+        p16[i][k] = int16_t( p[i][k] );
+    storage = INT16;
+  }
+  else if (minCoord >= -2147483648.f && maxCoord < 2147483648.f)
+  {
+    p32.resize( n );
+#pragma omp parallel for
+    for (long int i = 0; i < n; i++)
+      for (int k = 0; k < 3; k++)
+        p32[i][k] = int32_t( p[i][k] );
+    storage = INT32;
+  }
+  else
+    return;
+  vector<point_type>().swap( p );
+}
+
+/**!
+ * \brief
+ *  expand
+ *
+ *  Move the coordinates back to p, as floats
+ */
+void
+PointXYZSet::expand()
+{
+  if (storage == FLOAT32)
+    return;
+  const long int n = storage == INT16 ? p16.size() : p32.size();
+  p.resize( n );
+#pragma omp parallel for
+  for (long int i = 0; i < n; i++)
+    p[i] = point( i );
+  storage = FLOAT32;
+  vector<point16_type>().swap( p16 );
+  vector<point32_type>().swap( p32 );
+}
+
+const void *
+PointXYZSet::data( size_t i ) const
+{
+  switch (storage)
+  {
+  case INT16:
+    return p16.data() + i;
+  case INT32:
+    return p32.data() + i;
+  default:
+    return p.data() + i;
+  }
+}
+
+size_t
+PointXYZSet::pointBytes() const
+{
+  switch (storage)
+  {
+  case INT16:
+    return sizeof(point16_type);
+  case INT32:
+    return sizeof(point32_type);
+  default:
+    return sizeof(point_type);
+  }
 }
 
 /**!
@@ -146,6 +440,19 @@ PointXYZSet::loadPoints( PccPointCloud *pPcc, long int idx )
   return 0;
 }
 
+/**!
+ * \brief
+ *  loadBlock: convert the points [first, last) of a binary vertex block,
+ *  "data" pointing to the record of point "first"
+ */
+void
+PointXYZSet::loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last )
+{
+  for (int i = 0; i < 3; i++)
+    loadColumn( pPcc, idxInLine[i], data, first, last,
+                [this, i](long int idx, double v) { p[idx][i] = float(v); } );
+}
+
 /**!
  * **************************************
  *  Class RGBSet
@@ -193,6 +500,14 @@ RGBSet::loadPoints( PccPointCloud *pPcc, long int idx )
   return 0;
 }
 
+void
+RGBSet::loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last )
+{
+  for (int i = 0; i < 3; i++)
+    loadColumn( pPcc, idxInLine[i], data, first, last,
+                [this, i](long int idx, double v) { c[idx][i] = (unsigned char) v; } );
+}
+
 /**!
  * **************************************
  *  Class NormalSet
@@ -249,6 +564,14 @@ NormalSet::loadPoints( PccPointCloud *pPcc, long int idx )
   return 0;
 }
 
+void
+NormalSet::loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last )
+{
+  for (int i = 0; i < 3; i++)
+    loadColumn( pPcc, idxInLine[i], data, first, last,
+                [this, i](long int idx, double v) { n[idx][i] = float(v); } );
+}
+
 /**!
  * **************************************
  *  Class LidarSet
@@ -289,6 +612,13 @@ LidarSet::loadPoints( PccPointCloud *pPcc, long int idx )
   return 0;
 }
 
+void
+LidarSet::loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last )
+{
+  loadColumn( pPcc, idxInLine[0], data, first, last,
+              [this](long int idx, double v) { reflectance[idx] = (unsigned short) v; } );
+}
+
 /**!
  * **************************************
  *  Class PccPointCloud
@@ -306,26 +636,179 @@ PccPointCloud::PccPointCloud()
   dataPos = 0;
   lineNum = 0;
 
-  bXyz = bRgb = bNormal = bLidar = false;
+  bXyz = bRgb = bNormal = bLidar = bVoxelized = false;
+  bVerbose = true;
+  bCompactXyz = true;
+  log = &cout;
+  timeLoad = timeDedup = 0.0;
+  minNNDist = maxNNDist = -1.0;
 }
 
 PccPointCloud::~PccPointCloud()
 {
 }
 
+/**!
+ * \brief
+ *  buildKdtree
+ *
+ *  Build the kd-tree over the column of the point coordinates. It is built
+ *  on the first call only, and then shared by all the computations on this
+ *  point cloud. Concurrent callers wait for the single build.
+ */
+void
+PccPointCloud::buildKdtree()
+{
+  std::call_once( kdtreeOnce, [this]() {
+      // dim, cloud, max leaf
+      switch (xyz.storage)
+      {
+      case PointXYZSet::INT16:
+        kdtreeIndex16.reset( new my_kd_tree16_t(3, xyz.p16, 10) );
+        break;
+      case PointXYZSet::INT32:
+        kdtreeIndex32.reset( new my_kd_tree32_t(3, xyz.p32, 10) );
+        break;
+      default:
+        kdtreeIndex.reset( new my_kd_tree_t(3, xyz.p, 10) );
+      }
+    } );
+}
+
+bool
+PccPointCloud::hasKdtree() const
+{
+  return kdtreeIndex != nullptr || kdtreeIndex16 != nullptr || kdtreeIndex32 != nullptr;
+}
+
+/**!
+ * \brief
+ *  saveKdtree
+ *
+ *  Write the kd-tree, without the points, so that loadKdtree() can restore
+ *  it for the same points rather than building it again
+ */
+int
+PccPointCloud::saveKdtree( FILE *stream ) const
+{
+  if (kdtreeIndex16)
+    kdtreeIndex16->saveIndex( stream );
+  else if (kdtreeIndex32)
+    kdtreeIndex32->saveIndex( stream );
+  else if (kdtreeIndex)
+    kdtreeIndex->saveIndex( stream );
+  else
+    return -1;
+  return ferror( stream ) ? -1 : 0;
+}
+
+/**!
+ * \brief
+ *  loadKdtree
+ *
+ *  Read the kd-tree written by saveKdtree() for the same column of points,
+ *  instead of building it. If the stream is truncated, buildKdtree() builds
+ *  the tree on first use
+ */
+int
+PccPointCloud::loadKdtree( FILE *stream )
+{
+  try
+  {
+    std::call_once( kdtreeOnce, [this, stream]() {
+        switch (xyz.storage)
+        {
+        case PointXYZSet::INT16:
+          kdtreeIndex16.reset( new my_kd_tree16_t(3, xyz.p16, stream, 10) );
+          break;
+        case PointXYZSet::INT32:
+          kdtreeIndex32.reset( new my_kd_tree32_t(3, xyz.p32, stream, 10) );
+          break;
+        default:
+          kdtreeIndex.reset( new my_kd_tree_t(3, xyz.p, stream, 10) );
+        }
+      } );
+  }
+  catch (const std::exception &)
+  {
+    return -1;
+  }
+  return hasKdtree() ? 0 : -1;
+}
+
+/**!
+ * \brief
+ *  voxelGrid
+ *
+ *  Return the voxel grid over the point coordinates, for a voxelized point
+ *  cloud. Built and shared as the kd-tree.
+ */
+const PointVoxelGrid&
+PccPointCloud::voxelGrid()
+{
+  std::call_once( voxelGridOnce, [this]() {
+      voxelGridIndex.reset( new PointVoxelGrid( xyz, size ) );
+    } );
+  return *voxelGridIndex;
+}
+
+/**!
+ * \brief
+ *  queryTies
+ *
+ *  Search the nearest point and the points at the same distance, in the
+ *  voxel grid if bGrid (the query must then have integer coordinates), or
+ *  in the kd-tree. A query too far from the points for the grid falls back
+ *  to the kd-tree. The results are the same. The kd-tree search is
+ *  approximate if params has a positive eps or max_leaves.
+ */
+size_t
+PccPointCloud::queryTies( const float *query, size_t capacity, distance_type eps,
+                          index_type *indices, distance_type *sqrDist, bool bGrid,
+                          const nanoflann::SearchParams &params )
+{
+  if (bGrid)
+  {
+    const size_t nb = voxelGrid().queryTies( query, capacity, eps, indices, sqrDist );
+    if (nb > 0)
+      return nb;
+  }
+  nanoflann::NearestTiesResultSet<distance_type, index_type> resultSet( capacity, eps );
+  resultSet.init( indices, sqrDist );
+  findNeighbors( resultSet, query, params );
+  return resultSet.size();
+}
+
+/**!
+ * \brief
+ *  queryKnn
+ *
+ *  Search the num_closest nearest points in the kd-tree
+ */
+void
+PccPointCloud::queryKnn( const float *query, size_t num_closest, index_type *indices, distance_type *sqrDist )
+{
+  nanoflann::KNNResultSet<distance_type, index_type> resultSet( num_closest );
+  resultSet.init( indices, sqrDist );
+  findNeighbors( resultSet, query, nanoflann::SearchParams() );
+}
+
 /**!
  * \brief
  *  checkFile
  *
+ *  Parse the header section, at the beginning of the file content "data",
+ *  into the field schema of the vertex element: names, types and positions
+ *  in a line, and the offset of the data section.
+ *
  * \param out
- * return the position of the field, if found
- * return -1 if not found
+ * return 0, if succeed
+ * return -1, if the header is not compatible
  *  Dong Tian <tian@merl.com>
  */
 int
-PccPointCloud::checkFile(string fileName)
+PccPointCloud::checkFile(const unsigned char *data, size_t dataSize)
 {
-  ifstream in;
   string line;
   string str[3];
   int counter = 0;
@@ -336,9 +819,14 @@ PccPointCloud::checkFile(string fileName)
   bool bEnd = false;
   fieldSize = 0;                  // position in the line memory buffer
 
-  in.open(fileName, ifstream::in);
-  while ( getline(in, line) && lineNum < 100) // Maximum number of lines of header section: 100
+  size_t pos = 0;
+  while ( pos < dataSize && lineNum < 100) // Maximum number of lines of header section: 100
   {
+    const unsigned char *eol = (const unsigned char*) memchr( data + pos, '\n', dataSize - pos );
+    size_t next = eol ? eol - data + 1 : dataSize;
+    line.assign( (const char*) data + pos, next - pos );
+    pos = next;
+
     line = rtrim( line );
     if (line == "ply")
     {
@@ -378,12 +866,13 @@ PccPointCloud::checkFile(string fileName)
       else if ( str[0] == "property" && secIdx == 1 && str[1] != "list" )
       {
         fieldPos.push_back(fieldSize);
+        fieldName.push_back(str[2]);
         if ( str[1] == "uint8" || str[1] == "uchar" ) {
           fieldType.push_back(PointFieldTypes::UINT8);
           fieldSize += sizeof(unsigned char);
         }
         else if ( str[1] == "int8" || str[1] == "char" ) {
-          fieldType.push_back(PointFieldTypes::INT16);
+          fieldType.push_back(PointFieldTypes::INT8);
           fieldSize += sizeof(char);
         }
         else if ( str[1] == "uint16" || str[1] == "ushort" ) {
@@ -412,6 +901,7 @@ PccPointCloud::checkFile(string fileName)
         }
         else {
           cerr << "Incompatible header section. Line: " << line << endl;
+          fieldType.push_back(0);
           bPly = false;
         }
         fieldNum++;
@@ -426,29 +916,24 @@ PccPointCloud::checkFile(string fileName)
 
     lineNum++;
   }
-#ifndef _WIN32
-  dataPos = in.tellg(); // Only to be used under Linux. @DT
-#endif
-
-  in.close();
+  dataPos = pos;
 
   lineMem.reset(new unsigned char[fieldNum * sizeof(double)]);
 
   if (bPly && fileFormat >= 0 && fieldNum > 0 && size > 0 && bEnd)
     return 0;
 
-  cout << "Warning: The header section seems not fully compatible!\n";
+  *log << "Warning: The header section seems not fully compatible!\n";
   return -1;
 }
 
 /*
  * \brief
- *   Check the attribute by parsing the header section
+ *   Look up an attribute in the field schema parsed by checkFile
  *
  * \param[in]
- *   fileName: Input point cloud file
  *   fieldName: Attribute name
- *   fieldTypeX: Potential data type of the attribute
+ *   fieldTypes: Potential data types of the attribute
  *
  * \return -1, if fails
  *         index of this attribute in a row, if succeeds
@@ -456,66 +941,20 @@ PccPointCloud::checkFile(string fileName)
  *  Dong Tian <tian@merl.com>
  */
 int
-PccPointCloud::checkField(string fileName, string fieldName, const std::initializer_list<const char*>& fieldTypes)
+PccPointCloud::checkField(string fieldName, const std::initializer_list<int>& fieldTypes)
 {
-  ifstream in;
-  string line;
-  string str[3];
-  int counter = 0;
-  bool bFound = false;
-  int iPos = -1;
-
-  int secIdx = 0;               // 1: vertex.
-  in.open(fileName, ifstream::in);
-
-  while ( getline(in, line) )
+  for (int i = 0; i < fieldNum; i++)
   {
-    if (line == "ply")
-      ;
-    else
-    {
-      // cout << line << endl;
-      counter = 0;
-      stringstream ssin(line);
-      while (ssin.good() && counter < 3){
-        ssin >> str[counter];
-        counter++;
-      }
-
-      if ( str[0] == "format" )
-        ;                       // do nothing
-      else if ( str[0] == "element" )
-      {
-        if (str[1] == "vertex")
-          secIdx = 1;
-        else
-          secIdx = 2;
-      }
-      else if ( str[0] == "property" && secIdx == 1 && str[1] != "list" )
-      {
-        iPos++;
-        if ( std::find(fieldTypes.begin(), fieldTypes.end(), str[1]) != fieldTypes.end() )
-        {
-          if ( str[2] == fieldName )
-          {
-            bFound = true;
-            break;
-          }
-        }
-      }
-    }
+    if ( this->fieldName[i] == fieldName &&
+         std::find(fieldTypes.begin(), fieldTypes.end(), fieldType[i]) != fieldTypes.end() )
+      return i;
   }
-  in.close();
-
-  if ( !bFound )
-    iPos = -1;
-
-  return iPos;
+  return -1;
 }
 
 /*
  * \brief
- *   Load one line of data from the input file
+ *   Load one line of data from the input file (ascii format)
  *
  * \param[in]
  *   in: Input file stream
@@ -560,44 +999,7 @@ PccPointCloud::loadLine( ifstream &in )
         in >> ((double*)(lineMem.get()+fieldPos[i]))[0];
         break;
       default:
-        cout << "Unknown field type: " << fieldType[i] << endl;
-        return -1;
-        break;
-      }
-    }
-  }
-  else if (fileFormat == 1)     // binary_little_endian
-  {
-    for (i = 0; i < fieldNum; i++)
-    {
-      switch (fieldType[i])
-      {
-      case PointFieldTypes::UINT8:
-        in.read((char*)(lineMem.get()+fieldPos[i]), sizeof(unsigned char));
-        break;
-      case PointFieldTypes::INT8:
-        in.read((char*)(lineMem.get()+fieldPos[i]), sizeof(char));
-        break;
-      case PointFieldTypes::UINT16:
-        in.read((char*)(lineMem.get()+fieldPos[i]), sizeof(unsigned short));
-        break;
-      case PointFieldTypes::INT16:
-        in.read((char*)(lineMem.get()+fieldPos[i]), sizeof(short));
-        break;
-      case PointFieldTypes::UINT32:
-        in.read((char*)(lineMem.get()+fieldPos[i]), sizeof(unsigned int));
-        break;
-      case PointFieldTypes::INT32:
-        in.read((char*)(lineMem.get()+fieldPos[i]), sizeof(int));
-        break;
-      case PointFieldTypes::FLOAT32:
-        in.read((char*)(lineMem.get()+fieldPos[i]), sizeof(float));
-        break;
-      case PointFieldTypes::FLOAT64:
-        in.read((char*)(lineMem.get()+fieldPos[i]), sizeof(double));
-        break;
-      default:
-        cout << "Unknown field type: " << fieldType[i] << endl;
+        *log << "Unknown field type: " << fieldType[i] << endl;
         return -1;
         break;
       }
@@ -609,63 +1011,215 @@ PccPointCloud::loadLine( ifstream &in )
   return 0;
 }
 
-#if _WIN32
+/*
+ * \brief
+ *   Parse the ascii vertex data in parallel: the data section is split into
+ *   newline-aligned chunks, the records (non blank lines) of every chunk are
+ *   counted, then every chunk is parsed with std::from_chars into binary
+ *   records converted by the loadBlock() of the point sets.
+ *
+ * \param[in]
+ *   data: Content of the input file
+ *   dataSize: Size of the input file
+ *
+ * \return 0, if succeed
+ *         non-zero, if the data must be read by the stream parser instead:
+ *         std::from_chars not available, or values/layout that the stream
+ *         parser could read differently
+ */
 int
-PccPointCloud::seekAscii(ifstream &in)
+PccPointCloud::loadAscii( const unsigned char *data, size_t dataSize )
 {
-  string line;
-  int lineNum = 0;
-  bool bFound = false;
-  while (!bFound && lineNum < 1000 && getline(in, line))
+#if PCC_FAST_ASCII
+  const char *begin = (const char*) data + dataPos;
+  const char *end = (const char*) data + dataSize;
+  const size_t chunkBytes = 1 << 20;
+  const long int nbChunks = std::max<long int>( 1, (end - begin) / chunkBytes );
+
+  vector<const char*> chunkBegin( nbChunks + 1, end );
+  chunkBegin[0] = begin;
+  for (long int k = 1; k < nbChunks; k++)
   {
-    line = rtrim(line);
-    if (line == "end_header")
-      bFound = true;
+    const char *p = begin + (end - begin) / nbChunks * k;
+    const char *eol = (const char*) memchr( p, '\n', end - p );
+    chunkBegin[k] = eol ? eol + 1 : end;
   }
-  if (bFound)
-    return 0;
-  return -1;
-}
 
-int
-PccPointCloud::seekBinary(ifstream &in)
-{
-  // Move the pointer to the beginning of the data
-  // in.seekg( dataPos );
-  char buf[200];
-  char mark[] = "end_header";
-  int  markLen = sizeof(mark);
-  int posFile = 0;
-  int posBuf = 0;
-  while (strcmp(buf, mark) != 0 && posFile < 9000)
-  {
-    in.read(&buf[posBuf], 1);
-    buf[posBuf + 1] = 0;
-    if (posBuf >= markLen - 1)
+  // Index of the first record of every chunk
+  vector<long int> chunkFirst( nbChunks + 1, 0 );
+#pragma omp parallel for schedule(dynamic)
+  for (long int k = 0; k < nbChunks; k++)
+    chunkFirst[k + 1] = countRecords( chunkBegin[k], chunkBegin[k + 1] );
+  for (long int k = 0; k < nbChunks; k++)
+    chunkFirst[k + 1] += chunkFirst[k];
+  if ( chunkFirst[nbChunks] < size )
+    return -1;
+
+  int failed = 0;
+#pragma omp parallel for schedule(dynamic) reduction(|:failed)
+  for (long int k = 0; k < nbChunks; k++)
+  {
+    const long int first = chunkFirst[k];
+    const long int last = std::min( size, chunkFirst[k + 1] );
+    if ( first >= last )
+      continue;
+
+    vector<unsigned char> records( (size_t) (last - first) * fieldSize );
+    const char *p = chunkBegin[k];
+    const char *chunkEnd = chunkBegin[k + 1];
+    for (long int i = first; i < last && p < chunkEnd && !failed; p++)
     {
-      memcpy(buf, buf + 1, markLen + 1);
-      buf[markLen - 1] = 0;
+      const char *eol = (const char*) memchr( p, '\n', chunkEnd - p );
+      if ( !eol )
+        eol = chunkEnd;
+      while ( p < eol && isBlank( *p ) )
+        p++;
+      if ( p == eol )           // blank line
+        continue;
+
+      unsigned char *rec = &records[(size_t) (i - first) * fieldSize];
+      for (int f = 0; f < fieldNum && !failed; f++)
+      {
+        const char *token = p;
+        while ( p < eol && !isBlank( *p ) )
+          p++;
+        bool bOk = false;
+        switch (fieldType[f])
+        {
+        case PointFieldTypes::UINT8:
+          bOk = parseAsciiField<unsigned short, unsigned char>( token, p, rec + fieldPos[f] ); // as loadLine
+          break;
+        case PointFieldTypes::INT8:
+          bOk = parseAsciiField<short, signed char>( token, p, rec + fieldPos[f] );
+          break;
+        case PointFieldTypes::UINT16:
+          bOk = parseAsciiField<unsigned short>( token, p, rec + fieldPos[f] );
+          break;
+        case PointFieldTypes::INT16:
+          bOk = parseAsciiField<short>( token, p, rec + fieldPos[f] );
+          break;
+        case PointFieldTypes::UINT32:
+          bOk = parseAsciiField<unsigned int>( token, p, rec + fieldPos[f] );
+          break;
+        case PointFieldTypes::INT32:
+          bOk = parseAsciiField<int>( token, p, rec + fieldPos[f] );
+          break;
+        case PointFieldTypes::FLOAT32:
+          bOk = parseAsciiField<float>( token, p, rec + fieldPos[f] );
+          break;
+        case PointFieldTypes::FLOAT64:
+          bOk = parseAsciiField<double>( token, p, rec + fieldPos[f] );
+          break;
+        }
+        failed |= !bOk;
+        while ( p < eol && isBlank( *p ) )
+          p++;
+      }
+      failed |= (p != eol);     // a record per line only
+      i++;
+      p = eol;
     }
-    else
+
+    if ( !failed )
     {
-      posBuf++;
+      xyz.loadBlock( this, records.data(), first, last );
+      if (bNormal)
+        normal.loadBlock( this, records.data(), first, last );
+      if (bRgb)
+        rgb.loadBlock( this, records.data(), first, last );
+      if (bLidar)
+        lidar.loadBlock( this, records.data(), first, last );
     }
-    posFile++;
   }
-  // Move pointer to after end of line for this line
-  buf[0] = 0;
-  buf[1] = 0;
-  while (strcmp(buf, "\n") != 0 && posFile < 9000)
+  return failed ? -1 : 0;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * \brief
+ *   Convert the binary vertex block into the point sets, in parallel chunks.
+ *   Only the fields of the initialized sets are read.
+ *
+ * \param[in]
+ *   data: Content of the input file
+ *   dataSize: Size of the input file
+ *
+ * \return 0, if succeed
+ *         non-zero, if failed
+ */
+int
+PccPointCloud::loadBinary( const unsigned char *data, size_t dataSize )
+{
+  if ( dataPos + (size_t) size * fieldSize > dataSize )
   {
-    in.read(&buf[0], 1);
-    posFile++;
+    *log << "Error: the file is shorter than the vertex data declared in its header." << endl;
+    return -1;
   }
 
-  if (posFile >= 9000)
-    return -1;
+  const unsigned char *vertex = data + dataPos;
+  const long int chunkSize = 65536;
+  const long int nbChunks = (size + chunkSize - 1) / chunkSize;
+
+#pragma omp parallel for schedule(dynamic)
+  for (long int k = 0; k < nbChunks; k++)
+  {
+    const long int first = k * chunkSize;
+    const long int last = std::min( size, first + chunkSize );
+    xyz.loadBlock( this, vertex + (size_t) first * fieldSize, first, last );
+    if (bNormal)
+      normal.loadBlock( this, vertex + (size_t) first * fieldSize, first, last );
+    if (bRgb)
+      rgb.loadBlock( this, vertex + (size_t) first * fieldSize, first, last );
+    if (bLidar)
+      lidar.loadBlock( this, vertex + (size_t) first * fieldSize, first, last );
+  }
   return 0;
 }
-#endif
+
+
+/**!
+ * \brief
+ *  Order preserving key of a float: comparing the keys gives the same result
+ *  as comparing the floats, -0 and +0 sharing the same key.
+ */
+static inline uint32_t
+floatKey( float v )
+{
+  uint32_t bits;
+  if ( v == 0.0f )
+    v = 0.0f;
+  memcpy( &bits, &v, sizeof(bits) );
+  return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+struct SortRecord
+{
+  uint32_t key[3];              //! floatKey() of x, y, z
+  index_type idx;               //! index of the point in the loaded order
+};
+
+static inline bool
+sameKey( const SortRecord &a, const SortRecord &b )
+{
+  return a.key[0] == b.key[0] && a.key[1] == b.key[1] && a.key[2] == b.key[2];
+}
+
+/**!
+ * \brief
+ *  Gather values[order[i]] into a new array of values
+ */
+template <typename T>
+static void
+gather( vector<T> &values, const vector<index_type> &order )
+{
+  vector<T> sorted( order.size() );
+#pragma omp parallel for
+  for (long int i = 0; i < (long int) order.size(); i++)
+    sorted[i] = values[order[i]];
+  values.swap( sorted );
+}
 
 
 /*
@@ -674,6 +1228,9 @@ PccPointCloud::seekBinary(ifstream &in)
  *   inFile: File name of the input point cloud
  *   normalsOnly: Import only normals, or all data
  *   dropDuplicates: 0 (detect only), 1 (drop), 2 (average)
+ *   neighborsProc: 2 to keep the number of points merged in every point
+ *   attributes: the attributes loaded (Attributes flags), the other ones
+ *     being ignored
  *
  * \return 0, if succeed
  *         non-zero, if failed
@@ -681,11 +1238,9 @@ PccPointCloud::seekBinary(ifstream &in)
  *  Dong Tian <tian@merl.com>
  */
 int
-PccPointCloud::load(string inFile, bool normalsOnly, int dropDuplicates, int neighborsProc)
+PccPointCloud::load(string inFile, bool normalsOnly, int dropDuplicates, int neighborsProc, int attributes)
 {
-  int ret = 0;
-
-  int iPos[3];                  // The position of x,y,z in the list
+  const double t0 = GetWallClock();
 
   if (inFile == "")
     return 0;
@@ -693,28 +1248,92 @@ PccPointCloud::load(string inFile, bool normalsOnly, int dropDuplicates, int nei
   struct stat64 bufferExist;
   if (stat64(inFile.c_str(), &bufferExist) != 0)
   {
-    cout << "File does not exist: " << inFile << endl;
+    *log << "File does not exist: " << inFile << endl;
     return -1;
   }
 
-  // Check file header
-  if ( checkFile( inFile ) != 0 )
+  // Map the file, and parse its header once
+  MappedFile file;
+  if ( file.open( inFile ) != 0 )
+  {
+    *log << "Could not read the file: " << inFile << endl;
+    return -1;
+  }
+  if ( checkFile( file.data, file.size ) != 0 )
     return -1;
 
+  return loadFields( file.data, file.size, inFile, t0, normalsOnly, dropDuplicates, neighborsProc, attributes );
+}
+
+/*
+ * \brief load the vertex records of a binary file into memory, as load()
+ *   does with the vertex data of the file
+ * \param[in]
+ *   data: Records of nbRecords points, in the layout of the header parsed
+ *     beforehand by checkFile()
+ *
+ * \return 0, if succeed
+ *         non-zero, if failed
+ */
+int
+PccPointCloud::loadRecords(const unsigned char *data, long int nbRecords, bool normalsOnly, int dropDuplicates, int neighborsProc, int attributes)
+{
+  const double t0 = GetWallClock();
+  if (fileFormat != 1)
+    return -1;
+  size = nbRecords;
+  dataPos = 0;
+  return loadFields( data, (size_t) nbRecords * fieldSize, "", t0, normalsOnly, dropDuplicates, neighborsProc, attributes );
+}
+
+/*
+ * \brief load a ply file in memory, as load() does with a file
+ * \param[in]
+ *   data: Content of the ply file, header included, of dataSize bytes
+ *
+ * \return 0, if succeed
+ *         non-zero, if failed
+ */
+int
+PccPointCloud::loadMemory(const unsigned char *data, size_t dataSize, bool normalsOnly, int dropDuplicates, int neighborsProc, int attributes)
+{
+  const double t0 = GetWallClock();
+  if ( checkFile( data, dataSize ) != 0 )
+    return -1;
+  return loadFields( data, dataSize, "", t0, normalsOnly, dropDuplicates, neighborsProc, attributes );
+}
+
+/*
+ * \brief load the fields of the data section, once the header is parsed:
+ *   read the points, then sort them and process the duplicates
+ * \param[in]
+ *   data: Content of the input file, or vertex records
+ *   inFile: File name, for the ascii stream parser fallback
+ *   t0: Wall clock time at the beginning of the load
+ */
+int
+PccPointCloud::loadFields(const unsigned char *data, size_t dataSize, const string &inFile, double t0,
+                          bool normalsOnly, int dropDuplicates, int neighborsProc, int attributes)
+{
+  int ret = 0;
+  int iPos[3];                  // The position of x,y,z in the list
+
   // Make sure (x,y,z) available and determine the float type
-  iPos[0] = checkField( inFile, "x", {"float", "float32", "float64", "double", "int32", "uint32"} );
-  iPos[1] = checkField( inFile, "y", {"float", "float32", "float64", "double", "int32", "uint32"} );
-  iPos[2] = checkField( inFile, "z", {"float", "float32", "float64", "double", "int32", "uint32"} );
+  const std::initializer_list<int> coordTypes = { PointFieldTypes::FLOAT32, PointFieldTypes::FLOAT64,
+                                                   PointFieldTypes::INT32, PointFieldTypes::UINT32 };
+  iPos[0] = checkField( "x", coordTypes );
+  iPos[1] = checkField( "y", coordTypes );
+  iPos[2] = checkField( "z", coordTypes );
   if ( iPos[0] < 0 && iPos[1] < 0 && iPos[2] < 0 )
     return -1;
   xyz.init(size, iPos[0], iPos[1], iPos[2]);
   bXyz = true;
 
   // Optional normals (nx,ny,nz)
-  iPos[0] = checkField( inFile, "nx", {"float", "float32", "float64", "double", "int32", "uint32"} );
-  iPos[1] = checkField( inFile, "ny", {"float", "float32", "float64", "double", "int32", "uint32"} );
-  iPos[2] = checkField( inFile, "nz", {"float", "float32", "float64", "double", "int32", "uint32"} );
-  if ( iPos[0] >= 0 && iPos[1] >= 0 && iPos[2] >= 0 ) {
+  iPos[0] = checkField( "nx", coordTypes );
+  iPos[1] = checkField( "ny", coordTypes );
+  iPos[2] = checkField( "nz", coordTypes );
+  if ( (normalsOnly || (attributes & Attributes::NORMALS)) && iPos[0] >= 0 && iPos[1] >= 0 && iPos[2] >= 0 ) {
     normal.init(size, iPos[0], iPos[1], iPos[2]);
     bNormal = true;
   }
@@ -723,164 +1342,286 @@ PccPointCloud::load(string inFile, bool normalsOnly, int dropDuplicates, int nei
     return -1;
 
   // Make sure (r,g,b) available and determine the float type
-  iPos[0] = checkField( inFile, "red",   {"uint8", "uchar"} );
-  iPos[1] = checkField( inFile, "green", {"uint8", "uchar"} );
-  iPos[2] = checkField( inFile, "blue",  {"uint8", "uchar"} );
-  if ( !normalsOnly && iPos[0] >= 0 && iPos[1] >= 0 && iPos[2] >= 0 )
+  iPos[0] = checkField( "red",   {PointFieldTypes::UINT8} );
+  iPos[1] = checkField( "green", {PointFieldTypes::UINT8} );
+  iPos[2] = checkField( "blue",  {PointFieldTypes::UINT8} );
+  if ( !normalsOnly && (attributes & Attributes::COLORS) && iPos[0] >= 0 && iPos[1] >= 0 && iPos[2] >= 0 )
   {
     rgb.init(size, iPos[0], iPos[1], iPos[2]);
     bRgb = true;
   }
 
   // Make sure (lidar) available and determine the integer type
-  iPos[0] = checkField( inFile, "reflectance", {"uint16", "uint8"} );
-  if ( !normalsOnly && iPos[0] < 0 )
-    iPos[0] = checkField( inFile, "refc", {"uint16", "uint8"} );
+  iPos[0] = checkField( "reflectance", {PointFieldTypes::UINT16, PointFieldTypes::UINT8} );
+  if ( iPos[0] < 0 )
+    iPos[0] = checkField( "refc", {PointFieldTypes::UINT16, PointFieldTypes::UINT8} );
 
-  if ( iPos[0] >= 0 )
+  if ( !normalsOnly && (attributes & Attributes::REFLECTANCES) && iPos[0] >= 0 )
   {
     lidar.init(size, iPos[0]);
     bLidar = true;
   }
 
-  // Load regular data (rather than normals)
-  ifstream in;
-
-  if (fileFormat == 0)
+  if (fileFormat == 0 && loadAscii( data, dataSize ) != 0)
   {
-    in.open(inFile, ifstream::in);
-#if _WIN32
-    if (seekAscii(in) != 0)
-    {
-      cout << "Check the file header section. Incompatible header!" << endl;
-      in.close();
+    if (inFile == "")           // in memory: no file to parse as a stream
       return -1;
-    }
-#else
-    in.seekg(dataPos);
-#endif
-  }
-  else if (fileFormat == 1)
-  {
+
+    // Load regular data (rather than normals)
+    ifstream in;
     in.open(inFile, ifstream::in | ifstream::binary);
-#if _WIN32
-    if (seekBinary(in) != 0)
-    {
-      cout << "Check the file header section. Incompatible header!" << endl;
-      in.close();
-      return -1;
-    }
-#else
     in.seekg(dataPos);
-#endif
-  }
 
-  for (long int i = 0; i < size; i++)
-  {
-    if ( loadLine( in ) < 0 )   // Load the data into line memory
+    for (long int i = 0; i < size; i++)
     {
-      ret = -1;
-      break;
+      if ( loadLine( in ) < 0 )   // Load the data into line memory
+      {
+        ret = -1;
+        break;
+      }
+      xyz.loadPoints( this, i );
+      if (bNormal)
+        normal.loadPoints( this, i );
+      if (bRgb)
+        rgb.loadPoints( this, i );
+      if (bLidar)
+        lidar.loadPoints( this, i );
     }
-    xyz.loadPoints( this, i );
-    if (bNormal)
-      normal.loadPoints( this, i );
-    if (bRgb)
-      rgb.loadPoints( this, i );
-    if (bLidar)
-      lidar.loadPoints( this, i );
+    in.close();
+  }
+  else if (fileFormat == 1)
+  {
+    if ( loadBinary( data, dataSize ) != 0 )
+      return -1;
   }
-  in.close();
 
 #if 1
-  if (1)
+  if (bVerbose && size > 0)
   {
     long int i = size - 1;
-    cout << "Verifying if the data is loaded correctly.. The last point is: ";
-    cout << xyz.p[i][0] << " " << xyz.p[i][1] << " " << xyz.p[i][2] << endl;
+    *log << "Verifying if the data is loaded correctly.. The last point is: ";
+    const PointXYZSet::point_type last = xyz.point( i );
+    *log << last[0] << " " << last[1] << " " << last[2] << endl;
   }
 #endif
 
-  // sort the point cloud
-  std::sort(this->begin(), this->end());
+  timeLoad = GetWallClock() - t0;
 
-  // Find runs of identical point positions
-  for (auto it_seq = this->begin(); it_seq != this->end(); ) {
-    it_seq = std::adjacent_find(it_seq, this->end());
-    if (it_seq == this->end())
-      break;
+  sortAndMerge( dropDuplicates, neighborsProc );
+  return ret;
+}
 
-    // accumulators for averaging attribute values
-    long cattr[3] {}; // sum colors.
-    long lattr {}; // sum lidar.
+/*
+ * \brief load points already in memory, in the layout of the point cloud:
+ *   the vectors are moved into the point cloud, without copying them, then
+ *   sorted and deduplicated as load() does
+ * \param[in]
+ *   points: Coordinates of the points
+ *   colors, normals, reflectances: Attributes of the points, empty if not
+ *     available, of the size of points otherwise
+ *
+ * \return 0, if succeed
+ *         non-zero, if failed
+ */
+int
+PccPointCloud::loadVectors(vector<PointXYZSet::point_type> &&points, vector<RGBSet::value_type> &&colors,
+                           vector<NormalSet::value_type> &&normals, vector<LidarSet::value_type> &&reflectances,
+                           int dropDuplicates, int neighborsProc)
+{
+  const double t0 = GetWallClock();
+  const size_t n = points.size();
+  if ((!colors.empty() && colors.size() != n) || (!normals.empty() && normals.size() != n) ||
+      (!reflectances.empty() && reflectances.size() != n))
+    return -1;
 
-    // iterate over the duplicate points, accumulating values
-    int count = 0;
-    auto it = it_seq;
-    for (; *it == *it_seq; ++it) {
-      count++;
-      int idx = it.idx;
-      if (bRgb) {
-        cattr[0] += rgb.c[idx][0];
-        cattr[1] += rgb.c[idx][1];
-        cattr[2] += rgb.c[idx][2];
-      }
+  size = (long int) n;
+  xyz.init( 0 );
+  xyz.p = std::move( points );
+  rgb.c = std::move( colors );
+  normal.n = std::move( normals );
+  lidar.reflectance = std::move( reflectances );
+  bXyz = true;
+  bRgb = !rgb.c.empty();
+  bNormal = !normal.n.empty();
+  bLidar = !lidar.reflectance.empty();
+  timeLoad = GetWallClock() - t0;
 
-      if (bLidar)
-        lattr += lidar.reflectance[idx];
-    }
+  sortAndMerge( dropDuplicates, neighborsProc );
+  return 0;
+}
 
-    int first_idx = it_seq.idx;
-    it_seq = it;
+/*
+ * \brief sort the loaded points on (x, y, z) and process the duplicates
+ *   (see load()), then check whether the coordinates are voxelized
+ */
+void
+PccPointCloud::sortAndMerge(int dropDuplicates, int neighborsProc)
+{
+  const double t1 = GetWallClock();
 
-    // averaging case only
-    if (dropDuplicates != 2)
-      continue;
+  // sort the point cloud, on (x, y, z)
+  vector<SortRecord> rec( size );
+#pragma omp parallel for
+  for (long int i = 0; i < size; i++)
+  {
+    rec[i].key[0] = floatKey( xyz.p[i][0] );
+    rec[i].key[1] = floatKey( xyz.p[i][1] );
+    rec[i].key[2] = floatKey( xyz.p[i][2] );
+    rec[i].idx = i;
+  }
+  // z is the least significant word
+  radixSort( rec, 3, 32, []( const SortRecord &r, int w ) { return uint64_t( r.key[2 - w] ); } );
+
+  // Find the runs of identical point positions: runs[j] is the first record
+  // of the j-th run, computed per block and then offset
+  const size_t nbBlocks = std::min<size_t>( 64, size / 65536 + 1 );
+  vector<size_t> blockRuns( nbBlocks + 1, 0 );
+#pragma omp parallel for schedule(static)
+  for (long int b = 0; b < (long int) nbBlocks; b++)
+    for (size_t i = size * b / nbBlocks; i < size * (b + 1) / nbBlocks; i++)
+      blockRuns[b + 1] += (i == 0 || !sameKey( rec[i], rec[i - 1] ));
+  for (size_t b = 0; b < nbBlocks; b++)
+    blockRuns[b + 1] += blockRuns[b];
+
+  const long int nbRuns = blockRuns[nbBlocks];
+  vector<size_t> runs( nbRuns + 1, size );
+#pragma omp parallel for schedule(static)
+  for (long int b = 0; b < (long int) nbBlocks; b++)
+  {
+    size_t j = blockRuns[b];
+    for (size_t i = size * b / nbBlocks; i < size * (b + 1) / nbBlocks; i++)
+      if (i == 0 || !sameKey( rec[i], rec[i - 1] ))
+        runs[j++] = i;
+  }
 
-    if (bRgb) {
-      rgb.c[first_idx][0] = cattr[0] / count;
-      rgb.c[first_idx][1] = cattr[1] / count;
-      rgb.c[first_idx][2] = cattr[2] / count;
-    }
+  // averaging case only: the first point of every run gets the average
+  // attributes of the run, and the number of points of the run if they are
+  // used as weights (nbdup is empty otherwise, every point counting once)
+  if (dropDuplicates == 2 && neighborsProc == 2)
+    xyz.nbdup.assign( size, 1 );
+  if (dropDuplicates == 2)
+  {
+#pragma omp parallel for schedule(dynamic, 4096)
+    for (long int j = 0; j < nbRuns; j++)
+    {
+      const int count = runs[j + 1] - runs[j];
+      if (count == 1)
+        continue;
+
+      // accumulators for averaging attribute values
+      long cattr[3] {}; // sum colors.
+      long lattr {}; // sum lidar.
+      for (size_t i = runs[j]; i < runs[j + 1]; i++)
+      {
+        const index_type idx = rec[i].idx;
+        if (bRgb) {
+          cattr[0] += rgb.c[idx][0];
+          cattr[1] += rgb.c[idx][1];
+          cattr[2] += rgb.c[idx][2];
+        }
 
-    if (neighborsProc == 2)
-      xyz.nbdup[first_idx] = count;
+        if (bLidar)
+          lattr += lidar.reflectance[idx];
+      }
 
-    if (bLidar)
-      lidar.reflectance[first_idx] = lattr / count;
+      const index_type first_idx = rec[runs[j]].idx;
+      if (bRgb) {
+        rgb.c[first_idx][0] = cattr[0] / count;
+        rgb.c[first_idx][1] = cattr[1] / count;
+        rgb.c[first_idx][2] = cattr[2] / count;
+      }
+
+      if (neighborsProc == 2)
+        xyz.nbdup[first_idx] = count;
+
+      if (bLidar)
+        lidar.reflectance[first_idx] = lattr / count;
+    }
   }
 
+  // Reorder every attribute once, keeping the first point of every run
+  // when dropping or averaging the duplicates
   int duplicatesFound = 0;
-  if (dropDuplicates != 0) {
-    auto last = std::unique(this->begin(), this->end());
-    duplicatesFound = std::distance(last, this->end());
+  if (dropDuplicates != 0)
+  {
+    duplicatesFound = size - nbRuns;
+    size = nbRuns;
+  }
+  vector<index_type> order( size );
+  bool bSorted = duplicatesFound == 0;
+#pragma omp parallel for reduction(&&:bSorted)
+  for (long int i = 0; i < size; i++)
+  {
+    order[i] = rec[dropDuplicates != 0 ? runs[i] : i].idx;
+    bSorted = bSorted && order[i] == (index_type) i;
+  }
+  vector<SortRecord>().swap( rec );
 
-    size -= duplicatesFound;
-    xyz.p.resize(size);
-    xyz.nbdup.resize(size);
+  // Integer coordinates, spanning less than 2^21 along every axis: the
+  // nearest neighbors can be searched in a voxel grid. The duplicates have
+  // the coordinates of the points kept, and are checked with them
+  {
+    const float maxFloat = numeric_limits<float>::max();
+    float minX = maxFloat, minY = maxFloat, minZ = maxFloat;
+    float maxX = -maxFloat, maxY = -maxFloat, maxZ = -maxFloat;
+    bool bInteger = true;
+#pragma omp parallel for reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ) reduction(&&:bInteger)
+    for (long int i = 0; i < (long int) xyz.p.size(); i++)
+    {
+      const PointXYZSet::point_type &p = xyz.p[i];
+      bInteger = bInteger && p[0] == trunc( p[0] ) && p[1] == trunc( p[1] ) && p[2] == trunc( p[2] );
+      minX = min( minX, p[0] ); maxX = max( maxX, p[0] );
+      minY = min( minY, p[1] ); maxY = max( maxY, p[1] );
+      minZ = min( minZ, p[2] ); maxZ = max( maxZ, p[2] );
+    }
+    const double maxSpan = double( 1 << 21 );
+    bVoxelized = size > 0 && bInteger &&
+                 double( maxX ) - minX < maxSpan && double( maxY ) - minY < maxSpan && double( maxZ ) - minZ < maxSpan;
+
+    // and then stored as int16 or int32, 6 or 12 bytes per point, before
+    // the reordering
+    if (bVoxelized && bCompactXyz)
+      xyz.compact( min( minX, min( minY, minZ ) ), max( maxX, max( maxY, maxZ ) ) );
+  }
+
+  // Points already sorted without duplicates to remove are kept in place
+  if (!bSorted)
+  {
+    switch (xyz.storage)
+    {
+    case PointXYZSet::INT16:
+      gather( xyz.p16, order );
+      break;
+    case PointXYZSet::INT32:
+      gather( xyz.p32, order );
+      break;
+    default:
+      gather( xyz.p, order );
+    }
+    if (!xyz.nbdup.empty())
+      gather( xyz.nbdup, order );
     if (bNormal)
-      normal.n.resize(size);
+      gather( normal.n, order );
     if (bRgb)
-      rgb.c.resize(size);
+      gather( rgb.c, order );
     if (bLidar)
-      lidar.reflectance.resize(size);
+      gather( lidar.reflectance, order );
   }
 
-  if (duplicatesFound > 0)
+  timeDedup = GetWallClock() - t1;
+
+  if (bVerbose && duplicatesFound > 0)
   {
     switch (dropDuplicates)
     {
     case 0:
-      printf("WARNING: %d points with same coordinates found\n",
-              duplicatesFound);
+      *log << "WARNING: " << duplicatesFound << " points with same coordinates found" << endl;
       break;
     case 1:
-      printf("WARNING: %d points with same coordinates found and dropped\n",
-              duplicatesFound);
+      *log << "WARNING: " << duplicatesFound << " points with same coordinates found and dropped" << endl;
       break;
     case 2:
-      printf("WARNING: %d points with same coordinates found and averaged\n",
-              duplicatesFound);
+      *log << "WARNING: " << duplicatesFound << " points with same coordinates found and averaged" << endl;
     }
   }
 
@@ -890,13 +1631,11 @@ PccPointCloud::load(string inFile, bool normalsOnly, int dropDuplicates, int nei
     outF.open( "testItPly.ply", ofstream::out );
     for (long int i = 0; i < size; i++)
     {
-      outF << xyz.p[i][0] << " " << xyz.p[i][1] << " " << xyz.p[i][2] << " " << (unsigned short) rgb.c[i][0] << " " << (unsigned short) rgb.c[i][1] << " " << (unsigned short) rgb.c[i][2] << " " << lidar.reflectance[i] << endl;
+      outF << xyz.point( i )[0] << " " << xyz.point( i )[1] << " " << xyz.point( i )[2] << " " << (unsigned short) rgb.c[i][0] << " " << (unsigned short) rgb.c[i][1] << " " << (unsigned short) rgb.c[i][2] << " " << lidar.reflectance[i] << endl;
       // outF << xyz.p[i][0] << " " << xyz.p[i][1] << " " << xyz.p[i][2] << " " << (unsigned short) rgb.c[i][0] << " " << (unsigned short) rgb.c[i][1] << " " << (unsigned short) rgb.c[i][2] << endl;
       // outF << xyz.p[i][0] << " " << xyz.p[i][1] << " " << xyz.p[i][2] << endl;
     }
     outF.close();
   }
 #endif
-
-  return ret;
 }
@@ -41,7 +41,10 @@
 #ifndef PCC_PROCESSING_HPP
 #define PCC_PROCESSING_HPP
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <cstdio>
 #include <initializer_list>
 #include <iostream>
 #include <fstream>
@@ -49,6 +52,9 @@
 #include <mutex>
 #include <vector>
 
+#include "nanoflann/nanoflann.hpp"
+#include "nanoflann/KDTreeVectorOfVectorsAdaptor.h"
+
 #define DUPLICATECOLORS_DEBUG 0 // 0 or 1
 
 using namespace std;
@@ -56,28 +62,97 @@ using namespace std;
 namespace pcc_processing {
 
   class PccPointCloud;
+  class PointVoxelGrid;
 
   class PointBaseSet
   {
   public:
     PointBaseSet() {};
     virtual int loadPoints( PccPointCloud *pPcc, long int idx ) = 0;
+    virtual void loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last ) = 0;
   };
 
+  /**!
+   * \brief
+   *  Coordinates of the points, in a single column: float as read, or
+   *  int16/int32 once compact() found them all integers in that range.
+   *  point() reads any of them as floats, with the same values.
+   */
   class PointXYZSet : public PointBaseSet
   {
   private:
     int idxInLine[3];           //! index of the x,y,z in the line
   public:
     typedef std::array<float, 3> point_type;
-    vector<point_type> p;
-    vector< int > nbdup;
-    PointXYZSet() {};
+    typedef std::array<int16_t, 3> point16_type;
+    typedef std::array<int32_t, 3> point32_type;
+    enum Storage { FLOAT32, INT16, INT32 };
+
+    Storage storage;            //! column holding the coordinates
+    vector<point_type> p;       //! coordinates, if storage is FLOAT32
+    vector<point16_type> p16;   //! coordinates, if storage is INT16
+    vector<point32_type> p32;   //! coordinates, if storage is INT32
+    vector< int > nbdup;        //! number of points merged in every point, empty if not used (one)
+    PointXYZSet() : storage( FLOAT32 ) {};
     ~PointXYZSet();
     virtual int loadPoints( PccPointCloud *pPcc, long int idx );
+    virtual void loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last );
     void init( long int size, int i0 = -1, int i1 = -1, int i2 = -1 );
+    void compact( float minCoord, float maxCoord ); //! move integer coordinates within [minCoord, maxCoord] to p16 or p32
+    void expand();                                  //! move the coordinates back to p
+
+    inline point_type point( size_t i ) const
+    {
+      switch (storage)
+      {
+      case INT16:
+        return point_type {{ float( p16[i][0] ), float( p16[i][1] ), float( p16[i][2] ) }};
+      case INT32:
+        return point_type {{ float( p32[i][0] ), float( p32[i][1] ), float( p32[i][2] ) }};
+      default:
+        return p[i];
+      }
+    }
+    //! first byte of the coordinates of point i, of pointBytes() bytes per point
+    const void *data( size_t i = 0 ) const;
+    size_t pointBytes() const;
+  };
+
+  // Representation of linear point cloud indexes in kd-tree
+  typedef uint32_t index_type;
+
+  // Representation of distance metric during kd-tree search
+  typedef double distance_type;
+
+  // A version of nanoflann::metric_L2 that forces metric (distance)
+  // calculations to be performed using double precision floats.
+  // NB: by default nanoflann::metric_L2 will be used with the metric
+  //     type of T = num_t (the coordinate type).
+  struct metric_L2_double {
+    template<class T, class DataSource>
+    struct traits {
+      typedef nanoflann::L2_Adaptor<T,DataSource,double> distance_t;
+    };
   };
 
+  // kd-tree over a column of PointXYZSet, of coordinates T: the queries and
+  // the bounds of the nodes are floats, exact for the integer columns
+  template <typename T>
+  struct kd_tree
+  {
+    typedef KDTreeVectorOfVectorsAdaptor<
+        vector<std::array<T, 3>>,            // array type
+        PointXYZSet::point_type::value_type, // coordinate type
+        3,                                   // num dimensions
+        metric_L2_double,                    // distance class
+        index_type                           // index type (eg size_t)
+        > type;
+  };
+
+  typedef kd_tree<float>::type my_kd_tree_t;
+  typedef kd_tree<int16_t>::type my_kd_tree16_t;
+  typedef kd_tree<int32_t>::type my_kd_tree32_t;
+
   class RGBSet : public PointBaseSet
   {
   private:
@@ -88,6 +163,7 @@ namespace pcc_processing {
     RGBSet() {}
     ~RGBSet();
     virtual int loadPoints( PccPointCloud *pPcc, long int idx );
+    virtual void loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last );
     void init( long int size, int i0 = -1, int i1 = -1, int i2 = -1 );
   };
 
@@ -101,6 +177,7 @@ namespace pcc_processing {
     NormalSet() { }
     ~NormalSet();
     virtual int loadPoints( PccPointCloud *pPcc, long int idx );
+    virtual void loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last );
     void init( long int size, int i0 = -1, int i1 = -1, int i2 = -1 );
   };
 
@@ -114,86 +191,10 @@ namespace pcc_processing {
     LidarSet() { }
     ~LidarSet();
     virtual int loadPoints( PccPointCloud *pPcc, long int idx );
+    virtual void loadBlock( const PccPointCloud *pPcc, const unsigned char *data, long int first, long int last );
     void init( long int size, int i0 = -1 );
   };
 
-  struct ProxyIterator;
-  struct Proxy;
-  struct ProxyIterator {
-    typedef std::random_access_iterator_tag iterator_category;
-    typedef Proxy value_type;
-    typedef std::ptrdiff_t difference_type;
-    typedef Proxy* pointer;
-    typedef Proxy& reference;
-
-    ProxyIterator() : cloud(nullptr), idx() {}
-    ProxyIterator(PccPointCloud* cloud) : cloud(cloud), idx() {}
-    ProxyIterator(PccPointCloud* cloud, size_t idx) : cloud(cloud), idx(idx) {}
-
-    ProxyIterator(const ProxyIterator&) = default;
-    ProxyIterator& operator=(const ProxyIterator&) = default;
-
-    ProxyIterator(ProxyIterator&&) = default;
-    ProxyIterator& operator=(ProxyIterator&&) = default;
-
-    bool operator==(const ProxyIterator& other) const;
-
-    /* Iterator */
-    value_type operator*() const;
-    ProxyIterator& operator++();
-
-    /* InputIterator */
-    bool operator!=(const ProxyIterator& other) const;
-    value_type operator->() const;
-    ProxyIterator operator++(int);
-
-    /* BidirectionalIterator */
-    ProxyIterator& operator--();
-    ProxyIterator operator--(int);
-
-    /* RandomAccessIterator */
-    ProxyIterator& operator+=(difference_type m);
-    ProxyIterator operator+(difference_type m) const;
-    ProxyIterator& operator-=(difference_type m);
-    ProxyIterator operator-(difference_type m) const;
-    difference_type operator-(const ProxyIterator& other) const;
-    value_type operator[](size_t idx) const;
-    bool operator<(const ProxyIterator& other) const;
-    bool operator>(const ProxyIterator& other) const;
-    bool operator<=(const ProxyIterator& other) const;
-    bool operator>=(const ProxyIterator& other) const;
-
-    PccPointCloud* cloud;
-    size_t idx;
-  };
-
-  struct Proxy {
-    Proxy() : it() {}
-    Proxy(const ProxyIterator& it) : it(it) {}
-
-    Proxy(const Proxy&) = delete;
-    Proxy& operator=(const Proxy&) = delete;
-
-    Proxy& operator=(Proxy&& other);
-    Proxy(Proxy&& other)
-    : it() {
-      *this = std::move(other);
-    }
-
-    void swap(Proxy& other);
-
-    bool operator<(const Proxy& other) const;
-    bool operator==(const Proxy& other) const;
-
-    const ProxyIterator it;
-
-    PointXYZSet::point_type xyz;
-    int nbdup;
-    NormalSet::value_type normal;
-    RGBSet::value_type rgb;
-    LidarSet::value_type lidar;
-  };
-
   /**!
    * \brief
    *  Wrapper class to hold different type of attributes
@@ -213,31 +214,30 @@ namespace pcc_processing {
                            FLOAT32 = 7,
                            FLOAT64 = 8 };
 
+    enum Attributes { NORMALS = 1,
+                      COLORS = 2,
+                      REFLECTANCES = 4,
+                      ALL = NORMALS | COLORS | REFLECTANCES };
+
     long int size;                 //! The number of points
     int fileFormat;                //! 0: ascii. 1: binary_little_endian
+    std::vector<string> fieldName; //! The field name
     std::vector<int> fieldType;    //! The field type
     std::vector<int> fieldPos;     //! The field position in the line memory
     int fieldNum;                  //! The number of field available
     int fieldSize;                 //! The memory size of the used fields
-    int dataPos;                   //! The file pointer to the beginning of data
+    size_t dataPos;                //! The file offset of the beginning of data
     int lineNum;                   //! The number of lines of header section
     std::unique_ptr<unsigned char[]> lineMem;
 
-    int checkFile( string fileName );
-    int checkField( string fileName, string fieldName, const std::initializer_list<const char*>& fieldTypes );
+    int checkFile( const unsigned char *data, size_t dataSize );
+    int checkField( string fieldName, const std::initializer_list<int>& fieldTypes );
     int loadLine( ifstream &in );
-#if _WIN32
-    int seekBinary(ifstream &in);
-    int seekAscii(ifstream &in);
-#endif
-
-    ProxyIterator begin() {
-      return ProxyIterator(this, 0);
-    }
-
-    ProxyIterator end() {
-      return ProxyIterator(this, size);
-    }
+    int loadAscii( const unsigned char *data, size_t dataSize );
+    int loadBinary( const unsigned char *data, size_t dataSize );
+    int loadFields( const unsigned char *data, size_t dataSize, const string &inFile, double t0,
+                    bool normalsOnly, int dropDuplicates, int neighborsProc, int attributes );
+    void sortAndMerge( int dropDuplicates, int neighborsProc );
 
   public:
     PointXYZSet xyz;
@@ -249,182 +249,152 @@ namespace pcc_processing {
     bool bRgb;
     bool bNormal;
     bool bLidar;
+    bool bVoxelized;               //! integer coordinates, spanning less than 2^21 (see PointVoxelGrid)
+    bool bVerbose;                 //! print the last point and the duplicates found by load()
+    bool bCompactXyz;              //! store the coordinates of a voxelized cloud as int16/int32 (see PointXYZSet)
+    std::ostream *log;             //! stream of the messages of load(), std::cout by default
+
+    double timeLoad;               //! Wall clock time to read the file, in seconds
+    double timeDedup;              //! Wall clock time to sort and merge the duplicates, in seconds
+    double minNNDist;              //! Smallest nearest neighbor distance within the cloud, negative if not computed
+    double maxNNDist;              //! Largest nearest neighbor distance within the cloud (peak value), negative if not computed
 
     PccPointCloud();
     ~PccPointCloud();
-    int load( string inFile, bool normalsOnly = false, int dropDuplicates = 0, int neighborsProc = 0) ;
-  };
-
-
-// ------------- detail ----------------
-
-  inline void swap(Proxy& a, Proxy& b) {
-    a.swap(b);
-  }
-
-  inline void swap(Proxy&& a, Proxy&& b) {
-    a.swap(b);
-  }
-
-  inline void Proxy::swap(Proxy& other) {
-    /* swap proxied storage */
-    auto& a = this->it.cloud;
-    auto& b = other.it.cloud;
-
-    auto& a_xyz = a ? a->xyz.p[this->it.idx] : this->xyz;
-    auto& b_xyz = b ? b->xyz.p[other.it.idx] : other.xyz;
-
-    auto& a_nbdup = a ? a->xyz.nbdup[this->it.idx] : this->nbdup;
-    auto& b_nbdup = b ? b->xyz.nbdup[other.it.idx] : other.nbdup;
-
-    auto& a_normal = a && a->bNormal ? a->normal.n[this->it.idx] : this->normal;
-    auto& b_normal = b && b->bNormal ? b->normal.n[other.it.idx] : other.normal;
-
-    auto& a_rgb = a && a->bRgb ? a->rgb.c[this->it.idx] : this->rgb;
-    auto& b_rgb = b && b->bRgb ? b->rgb.c[other.it.idx] : other.rgb;
-
-    auto& a_lidar = a && a->bLidar
-      ? a->lidar.reflectance[this->it.idx] : this->lidar;
-    auto& b_lidar = b && b->bLidar
-      ? b->lidar.reflectance[other.it.idx] : other.lidar;
-
-    using std::swap;
-    swap(a_xyz, b_xyz);
-    swap(a_nbdup, b_nbdup);
-    swap(a_normal, b_normal);
-    swap(a_rgb, b_rgb);
-    swap(a_lidar, b_lidar);
-  }
-
-  inline Proxy& Proxy::operator=(Proxy&& other) {
-    /* move operation */
-    auto& a = this->it.cloud;
-    auto& b = other.it.cloud;
-
-    auto& a_xyz = a ? a->xyz.p[this->it.idx] : this->xyz;
-    auto& b_xyz = b ? b->xyz.p[other.it.idx] : other.xyz;
-
-    auto& a_nbdup = a ? a->xyz.nbdup[this->it.idx] : this->nbdup;
-    auto& b_nbdup = b ? b->xyz.nbdup[other.it.idx] : other.nbdup;
-
-    auto& a_normal = a && a->bNormal ? a->normal.n[this->it.idx] : this->normal;
-    auto& b_normal = b && b->bNormal ? b->normal.n[other.it.idx] : other.normal;
-
-    auto& a_rgb = a && a->bRgb ? a->rgb.c[this->it.idx] : this->rgb;
-    auto& b_rgb = b && b->bRgb ? b->rgb.c[other.it.idx] : other.rgb;
-
-    auto& a_lidar = a && a->bLidar
-      ? a->lidar.reflectance[this->it.idx] : this->lidar;
-    auto& b_lidar = b && b->bLidar
-      ? b->lidar.reflectance[other.it.idx] : other.lidar;
-
-    a_xyz = std::move(b_xyz);
-    a_nbdup = std::move(b_nbdup);
-    a_normal = std::move(b_normal);
-    a_rgb = std::move(b_rgb);
-    a_lidar = std::move(b_lidar);
-
-    return *this;
-  }
-
-  inline bool Proxy::operator<(const Proxy& other) const {
-    auto& a = this->it.cloud;
-    auto& b = other.it.cloud;
-
-    auto& a_xyz = a ? a->xyz.p[this->it.idx] : this->xyz;
-    auto& b_xyz = b ? b->xyz.p[other.it.idx] : other.xyz;
-
-    return a_xyz < b_xyz;
-  }
-
-  inline bool Proxy::operator==(const Proxy& other) const {
-    auto& a = this->it.cloud;
-    auto& b = other.it.cloud;
-
-    auto& a_xyz = a ? a->xyz.p[this->it.idx] : this->xyz;
-    auto& b_xyz = b ? b->xyz.p[other.it.idx] : other.xyz;
-
-    return a_xyz == b_xyz;
-  }
-
-// ----
-
-  inline bool ProxyIterator::operator==(const ProxyIterator& other) const {
-    return idx == other.idx && cloud == other.cloud;
-  }
-
-  inline bool ProxyIterator::operator!=(const ProxyIterator& other) const {
-    return !(*this == other);
-  }
-
-  inline ProxyIterator::value_type ProxyIterator::operator*() const {
-    return Proxy(*this);
-  }
-
-  inline ProxyIterator& ProxyIterator::operator++() {
-    idx++;
-    return *this;
-  }
-
-  inline ProxyIterator ProxyIterator::operator++(int) {
-    ProxyIterator it(*this);
-    idx++;
-    return it;
-  }
-
-  inline ProxyIterator& ProxyIterator::operator--() {
-    idx--;
-    return *this;
-  }
-
-  inline ProxyIterator ProxyIterator::operator--(int) {
-    ProxyIterator it(*this);
-    idx--;
-    return it;
-  }
-
-  inline ProxyIterator& ProxyIterator::operator+=(ProxyIterator::difference_type m) {
-    idx += m;
-    return *this;
-  }
-
-  inline ProxyIterator ProxyIterator::operator+(ProxyIterator::difference_type m) const {
-    ProxyIterator it(*this);
-    it += m;
-    return it;
-  }
+    int load( string inFile, bool normalsOnly = false, int dropDuplicates = 0, int neighborsProc = 0,
+              int attributes = Attributes::ALL ) ;
+    int loadRecords( const unsigned char *data, long int nbRecords, bool normalsOnly = false, int dropDuplicates = 0,
+                     int neighborsProc = 0, int attributes = Attributes::ALL );
+    int loadMemory( const unsigned char *data, size_t dataSize, bool normalsOnly = false, int dropDuplicates = 0,
+                    int neighborsProc = 0, int attributes = Attributes::ALL );
+    int loadVectors( vector<PointXYZSet::point_type> &&points, vector<RGBSet::value_type> &&colors,
+                     vector<NormalSet::value_type> &&normals, vector<LidarSet::value_type> &&reflectances,
+                     int dropDuplicates = 0, int neighborsProc = 0 );
+
+    void buildKdtree();            //! kd-tree over xyz, built once on first use (thread safe)
+    const PointVoxelGrid& voxelGrid(); //! voxel grid over xyz, if bVoxelized, built once on first use (thread safe)
+    bool hasKdtree() const;        //! whether the kd-tree is built (or loaded)
+    int saveKdtree( FILE *stream ) const; //! write the kd-tree, if built, without the points
+    int loadKdtree( FILE *stream );       //! read the kd-tree written by saveKdtree() for the same points, instead of building it
+
+    //! my_kd_tree_t::queryTies(), in the voxel grid if bGrid (same results, the grid search is always exact)
+    size_t queryTies( const float *query, size_t capacity, distance_type eps,
+                      index_type *indices, distance_type *sqrDist, bool bGrid,
+                      const nanoflann::SearchParams &params = nanoflann::SearchParams() );
+    //! my_kd_tree_t::query(), the num_closest nearest points in the kd-tree
+    void queryKnn( const float *query, size_t num_closest, index_type *indices, distance_type *sqrDist );
+    //! my_kd_tree_t::index->findNeighbors(), with any result set, in the kd-tree
+    template <typename ResultSet>
+    void findNeighbors( ResultSet &result, const float *query, const nanoflann::SearchParams &params )
+    {
+      buildKdtree();
+      if (kdtreeIndex16)
+        kdtreeIndex16->index->findNeighbors( result, query, params );
+      else if (kdtreeIndex32)
+        kdtreeIndex32->index->findNeighbors( result, query, params );
+      else
+        kdtreeIndex->index->findNeighbors( result, query, params );
+    }
 
-  inline ProxyIterator& ProxyIterator::operator-=(ProxyIterator::difference_type m) {
-    return *this += -m;
-  }
+  private:
+    std::unique_ptr<my_kd_tree_t> kdtreeIndex;   //! one of the three, over the column of xyz.storage
+    std::unique_ptr<my_kd_tree16_t> kdtreeIndex16;
+    std::unique_ptr<my_kd_tree32_t> kdtreeIndex32;
+    std::once_flag kdtreeOnce;
+    std::unique_ptr<PointVoxelGrid> voxelGridIndex;
+    std::once_flag voxelGridOnce;
+  };
 
-  inline ProxyIterator ProxyIterator::operator-(ProxyIterator::difference_type m) const {
-    return *this + (-m);
-  }
+  /**!
+   * \brief
+   *  Read-only view of a whole file: memory-mapped, or read into memory
+   *  where mmap is not available
+   */
+  class MappedFile
+  {
+  public:
+    const unsigned char *data;
+    size_t size;
 
-  inline ProxyIterator::difference_type ProxyIterator::operator-(const ProxyIterator& other) const {
-    return ptrdiff_t(idx - other.idx);
-  }
+    MappedFile() : data(nullptr), size(0) {}
+    ~MappedFile();
+    int open( const string &fileName );
 
-  inline ProxyIterator::value_type ProxyIterator::operator[](size_t idx) const {
-    return Proxy(*this);
-  }
+  private:
+#ifdef _WIN32
+    std::vector<unsigned char> buffer;
+#endif
+  };
 
-  inline bool ProxyIterator::operator<(const ProxyIterator& other) const {
-    return idx < other.idx;
-  }
+  void prefetchFile( const string &inFile );
 
-  inline bool ProxyIterator::operator>(const ProxyIterator& other) const {
-    return idx > other.idx;
-  }
+  /**!
+   * \brief
+   *  Stable LSD radix sort of records on a key of nbWords words of wordBits
+   *  bits, with 8 bits digits. wordOf( rec, w ) returns the word w of the key
+   *  of a record, word 0 being the least significant. Every pass counts the
+   *  digits of contiguous blocks in parallel, then scatters the blocks in
+   *  parallel. Digits shared by all the records are skipped.
+   */
+  template <typename Record, typename WordOf>
+  void radixSort( std::vector<Record> &rec, int nbWords, int wordBits, WordOf wordOf )
+  {
+    const size_t n = rec.size();
+    const size_t nbBlocks = std::min<size_t>( 64, n / 65536 + 1 );
+
+    // bits that differ between the records, per word
+    std::vector<uint64_t> keyDiff( nbWords );
+    for (int w = 0; w < nbWords; w++)
+    {
+      uint64_t a = ~0ull, o = 0;
+#pragma omp parallel for reduction(&:a) reduction(|:o)
+      for (long int i = 0; i < (long int) n; i++)
+      {
+        a &= wordOf( rec[i], w );
+        o |= wordOf( rec[i], w );
+      }
+      keyDiff[w] = a ^ o;
+    }
 
-  inline bool ProxyIterator::operator<=(const ProxyIterator& other) const {
-    return !(*this > other);
+    std::vector<Record> tmp( n );
+    std::vector<size_t> offsets( nbBlocks * 256 );
+    for (int w = 0; w < nbWords; w++)
+    {
+      for (int shift = 0; shift < wordBits; shift += 8)
+      {
+        if ( ((keyDiff[w] >> shift) & 0xff) == 0 )
+          continue;
+
+#pragma omp parallel for schedule(static)
+        for (long int b = 0; b < (long int) nbBlocks; b++)
+        {
+          size_t *count = &offsets[b * 256];
+          std::fill( count, count + 256, 0 );
+          for (size_t i = n * b / nbBlocks; i < n * (b + 1) / nbBlocks; i++)
+            count[(wordOf( rec[i], w ) >> shift) & 0xff]++;
+        }
+
+        size_t sum = 0;
+        for (size_t d = 0; d < 256; d++)
+          for (size_t b = 0; b < nbBlocks; b++)
+          {
+            const size_t count = offsets[b * 256 + d];
+            offsets[b * 256 + d] = sum;
+            sum += count;
+          }
+
+#pragma omp parallel for schedule(static)
+        for (long int b = 0; b < (long int) nbBlocks; b++)
+        {
+          size_t *pos = &offsets[b * 256];
+          for (size_t i = n * b / nbBlocks; i < n * (b + 1) / nbBlocks; i++)
+            tmp[pos[(wordOf( rec[i], w ) >> shift) & 0xff]++] = rec[i];
+        }
+        rec.swap( tmp );
+      }
+    }
   }
 
-  inline bool ProxyIterator::operator>=(const ProxyIterator& other) const {
-    return !(*this < other);
-  }
 };
 
 #endif
@@ -0,0 +1,111 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "pcc_quantile.hpp"
+
+using namespace std;
+using namespace pcc_quality;
+
+/*
+ ***********************************************
+   Implementation of exposed functions and classes
+ ***********************************************
+ */
+
+const double pcc_quality::quantileLevels[PCC_QUANTILE_NUM] = { 0.5, 0.9, 0.99, 0.999 };
+const char *const pcc_quality::quantileNames[PCC_QUANTILE_NUM] = { "p50", "p90", "p99", "p99.9" };
+
+const int64_t QuantileSketch::firstBucket;
+const int64_t QuantileSketch::nbBuckets;
+
+void
+QuantileSketch::merge( const QuantileSketch &other )
+{
+  zeros += other.zeros;
+  if (other.counts.empty())
+    return;
+  if (counts.empty())
+    counts.resize( nbBuckets );
+  for (size_t b = 0; b < counts.size(); b++)
+    counts[b] += other.counts[b];
+}
+
+uint64_t
+QuantileSketch::count() const
+{
+  uint64_t total = zeros;
+  for (uint64_t c : counts)
+    total += c;
+  return total;
+}
+
+double
+QuantileSketch::quantile( double q ) const
+{
+  const uint64_t total = count();
+  if (total == 0)
+    return 0.0;
+
+  // Nearest rank, in [1, total]. The product is rounded down within 1e-12
+  // of an integer (e.g. 0.9 * 10)
+  const double r = q * double( total );
+  uint64_t rank = uint64_t( max( 0.0, ceil( r - r * 1e-12 ) ) );
+  rank = min( max( rank, uint64_t( 1 ) ), total );
+
+  uint64_t cumul = zeros;
+  if (rank <= cumul)
+    return 0.0;
+  size_t b = 0;
+  for (; b + 1 < counts.size(); b++)
+  {
+    cumul += counts[b];
+    if (cumul >= rank)
+      break;
+  }
+  const uint32_t bits = uint32_t( int64_t( b ) + firstBucket ) << (23 - QUANTILE_MANTISSA_BITS);
+  float lower;
+  memcpy( &lower, &bits, sizeof(lower) );
+  return lower;
+}
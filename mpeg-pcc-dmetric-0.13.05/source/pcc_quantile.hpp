@@ -0,0 +1,118 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PCC_QUANTILE_HPP
+#define PCC_QUANTILE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Quantiles of the point errors reported by pc_error (see qMetric)
+#define PCC_QUANTILE_NUM 4
+
+// Leading mantissa bits of the buckets of QuantileSketch: relative width of
+// 2^-7 (0.8%)
+#define QUANTILE_MANTISSA_BITS 7
+
+// Range of the exponents of the buckets of QuantileSketch: the values out of
+// [2^-64, 2^64) are counted in the first or last bucket
+#define QUANTILE_MIN_EXPONENT -64
+#define QUANTILE_MAX_EXPONENT 64
+
+namespace pcc_quality {
+
+  //! Levels of the quantiles of qMetric, and their names
+  extern const double quantileLevels[PCC_QUANTILE_NUM];
+  extern const char *const quantileNames[PCC_QUANTILE_NUM];
+
+  /**!
+   * \brief
+   *  Streaming quantile sketch of non negative values: the counts of the
+   *  values in logarithmic buckets, taken from the exponent and the leading
+   *  mantissa bits of their float representation. The memory is bounded
+   *  (128 KB once a positive value is added), add() is a few instructions
+   *  and merging adds the counts, so that the quantiles depend neither on
+   *  the order of the values nor on the number of threads.
+   *
+   *  A quantile is the lower bound of the bucket of the value of this rank:
+   *  less than 0.8% below it, exact for the integers below 256 and for 0.
+   *  The values that are not positive (e.g. nan) are counted as 0.
+   */
+  class QuantileSketch
+  {
+  public:
+    QuantileSketch() : zeros( 0 ) {}
+
+    void add( double value )
+    {
+      const float v = float( value );
+      if (!(v > 0))
+      {
+        zeros++;
+        return;
+      }
+      if (counts.empty())
+        counts.resize( nbBuckets );
+      uint32_t bits;
+      memcpy( &bits, &v, sizeof(bits) );
+      const int64_t bucket = int64_t( bits >> (23 - QUANTILE_MANTISSA_BITS) ) - firstBucket;
+      counts[bucket < 0 ? 0 : (bucket >= nbBuckets ? nbBuckets - 1 : bucket)]++;
+    }
+
+    void merge( const QuantileSketch &other );
+    uint64_t count() const;
+
+    //! Smallest value with at least q * count() values below or equal, 0 if empty
+    double quantile( double q ) const;
+
+  private:
+    static const int64_t firstBucket = int64_t( 127 + QUANTILE_MIN_EXPONENT ) << QUANTILE_MANTISSA_BITS;
+    static const int64_t nbBuckets = int64_t( QUANTILE_MAX_EXPONENT - QUANTILE_MIN_EXPONENT ) << QUANTILE_MANTISSA_BITS;
+
+    uint64_t zeros;                //! number of values counted as 0
+    std::vector<uint64_t> counts;  //! number of values of every bucket, empty if none
+  };
+
+};
+
+#endif
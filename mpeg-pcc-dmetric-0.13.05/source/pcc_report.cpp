@@ -0,0 +1,393 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "pcc_report.hpp"
+
+using namespace std;
+using namespace pcc_quality;
+
+/*
+ ***********************************************
+   Implementation of local functions
+ ***********************************************
+ */
+
+struct reportField
+{
+  string name;
+  float value;
+  bool bValid;                  //! computed, for the parameters used
+};
+
+/**!
+ * \brief
+ *  Flat list of the fields of a metric. The fields are always listed, so
+ *  that the csv columns do not depend on the parameters; the ones not
+ *  computed are marked invalid.
+ */
+static vector<reportField>
+getFields( const qMetric &m, const commandPar &cPar )
+{
+  const bool bC2p = !cPar.c2c_only;
+  const bool bH = cPar.hausdorff;
+  const bool bMse = !cPar.hausdorffOnly;
+  vector<reportField> fields = {
+    { "c2c_mse",            m.c2c_mse,            bMse },
+    { "c2c_psnr",           m.c2c_psnr,           bMse },
+    { "c2c_hausdorff",      m.c2c_hausdorff,      bH },
+    { "c2c_hausdorff_psnr", m.c2c_hausdorff_psnr, bH },
+    { "c2p_mse",            m.c2p_mse,            bC2p },
+    { "c2p_psnr",           m.c2p_psnr,           bC2p },
+    { "c2p_hausdorff",      m.c2p_hausdorff,      bC2p && bH },
+    { "c2p_hausdorff_psnr", m.c2p_hausdorff_psnr, bC2p && bH } };
+  for (int c = 0; c < 3; c++)
+  {
+    const string i = to_string( c );
+    fields.push_back( { "color_mse_" + i,                m.color_mse[c],                cPar.bColor } );
+    fields.push_back( { "color_psnr_" + i,               m.color_psnr[c],               cPar.bColor } );
+    fields.push_back( { "color_rgb_hausdorff_" + i,      m.color_rgb_hausdorff[c],      cPar.bColor && bH } );
+    fields.push_back( { "color_rgb_hausdorff_psnr_" + i, m.color_rgb_hausdorff_psnr[c], cPar.bColor && bH } );
+  }
+  fields.push_back( { "reflectance_mse",            m.reflectance_mse,            cPar.bLidar } );
+  fields.push_back( { "reflectance_psnr",           m.reflectance_psnr,           cPar.bLidar } );
+  fields.push_back( { "reflectance_hausdorff",      m.reflectance_hausdorff,      cPar.bLidar && bH } );
+  fields.push_back( { "reflectance_hausdorff_psnr", m.reflectance_hausdorff_psnr, cPar.bLidar && bH } );
+
+  // Quantiles, e.g. "c2c_p99.9"
+  const bool bQ = bMse && cPar.bQuantiles;
+  for (int q = 0; q < PCC_QUANTILE_NUM; q++)
+  {
+    const string name = string( "_" ) + quantileNames[q];
+    fields.push_back( { "c2c" + name, m.c2c_quantile[q], bQ } );
+    fields.push_back( { "c2p" + name, m.c2p_quantile[q], bQ && bC2p } );
+    for (int c = 0; c < 3; c++)
+      fields.push_back( { "color_" + to_string( c ) + name, m.color_quantile[c][q], bQ && cPar.bColor } );
+    fields.push_back( { "reflectance" + name, m.reflectance_quantile[q], bQ && cPar.bLidar } );
+  }
+
+  // Biases of the approximate search
+  const bool bB = bMse && (cPar.approxEps > 0 || cPar.approxLeaves > 0);
+  fields.push_back( { "c2c_mse_bias",    m.c2c_mse_bias,    bB } );
+  fields.push_back( { "c2c_mse_bias_ci", m.c2c_mse_bias_ci, bB } );
+  fields.push_back( { "c2c_psnr_bias",   m.c2c_psnr_bias,   bB } );
+  fields.push_back( { "c2p_mse_bias",    m.c2p_mse_bias,    bB && bC2p } );
+  fields.push_back( { "c2p_mse_bias_ci", m.c2p_mse_bias_ci, bB && bC2p } );
+  fields.push_back( { "c2p_psnr_bias",   m.c2p_psnr_bias,   bB && bC2p } );
+  for (int c = 0; c < 3; c++)
+  {
+    const string i = to_string( c );
+    fields.push_back( { "color_mse_bias_" + i,    m.color_mse_bias[c],    bB && cPar.bColor } );
+    fields.push_back( { "color_mse_bias_ci_" + i, m.color_mse_bias_ci[c], bB && cPar.bColor } );
+    fields.push_back( { "color_psnr_bias_" + i,   m.color_psnr_bias[c],   bB && cPar.bColor } );
+  }
+  fields.push_back( { "reflectance_mse_bias",    m.reflectance_mse_bias,    bB && cPar.bLidar } );
+  fields.push_back( { "reflectance_mse_bias_ci", m.reflectance_mse_bias_ci, bB && cPar.bLidar } );
+  fields.push_back( { "reflectance_psnr_bias",   m.reflectance_psnr_bias,   bB && cPar.bLidar } );
+  return fields;
+}
+
+// The values of a metric, as listed by getFields()
+static vector<float*>
+getValues( qMetric &m )
+{
+  vector<float*> values = { &m.c2c_mse, &m.c2c_psnr, &m.c2c_hausdorff, &m.c2c_hausdorff_psnr,
+                            &m.c2p_mse, &m.c2p_psnr, &m.c2p_hausdorff, &m.c2p_hausdorff_psnr };
+  for (int c = 0; c < 3; c++)
+  {
+    values.push_back( &m.color_mse[c] );
+    values.push_back( &m.color_psnr[c] );
+    values.push_back( &m.color_rgb_hausdorff[c] );
+    values.push_back( &m.color_rgb_hausdorff_psnr[c] );
+  }
+  values.push_back( &m.reflectance_mse );
+  values.push_back( &m.reflectance_psnr );
+  values.push_back( &m.reflectance_hausdorff );
+  values.push_back( &m.reflectance_hausdorff_psnr );
+  for (int q = 0; q < PCC_QUANTILE_NUM; q++)
+  {
+    values.push_back( &m.c2c_quantile[q] );
+    values.push_back( &m.c2p_quantile[q] );
+    for (int c = 0; c < 3; c++)
+      values.push_back( &m.color_quantile[c][q] );
+    values.push_back( &m.reflectance_quantile[q] );
+  }
+  values.push_back( &m.c2c_mse_bias );
+  values.push_back( &m.c2c_mse_bias_ci );
+  values.push_back( &m.c2c_psnr_bias );
+  values.push_back( &m.c2p_mse_bias );
+  values.push_back( &m.c2p_mse_bias_ci );
+  values.push_back( &m.c2p_psnr_bias );
+  for (int c = 0; c < 3; c++)
+  {
+    values.push_back( &m.color_mse_bias[c] );
+    values.push_back( &m.color_mse_bias_ci[c] );
+    values.push_back( &m.color_psnr_bias[c] );
+  }
+  values.push_back( &m.reflectance_mse_bias );
+  values.push_back( &m.reflectance_mse_bias_ci );
+  values.push_back( &m.reflectance_psnr_bias );
+  return values;
+}
+
+// Mean of a metric over the reports
+static void
+averageMetric( const vector<qReport> &reports, qMetric qReport::*metric, qMetric &average )
+{
+  vector<float*> values = getValues( average );
+  vector<double> sums( values.size(), 0.0 );
+  for (const auto &report : reports)
+  {
+    qMetric m = report.*metric;
+    const vector<float*> frameValues = getValues( m );
+    for (size_t i = 0; i < values.size(); i++)
+      sums[i] += *frameValues[i];
+  }
+  for (size_t i = 0; i < values.size(); i++)
+    *values[i] = float( sums[i] / reports.size() );
+}
+
+// Name and metric of the passes of a report, null if not computed
+static vector<pair<string, const qMetric*>>
+getPasses( const qReport &report )
+{
+  const bool bBoth = report.cPar.file2 != "" && !report.cPar.singlePass;
+  return {
+    { "A2B",       report.cPar.file2 != "" ? &report.metricA : nullptr },
+    { "B2A",       bBoth ? &report.metricB : nullptr },
+    { "symmetric", bBoth ? &report.metricF : nullptr } };
+}
+
+static string
+jsonString( const string &str )
+{
+  ostringstream out;
+  out << '"';
+  for (unsigned char c : str)
+  {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (c < 0x20)
+      out << "\\u" << hex << setw(4) << setfill('0') << (int) c << dec;
+    else
+      out << c;
+  }
+  out << '"';
+  return out.str();
+}
+
+// json has no inf/nan: written as null
+static string
+jsonNumber( double value )
+{
+  if (!std::isfinite( value ))
+    return "null";
+  ostringstream out;
+  out << setprecision( numeric_limits<double>::max_digits10 ) << value;
+  return out.str();
+}
+
+static string
+csvString( const string &str )
+{
+  if (str.find_first_of( ",\"\n" ) == string::npos)
+    return str;
+  string quoted = "\"";
+  for (char c : str)
+    quoted += (c == '"') ? string( "\"\"" ) : string( 1, c );
+  return quoted + "\"";
+}
+
+static void
+writeJson( ostream &out, const vector<qReport> &reports )
+{
+  out << "{\n  \"version\": " << jsonString( PCC_QUALITY_VERSION ) << ",\n  \"results\": [";
+  for (size_t r = 0; r < reports.size(); r++)
+  {
+    const qReport &report = reports[r];
+    out << (r ? "," : "") << "\n    {\n";
+    out << "      \"fileA\": " << jsonString( report.cPar.file1 ) << ",\n";
+    out << "      \"fileB\": " << jsonString( report.cPar.file2 ) << ",\n";
+    out << "      \"inputNorm\": " << jsonString( report.cPar.normIn ) << ",\n";
+    out << "      \"pPSNR\": " << jsonNumber( report.pPSNR ) << ",\n";
+    for (const auto &pass : getPasses( report ))
+    {
+      out << "      " << jsonString( pass.first ) << ": ";
+      if (!pass.second)
+      {
+        out << "null,\n";
+        continue;
+      }
+      out << "{";
+      bool bFirst = true;
+      for (const auto &field : getFields( *pass.second, report.cPar ))
+      {
+        out << (bFirst ? "" : ",") << "\n        " << jsonString( field.name ) << ": "
+            << (field.bValid ? jsonNumber( field.value ) : "null");
+        bFirst = false;
+      }
+      out << "\n      },\n";
+    }
+    out << "      \"timings\": {";
+    for (size_t i = 0; i < report.timings.size(); i++)
+      out << (i ? "," : "") << "\n        " << jsonString( report.timings[i].first ) << ": "
+          << jsonNumber( report.timings[i].second );
+    out << "\n      }\n    }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+static void
+writeCsv( ostream &out, const vector<qReport> &reports )
+{
+  // Timing columns: all the phases of all the reports, in order of appearance
+  vector<string> phases;
+  for (const auto &report : reports)
+    for (const auto &timing : report.timings)
+      if (find( phases.begin(), phases.end(), timing.first ) == phases.end())
+        phases.push_back( timing.first );
+
+  const commandPar noPar;
+  out << "fileA,fileB,inputNorm,pPSNR";
+  for (const auto &pass : getPasses( qReport() ))
+    for (const auto &field : getFields( qMetric(), noPar ))
+      out << "," << pass.first << "_" << field.name;
+  for (const auto &phase : phases)
+    out << ",time_" << phase;
+  out << "\n";
+
+  out << setprecision( numeric_limits<double>::max_digits10 );
+  for (const auto &report : reports)
+  {
+    out << csvString( report.cPar.file1 ) << "," << csvString( report.cPar.file2 ) << ","
+        << csvString( report.cPar.normIn ) << "," << report.pPSNR;
+    for (const auto &pass : getPasses( report ))
+    {
+      const vector<reportField> fields = getFields( pass.second ? *pass.second : qMetric(), report.cPar );
+      for (const auto &field : fields)
+      {
+        out << ",";
+        if (pass.second && field.bValid)
+          out << field.value;
+      }
+    }
+    for (const auto &phase : phases)
+    {
+      out << ",";
+      for (const auto &timing : report.timings)
+        if (timing.first == phase)
+          out << timing.second;
+    }
+    out << "\n";
+  }
+}
+
+/*
+ ***********************************************
+   Implementation of exposed functions and classes
+ ***********************************************
+ */
+
+void
+qReport::addTiming( const string &phase, double seconds )
+{
+  for (auto &timing : timings)
+  {
+    if (timing.first == phase)
+    {
+      timing.second += seconds;
+      return;
+    }
+  }
+  timings.push_back( make_pair( phase, seconds ) );
+}
+
+qReport
+pcc_quality::averageReports( const vector<qReport> &reports )
+{
+  qReport average;
+  if (reports.empty())
+    return average;
+  average.cPar = reports[0].cPar;
+  averageMetric( reports, &qReport::metricA, average.metricA );
+  averageMetric( reports, &qReport::metricB, average.metricB );
+  averageMetric( reports, &qReport::metricF, average.metricF );
+
+  double pPSNR = 0;
+  for (const auto &report : reports)
+  {
+    pPSNR += report.pPSNR;
+    for (const auto &timing : report.timings)
+      average.addTiming( timing.first, timing.second / reports.size() );
+  }
+  average.pPSNR = float( pPSNR / reports.size() );
+  average.metricA.pPSNR = average.metricB.pPSNR = average.metricF.pPSNR = average.pPSNR;
+  return average;
+}
+
+int
+pcc_quality::writeReports( const string &fileName, const string &format, const vector<qReport> &reports )
+{
+  if (format != "json" && format != "csv")
+  {
+    cout << "Unknown result format: " << format << endl;
+    return -1;
+  }
+  ofstream out( fileName );
+  if (!out)
+  {
+    cout << "Error writing the results: " << fileName << endl;
+    return -1;
+  }
+  if (format == "json")
+    writeJson( out, reports );
+  else
+    writeCsv( out, reports );
+  return out.good() ? 0 : -1;
+}
@@ -0,0 +1,92 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PCC_REPORT_HPP
+#define PCC_REPORT_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pcc_distortion.hpp"
+
+namespace pcc_quality {
+
+  /**!
+   * \brief
+   *  All the metrics computed for one pair of point clouds, with the wall
+   *  clock time of every processing phase, for machine-readable output
+   */
+  class qReport {
+
+  public:
+    qMetric metricA;          //! A->B
+    qMetric metricB;          //! B->A, unless singlePass
+    qMetric metricF;          //! symmetric, unless singlePass
+    commandPar cPar;          //! parameters, as used to compute the metrics
+    float pPSNR;              //! peak value for PSNR computation
+
+    //! (phase, seconds) in processing order
+    std::vector<std::pair<std::string, double>> timings;
+
+    qReport() : pPSNR( 0 ) {}
+    void addTiming( const std::string &phase, double seconds );
+  };
+
+  /**!
+   * \brief
+   *  Write the reports to a file, as "json" or "csv" (one row per report).
+   *  Returns 0 if succeed, non-zero otherwise
+   */
+  int writeReports( const std::string &fileName, const std::string &format, const std::vector<qReport> &reports );
+
+  /**!
+   * \brief
+   *  Average of the reports of the frames of a sequence: every metric, the
+   *  peak value and the time of every phase are the means over the frames.
+   *  The parameters are the ones of the first report
+   */
+  qReport averageReports( const std::vector<qReport> &reports );
+
+};
+
+#endif
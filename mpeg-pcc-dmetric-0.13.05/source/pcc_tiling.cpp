@@ -0,0 +1,340 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "pcc_tiling.hpp"
+
+#if _WIN32
+#define fseeko _fseeki64
+#endif
+
+using namespace std;
+using namespace pcc_processing;
+
+// Number of records read at once when scanning a file
+#define TILE_CHUNK_RECORDS 65536
+
+// Maximum size of the header section of a file
+#define TILE_MAX_HEADER (1 << 20)
+
+// Size of the write buffer of every bucket, the size of the segments of the
+// temporary file
+#define TILE_SEGMENT_BYTES (1 << 16)
+
+/*
+ ***********************************************
+   Implementation of local functions
+ ***********************************************
+ */
+
+/**!
+ * \brief
+ *  Value of a coordinate field of a record, as PointXYZSet::loadBlock()
+ *  converts it
+ */
+static inline float
+recordCoord( const unsigned char *src, int type )
+{
+  switch (type)
+  {
+  case PccPointCloud::PointFieldTypes::FLOAT32: { float v;    memcpy( &v, src, sizeof(v) ); return float( double( v ) ); }
+  case PccPointCloud::PointFieldTypes::FLOAT64: { double v;   memcpy( &v, src, sizeof(v) ); return float( v ); }
+  case PccPointCloud::PointFieldTypes::INT32:   { int32_t v;  memcpy( &v, src, sizeof(v) ); return float( double( v ) ); }
+  case PccPointCloud::PointFieldTypes::UINT32:  { uint32_t v; memcpy( &v, src, sizeof(v) ); return float( double( v ) ); }
+  }
+  return 0;
+}
+
+/**!
+ * \brief
+ *  New temporary file in "dir", or in the system temporary directory,
+ *  removed when closed
+ */
+static FILE *
+temporaryFile( const string &dir )
+{
+#ifndef _WIN32
+  const char *tmpDir = getenv( "TMPDIR" );
+  string path = (dir != "" ? dir : (tmpDir ? string( tmpDir ) : string( "/tmp" ))) + "/pc_error_XXXXXX";
+  vector<char> name( path.begin(), path.end() );
+  name.push_back( 0 );
+  const int fd = mkstemp( name.data() );
+  if (fd < 0)
+    return nullptr;
+  unlink( name.data() );
+  return fdopen( fd, "w+b" );
+#else
+  return tmpfile();
+#endif
+}
+
+/*
+ ***********************************************
+   Implementation of exposed functions and classes
+ ***********************************************
+ */
+
+/**!
+ * **************************************
+ *  Class PccTiledFile
+ * **************************************
+ */
+
+PccTiledFile::PccTiledFile()
+{
+  xField = -1;
+  spill = nullptr;
+}
+
+PccTiledFile::~PccTiledFile()
+{
+  if (spill)
+    fclose( spill );
+}
+
+int
+PccTiledFile::open( const string &inFile )
+{
+  fileName = inFile;
+  FILE *f = fopen( inFile.c_str(), "rb" );
+  if (!f)
+  {
+    cout << "Could not read the file: " << inFile << endl;
+    return -1;
+  }
+  header.resize( TILE_MAX_HEADER );
+  header.resize( fread( header.data(), 1, header.size(), f ) );
+  fclose( f );
+
+  if (schema.checkFile( header.data(), header.size() ) != 0)
+    return -1;
+  if (schema.fileFormat != 1)
+  {
+    cout << "Error: the evaluation by tiles needs binary_little_endian files: " << inFile << endl;
+    return -1;
+  }
+  header.resize( schema.dataPos );
+  xField = schema.checkField( "x", { PccPointCloud::PointFieldTypes::FLOAT32, PccPointCloud::PointFieldTypes::FLOAT64,
+                                     PccPointCloud::PointFieldTypes::INT32, PccPointCloud::PointFieldTypes::UINT32 } );
+  if (xField < 0)
+    return -1;
+  return 0;
+}
+
+bool
+PccTiledFile::hasNormals()
+{
+  const std::initializer_list<int> coordTypes = { PccPointCloud::PointFieldTypes::FLOAT32, PccPointCloud::PointFieldTypes::FLOAT64,
+                                                   PccPointCloud::PointFieldTypes::INT32, PccPointCloud::PointFieldTypes::UINT32 };
+  return schema.checkField( "nx", coordTypes ) >= 0 && schema.checkField( "ny", coordTypes ) >= 0 &&
+         schema.checkField( "nz", coordTypes ) >= 0;
+}
+
+/**!
+ * \brief
+ *  Read the vertex records by chunks, calling body(records, count) for
+ *  every chunk
+ */
+template <typename Body>
+int
+PccTiledFile::forEachChunk( const Body &body )
+{
+  FILE *f = fopen( fileName.c_str(), "rb" );
+  if (!f || fseek( f, long( schema.dataPos ), SEEK_SET ) != 0)
+  {
+    if (f)
+      fclose( f );
+    cout << "Could not read the file: " << fileName << endl;
+    return -1;
+  }
+  vector<unsigned char> records( (size_t) TILE_CHUNK_RECORDS * schema.fieldSize );
+  for (long int first = 0; first < schema.size; first += TILE_CHUNK_RECORDS)
+  {
+    const long int count = min<long int>( TILE_CHUNK_RECORDS, schema.size - first );
+    if (fread( records.data(), schema.fieldSize, count, f ) != (size_t) count)
+    {
+      fclose( f );
+      cout << "Error: the file is shorter than the vertex data declared in its header: " << fileName << endl;
+      return -1;
+    }
+    body( records.data(), count );
+  }
+  fclose( f );
+  return 0;
+}
+
+int
+PccTiledFile::rangeX( float &xMin, float &xMax )
+{
+  const int pos = schema.fieldPos[xField];
+  const int type = schema.fieldType[xField];
+  const int recordSize = schema.fieldSize;
+  return forEachChunk( [&]( const unsigned char *records, long int count )
+  {
+    for (long int i = 0; i < count; i++)
+    {
+      const float x = recordCoord( records + (size_t) i * recordSize + pos, type );
+      xMin = min( xMin, x );
+      xMax = max( xMax, x );
+    }
+  } );
+}
+
+size_t
+PccTiledFile::binOf( float x, float xMin, float xMax, size_t nbBins )
+{
+  const double t = (double( x ) - xMin) / (double( xMax ) - xMin) * nbBins;
+  if (!(t > 0))
+    return 0;
+  return min( nbBins - 1, size_t( t ) );
+}
+
+int
+PccTiledFile::histogramX( float xMin, float xMax, vector<long int> &counts )
+{
+  const int pos = schema.fieldPos[xField];
+  const int type = schema.fieldType[xField];
+  const int recordSize = schema.fieldSize;
+  return forEachChunk( [&]( const unsigned char *records, long int count )
+  {
+    for (long int i = 0; i < count; i++)
+      counts[binOf( recordCoord( records + (size_t) i * recordSize + pos, type ), xMin, xMax, counts.size() )]++;
+  } );
+}
+
+int
+PccTiledFile::partition( float xMin, float xMax, const vector<uint32_t> &binBucket, const string &dir )
+{
+  const size_t nbBuckets = binBucket.back() + 1;
+  bucketCounts.assign( nbBuckets, 0 );
+  bucketSegments.assign( nbBuckets, vector< pair<uint64_t, long int> >() );
+  if (spill)
+    fclose( spill );
+  spill = temporaryFile( dir );
+  if (!spill)
+  {
+    cout << "Error: could not create a temporary file in: " << (dir != "" ? dir : "the temporary directory") << endl;
+    return -1;
+  }
+
+  // The records of every bucket are buffered, then appended to the file as
+  // a segment of the bucket, in the order of the records
+  const int pos = schema.fieldPos[xField];
+  const int type = schema.fieldType[xField];
+  const int recordSize = schema.fieldSize;
+  const long int segmentRecords = max<long int>( 1, TILE_SEGMENT_BYTES / recordSize );
+  vector< vector<unsigned char> > buffers( nbBuckets );
+  uint64_t spillSize = 0;
+  bool bWritten = true;
+  auto flushBucket = [&]( size_t b )
+  {
+    const size_t bytes = buffers[b].size();
+    if (bytes == 0)
+      return;
+    bWritten = bWritten && fwrite( buffers[b].data(), 1, bytes, spill ) == bytes;
+    bucketSegments[b].push_back( make_pair( spillSize, (long int) (bytes / recordSize) ) );
+    spillSize += bytes;
+    buffers[b].clear();
+  };
+  int ret = forEachChunk( [&]( const unsigned char *records, long int count )
+  {
+    for (long int i = 0; i < count; i++)
+    {
+      const unsigned char *rec = records + (size_t) i * recordSize;
+      const uint32_t b = binBucket[binOf( recordCoord( rec + pos, type ), xMin, xMax, binBucket.size() )];
+      if (buffers[b].empty())
+        buffers[b].reserve( (size_t) segmentRecords * recordSize );
+      buffers[b].insert( buffers[b].end(), rec, rec + recordSize );
+      bucketCounts[b]++;
+      if (buffers[b].size() == (size_t) segmentRecords * recordSize)
+        flushBucket( b );
+    }
+  } );
+  for (size_t b = 0; b < nbBuckets; b++)
+  {
+    flushBucket( b );
+    vector<unsigned char>().swap( buffers[b] );
+  }
+  bWritten = bWritten && fflush( spill ) == 0;
+  if (ret == 0 && !bWritten)
+  {
+    cout << "Error: could not write the temporary files of: " << fileName << endl;
+    ret = -1;
+  }
+  return ret;
+}
+
+int
+PccTiledFile::loadBuckets( size_t first, size_t last, PccPointCloud &cloud, bool normalsOnly,
+                           int dropDuplicates, int neighborsProc, int attributes ) const
+{
+  long int nbRecords = 0;
+  for (size_t b = first; b < last; b++)
+    nbRecords += bucketCounts[b];
+
+  vector<unsigned char> records( (size_t) nbRecords * schema.fieldSize );
+  size_t offset = 0;
+  for (size_t b = first; b < last; b++)
+    for (const auto &segment : bucketSegments[b])
+    {
+      const size_t bytes = (size_t) segment.second * schema.fieldSize;
+      if (fseeko( spill, segment.first, SEEK_SET ) != 0 ||
+          fread( records.data() + offset, 1, bytes, spill ) != bytes)
+      {
+        cout << "Error: could not read the temporary files of: " << fileName << endl;
+        return -1;
+      }
+      offset += bytes;
+    }
+
+  cloud.bVerbose = false;
+  if (cloud.checkFile( header.data(), header.size() ) != 0)
+    return -1;
+  return cloud.loadRecords( records.data(), nbRecords, normalsOnly, dropDuplicates, neighborsProc, attributes );
+}
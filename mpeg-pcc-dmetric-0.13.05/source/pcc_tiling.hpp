@@ -0,0 +1,111 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef PCC_TILING_HPP
+#define PCC_TILING_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "pcc_processing.hpp"
+
+namespace pcc_processing {
+
+  /**!
+   * \brief
+   *  Vertex records of a binary ply file, partitioned along x into buckets
+   *  of consecutive bins, all held in a single temporary file: every bucket
+   *  is a list of segments of the file. Any range of buckets can then be
+   *  loaded as a point cloud, without reading the whole file again.
+   */
+  class PccTiledFile
+  {
+  public:
+    PccTiledFile();
+    ~PccTiledFile();
+
+    //! Parse the header of a binary_little_endian file
+    int open( const string &inFile );
+
+    //! Whether the file has normals (nx, ny, nz)
+    bool hasNormals();
+
+    //! Widen [xMin, xMax] to the x coordinates of the points
+    int rangeX( float &xMin, float &xMax );
+
+    //! Add the number of points of every one of the counts.size() bins of [xMin, xMax]
+    int histogramX( float xMin, float xMax, vector<long int> &counts );
+
+    //! Write the records of every bucket in the temporary file of "dir" (the
+    //! system temporary directory if empty). binBucket gives the bucket of
+    //! every bin of [xMin, xMax], in increasing order
+    int partition( float xMin, float xMax, const vector<uint32_t> &binBucket, const string &dir );
+
+    //! Number of points of a bucket
+    long int bucketSize( size_t bucket ) const { return bucketCounts[bucket]; }
+
+    //! PccPointCloud::load() of the points of the buckets [first, last)
+    int loadBuckets( size_t first, size_t last, PccPointCloud &cloud, bool normalsOnly,
+                     int dropDuplicates, int neighborsProc, int attributes ) const;
+
+    //! Bin of the x coordinate, among nbBins bins of [xMin, xMax]
+    static size_t binOf( float x, float xMin, float xMax, size_t nbBins );
+
+  private:
+    string fileName;
+    vector<unsigned char> header;            //! header section, up to the vertex data
+    PccPointCloud schema;                    //! fields of the header
+    int xField;                              //! index of the x field
+    FILE *spill;                             //! temporary file of the buckets
+    vector<long int> bucketCounts;           //! number of points of every bucket
+    vector< vector< pair<uint64_t, long int> > > bucketSegments;  //! (offset, number of points) of the segments of every bucket
+
+    template <typename Body>
+    int forEachChunk( const Body &body );
+  };
+
+}
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+#include "pcc_voxelgrid.hpp"
+
+using namespace std;
+using namespace pcc_processing;
+
+// The cell size is the smallest power of 2 giving at least this number of
+// points per occupied cell, on average
+#define GRID_CELL_POINTS 8
+
+// Number of shells of cells searched around the cell of the query, before
+// giving up (the kd-tree is used then)
+#define GRID_MAX_SHELLS 3
+
+// Maximum number of bits of the coordinates, per axis (63 bits Morton codes)
+#define GRID_COORD_BITS 21
+
+/*
+ ***********************************************
+   Implementation of local functions
+ ***********************************************
+ */
+
+/**!
+ * \brief
+ *  Spread the 21 low bits of v, 2 zero bits between each of them
+ */
+static inline uint64_t
+spreadBits( uint64_t v )
+{
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8)  & 0x100f00f00f00f00full;
+  v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2)  & 0x1249249249249249ull;
+  return v;
+}
+
+static inline uint64_t
+mortonCode( int64_t x, int64_t y, int64_t z )
+{
+  return (spreadBits( x ) << 2) | (spreadBits( y ) << 1) | spreadBits( z );
+}
+
+// floor( v / 2^bits ), for negative values as well
+static inline int64_t
+floorShift( int64_t v, int bits )
+{
+  return v >= 0 ? v >> bits : -((-v - 1) >> bits) - 1;
+}
+
+struct MortonRecord
+{
+  uint64_t key;                 //! Morton code of the voxel
+  index_type idx;               //! index of the point in the cloud
+};
+
+/*
+ ***********************************************
+   Implementation of exposed functions and classes
+ ***********************************************
+ */
+
+/**!
+ * **************************************
+ *  Class PointVoxelGrid
+ * **************************************
+ */
+
+/**!
+ * \brief
+ *  Build the grid over the n points of the cloud, which must have integer
+ *  coordinates spanning less than 2^21 along every axis
+ *  (PccPointCloud::bVoxelized)
+ */
+PointVoxelGrid::PointVoxelGrid( const PointXYZSet &cloud, long int n )
+{
+  float minX = numeric_limits<float>::max(), minY = minX, minZ = minX;
+#pragma omp parallel for reduction(min:minX,minY,minZ)
+  for (long int i = 0; i < n; i++)
+  {
+    const PointXYZSet::point_type p = cloud.point( i );
+    minX = min( minX, p[0] );
+    minY = min( minY, p[1] );
+    minZ = min( minZ, p[2] );
+  }
+  origin[0] = int64_t( minX );
+  origin[1] = int64_t( minY );
+  origin[2] = int64_t( minZ );
+
+  // Voxels in Morton order: every cell, whatever its size, is then a run
+  vector<MortonRecord> rec( n );
+  int64_t maxX = 0, maxY = 0, maxZ = 0;
+#pragma omp parallel for reduction(max:maxX,maxY,maxZ)
+  for (long int i = 0; i < n; i++)
+  {
+    const PointXYZSet::point_type p = cloud.point( i );
+    const int64_t x = int64_t( p[0] ) - origin[0];
+    const int64_t y = int64_t( p[1] ) - origin[1];
+    const int64_t z = int64_t( p[2] ) - origin[2];
+    rec[i].key = mortonCode( x, y, z );
+    rec[i].idx = index_type( i );
+    maxX = max( maxX, x );
+    maxY = max( maxY, y );
+    maxZ = max( maxZ, z );
+  }
+  radixSort( rec, 1, 64, []( const MortonRecord &r, int ) { return r.key; } );
+
+  // Cell size
+  for (cellBits = 0; cellBits < GRID_COORD_BITS; cellBits++)
+  {
+    const int shift = 3 * cellBits;
+    long int nbRuns = 0;
+#pragma omp parallel for reduction(+:nbRuns)
+    for (long int i = 0; i < n; i++)
+      nbRuns += (i == 0 || (rec[i].key >> shift) != (rec[i - 1].key >> shift));
+    if (n >= GRID_CELL_POINTS * nbRuns)
+      break;
+  }
+  const int shift = 3 * cellBits;
+  nbCells[0] = (maxX >> cellBits) + 1;
+  nbCells[1] = (maxY >> cellBits) + 1;
+  nbCells[2] = (maxZ >> cellBits) + 1;
+
+  // Points by cell, and the cell of every Morton code in the hash table
+  const bool bShort = max( maxX, max( maxY, maxZ ) ) <= numeric_limits<uint16_t>::max();
+  if (bShort)
+    points16.resize( n );
+  else
+    points32.resize( n );
+  pointIdx.resize( n );
+#pragma omp parallel for
+  for (long int i = 0; i < n; i++)
+  {
+    const PointXYZSet::point_type p = cloud.point( rec[i].idx );
+    for (int a = 0; a < 3; a++)
+    {
+      const int64_t offset = int64_t( p[a] ) - origin[a];
+      if (bShort)
+        points16[i][a] = uint16_t( offset );
+      else
+        points32[i][a] = uint32_t( offset );
+    }
+    pointIdx[i] = rec[i].idx;
+  }
+
+  for (long int i = 0; i < n; i++)
+    if (i == 0 || (rec[i].key >> shift) != (rec[i - 1].key >> shift))
+      cellStart.push_back( uint32_t( i ) );
+  cellStart.push_back( uint32_t( n ) );
+
+  const size_t nbCellsUsed = cellStart.size() - 1;
+  size_t nbSlots = 16;
+  while (nbSlots < 2 * nbCellsUsed)
+    nbSlots *= 2;
+  slotKeys.assign( nbSlots, ~0ull );
+  slotCells.resize( nbSlots );
+  for (size_t c = 0; c < nbCellsUsed; c++)
+  {
+    const uint64_t key = rec[cellStart[c]].key >> shift;
+    size_t s = (key * 0x9e3779b97f4a7c15ull) & (nbSlots - 1);
+    while (slotKeys[s] != ~0ull)
+      s = (s + 1) & (nbSlots - 1);
+    slotKeys[s] = key;
+    slotCells[s] = uint32_t( c );
+  }
+}
+
+/**!
+ * \brief
+ *  Cell number of the Morton code of a cell, null if the cell is empty
+ */
+const uint32_t *
+PointVoxelGrid::findCell( uint64_t key ) const
+{
+  const size_t mask = slotKeys.size() - 1;
+  for (size_t s = (key * 0x9e3779b97f4a7c15ull) & mask; slotKeys[s] != ~0ull; s = (s + 1) & mask)
+    if (slotKeys[s] == key)
+      return &slotCells[s];
+  return nullptr;
+}
+
+size_t
+PointVoxelGrid::queryTies( const float *query, size_t capacity, distance_type eps,
+                           index_type *indices, distance_type *sqrDist ) const
+{
+  if (!points16.empty())
+    return queryTies( points16, query, capacity, eps, indices, sqrDist );
+  return queryTies( points32, query, capacity, eps, indices, sqrDist );
+}
+
+/**!
+ * \brief
+ *  The shells of cells around the cell of the query are searched until no
+ *  point beyond the searched cells can be closer than the worst distance of
+ *  the result set. Cells farther than this distance are skipped. As with
+ *  the kd-tree, a point is added only if it is closer than the worst
+ *  distance: the result set then keeps the same points.
+ */
+template <typename T>
+size_t
+PointVoxelGrid::queryTies( const vector<std::array<T, 3>> &points, const float *query, size_t capacity,
+                           distance_type eps, index_type *indices, distance_type *sqrDist ) const
+{
+  nanoflann::NearestTiesResultSet<distance_type, index_type> result( capacity, eps );
+  result.init( indices, sqrDist );
+
+  const int64_t cellSize = int64_t( 1 ) << cellBits;
+  int64_t v[3];                 // voxel of the query, in the grid
+  int64_t c[3];                 // cell of the query
+  for (int a = 0; a < 3; a++)
+  {
+    v[a] = int64_t( query[a] ) - origin[a];
+    c[a] = floorShift( v[a], cellBits );
+  }
+
+  auto searchCell = [&]( int64_t cx, int64_t cy, int64_t cz )
+  {
+    const int64_t cell[3] = { cx, cy, cz };
+    distance_type boxDist = 0;
+    for (int a = 0; a < 3; a++)
+    {
+      if (cell[a] < 0 || cell[a] >= nbCells[a])
+        return;
+      const int64_t lo = cell[a] * cellSize;
+      const int64_t hi = lo + cellSize - 1;
+      const int64_t d = v[a] < lo ? lo - v[a] : (v[a] > hi ? v[a] - hi : 0);
+      boxDist += distance_type( d ) * d;
+    }
+    if (boxDist >= result.worstDist())
+      return;
+    const uint32_t *cellNum = findCell( mortonCode( cx, cy, cz ) );
+    if (!cellNum)
+      return;
+    for (uint32_t k = cellStart[*cellNum]; k < cellStart[*cellNum + 1]; k++)
+    {
+      // Same distance as nanoflann::L2_Adaptor: the differences are below
+      // (GRID_MAX_SHELLS + 1) * 2^GRID_COORD_BITS = 2^23, and the sum of their
+      // squares below 2^48, all exact in float and double as well
+      const int64_t d0 = v[0] - int64_t( points[k][0] );
+      const int64_t d1 = v[1] - int64_t( points[k][1] );
+      const int64_t d2 = v[2] - int64_t( points[k][2] );
+      const distance_type dist = distance_type( d0 * d0 + d1 * d1 + d2 * d2 );
+      if (dist < result.worstDist())
+        result.addPoint( dist, pointIdx[k] );
+    }
+  };
+
+  for (int r = 0; ; r++)
+  {
+    if (r > 0)
+    {
+      // Distance from the query to the cells beyond the shells searched
+      int64_t gap = numeric_limits<int64_t>::max();
+      for (int a = 0; a < 3; a++)
+        gap = min( gap, min( v[a] - (c[a] - r + 1) * cellSize + 1, (c[a] + r) * cellSize - v[a] ) );
+      if (distance_type( gap ) * gap >= result.worstDist())
+        return result.size();
+    }
+    if (r > GRID_MAX_SHELLS)
+      return 0;
+
+    for (int dx = -r; dx <= r; dx++)
+      for (int dy = -r; dy <= r; dy++)
+      {
+        const bool bFace = abs( dx ) == r || abs( dy ) == r;
+        for (int dz = -r; dz <= r; dz += bFace ? 1 : 2 * r)
+          searchCell( c[0] + dx, c[1] + dy, c[2] + dz );
+      }
+  }
+}
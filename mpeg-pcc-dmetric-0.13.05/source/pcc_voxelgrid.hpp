@@ -0,0 +1,101 @@
+/*
+ * Software License Agreement
+ *
+ *  Point to plane metric for point cloud distortion measurement
+ *  Copyright (c) 2016, MERL
+ *
+ *  All rights reserved.
+ *
+ *  Contributors:
+ *    Dong Tian <tian@merl.com>
+ *    Maja Krivokuca <majakri01@gmail.com>
+ *    Phil Chou <philchou@msn.com>
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PCC_VOXELGRID_HPP
+#define PCC_VOXELGRID_HPP
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "pcc_processing.hpp"
+
+namespace pcc_processing {
+
+  /**!
+   * \brief
+   *  Nearest neighbor search for voxelized point clouds (integer
+   *  coordinates). The points are grouped in cubic cells of a sparse grid,
+   *  found through a hash table of the occupied cells, and searched in
+   *  shells of cells around the query.
+   *
+   *  The results are exactly those of my_kd_tree_t::queryTies(): the
+   *  distances are computed in the same way, and the ties are ordered by
+   *  index whatever the order of the search.
+   *
+   *  The points are stored as offsets from the minimum coordinates, on 16
+   *  bits if they span less than 2^16 along every axis, on 32 bits
+   *  otherwise, and their distances to the query are computed with
+   *  integers (exact, as are the double distances of the kd-tree).
+   */
+  class PointVoxelGrid
+  {
+  public:
+    PointVoxelGrid( const PointXYZSet &points, long int n );
+
+    //! Same as my_kd_tree_t::queryTies(), for a query with integer
+    //! coordinates. Returns 0 if the nearest point is too far from the
+    //! query to be found in the grid: use the kd-tree then.
+    size_t queryTies( const float *query, size_t capacity, distance_type eps,
+                      index_type *indices, distance_type *sqrDist ) const;
+
+  private:
+    int cellBits;                            //! log2 of the cell size
+    int64_t origin[3];                       //! minimum coordinates
+    int64_t nbCells[3];                      //! number of cells along each axis
+    vector<uint64_t> slotKeys;               //! hash table: Morton code of the cell
+    vector<uint32_t> slotCells;              //! hash table: cell number
+    vector<uint32_t> cellStart;              //! first point of each cell, and the end
+    vector<std::array<uint16_t, 3>> points16; //! points, by cell, if they span less than 2^16
+    vector<std::array<uint32_t, 3>> points32; //! points, by cell, otherwise
+    vector<index_type> pointIdx;             //! index of the points in the cloud
+
+    const uint32_t *findCell( uint64_t key ) const;
+
+    template <typename T>
+    size_t queryTies( const vector<std::array<T, 3>> &points, const float *query, size_t capacity,
+                      distance_type eps, index_type *indices, distance_type *sqrDist ) const;
+  };
+
+}
+
+#endif
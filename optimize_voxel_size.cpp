@@ -27,13 +27,13 @@
 
 #include <Open3D.h>
 
+#include "spacing_estimator.h"
+
 using namespace open3d;
 using namespace std;
 
 #define BIG_NUMBER 1000000000 // 1bi points max
 
-#define KNN 9 // get 8-NN plus the own point
-
 int main(int argc, char *argv[])
 {
     int pc_number = 0;
@@ -42,7 +42,6 @@ int main(int argc, char *argv[])
     double voxel_size = 0;
     double knob1 = 0.6;
     int voxel_strategy = 1;
-    int knn = KNN;
 
     if (argc < 3)
     {
@@ -89,58 +88,15 @@ int main(int argc, char *argv[])
 
     kdtree.SetGeometry(*pc[min_pc_index]);
 
-    if (voxel_strategy == 2)
+    // mean NN (strategy 2) or k-NN (strategy 3) distance, estimated from a
+    // stratified sample of the points
+    if (voxel_strategy == 2 || voxel_strategy == 3)
     {
-#pragma omp parallel for num_threads(32) reduction(+:average_dist) schedule(dynamic,1000)
-        for (size_t i = 0; i < pc[min_pc_index]->points_.size(); i++)
-        {
-            std::vector<int> indices_vec(2);
-            std::vector<double> dists_vec(2);
-
-            kdtree.SearchKNN(pc[min_pc_index]->points_[i], 2, indices_vec, dists_vec);
-
-            Eigen::Vector3d point_close = pc[min_pc_index]->points_[i];
-            Eigen::Vector3d point_distant = pc[min_pc_index]->points_[indices_vec[1]];
-
-            double dist = sqrt ( (pow((point_distant[0] - point_close[0]), 2)) +
-                                 (pow((point_distant[1] - point_close[1]), 2)) +
-                                 (pow((point_distant[2] - point_close[2]), 2)) );
+        spacing_estimate est = estimate_mean_spacing(*pc[min_pc_index], kdtree, voxel_strategy_knn(voxel_strategy));
 
-            // #pragma omp atomic
-            average_dist += dist;
-        }
-        average_dist /= pc[min_pc_index]->points_.size();
-    }
-
-
-    if (voxel_strategy == 3)
-    {
-#pragma omp parallel for num_threads(32) reduction(+:average_dist) schedule(dynamic,1000)
-        for (size_t i = 0; i < pc[min_pc_index]->points_.size(); i++)
-        {
-            std::vector<int> indices_vec(knn);
-            std::vector<double> dists_vec(knn);
-
-            kdtree.SearchKNN(pc[min_pc_index]->points_[i], knn, indices_vec, dists_vec);
-
-            Eigen::Vector3d points[knn];
-            for (int j = 0; j < knn; j++)
-            {
-                points[j] = pc[min_pc_index]->points_[indices_vec[j]];
-            }
-
-            double dist = 0;
-            for (int j = 1; j < knn; j++)
-            {
-                dist += sqrt ( (pow((points[j][0] - points[0][0]), 2)) +
-                                     (pow((points[j][1] - points[0][1]), 2)) +
-                                     (pow((points[j][2] - points[0][2]), 2)) );
-            }
-            dist /= (knn - 1);
-            // #pragma omp atomic
-            average_dist += dist;
-        }
-        average_dist /= pc[min_pc_index]->points_.size();
+        average_dist = est.mean;
+        fprintf(stderr, "average distance = %0.16f (95%% CI [%0.16f, %0.16f], %zu of %zu points queried)\n",
+                est.mean, est.ci_low, est.ci_high, est.samples, pc[min_pc_index]->points_.size());
     }
 
 
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2019-2021 Rafael Diniz <rafael@riseup.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+/*
+ * Sampled estimator of the mean k-NN distance (point spacing) of a PC.
+ *
+ * Instead of querying the kd-tree for every point, the points are ordered
+ * along a coarse Morton-ordered grid and split in "n" contiguous strata of
+ * (almost) equal size, each one holding a single random sample. When the
+ * confidence interval of the mean is still wider than the requested relative
+ * tolerance, every stratum is split in two halves and only the half without
+ * a sample gets a new query, so all previous queries are reused. The
+ * variance is estimated pairing neighbour strata (collapsed strata).
+ *
+ * Small PCs, or a refinement reaching the PC size, fall back to the exact
+ * full-cloud computation.
+ */
+
+#ifndef __SPACING_ESTIMATOR
+#define __SPACING_ESTIMATOR
+
+#include <cstdint>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <Open3D.h>
+
+#define SPACING_REL_TOL 0.005 // half width of the interval, relative to the mean
+#define SPACING_CONFIDENCE_Z 1.96 // 95% confidence interval
+#define SPACING_MIN_SAMPLES 256 // initial number of strata (power of 2)
+#define SPACING_GRID_BITS 6 // 64x64x64 grid used for the stratification
+#define SPACING_SEED 0x5eed
+
+#define SPACING_KNN 9 // 8-NN plus the own point, as used by voxelization strategy 3
+
+struct spacing_estimate
+{
+    double mean; // estimated mean distance to the k-NN
+    double ci_low; // confidence interval lower bound
+    double ci_high; // confidence interval upper bound
+    size_t samples; // number of kd-tree queries issued
+    bool exact; // all points were queried, interval is collapsed to the mean
+};
+
+// mean distance from point "i" to its (knn - 1) nearest neighbours,
+// index 0 of the search being the own point
+static inline double point_knn_spacing(const open3d::geometry::PointCloud &pc,
+                                       const open3d::geometry::KDTreeFlann &kdtree,
+                                       size_t i, int knn)
+{
+    std::vector<int> indices_vec(knn);
+    std::vector<double> dists_vec(knn);
+
+    kdtree.SearchKNN(pc.points_[i], knn, indices_vec, dists_vec);
+
+    double dist = 0;
+    for (int j = 1; j < knn; j++)
+        dist += sqrt(dists_vec[j]);
+
+    return dist / (knn - 1);
+}
+
+static inline uint32_t spacing_morton_spread(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// point indexes ordered by the Morton code of their grid cell (counting sort)
+static inline std::vector<size_t> spacing_stratified_order(const open3d::geometry::PointCloud &pc)
+{
+    const size_t n_points = pc.points_.size();
+    const int cells = 1 << SPACING_GRID_BITS;
+
+    Eigen::Vector3d min_bound = pc.points_[0];
+    Eigen::Vector3d max_bound = pc.points_[0];
+    for (size_t i = 1; i < n_points; i++)
+    {
+        min_bound = min_bound.cwiseMin(pc.points_[i]);
+        max_bound = max_bound.cwiseMax(pc.points_[i]);
+    }
+
+    double scale[3];
+    for (int d = 0; d < 3; d++)
+    {
+        double extent = max_bound[d] - min_bound[d];
+        scale[d] = (extent > 0) ? (cells - 1) / extent : 0;
+    }
+
+    std::vector<uint32_t> key(n_points);
+    std::vector<size_t> bucket(((size_t) 1 << (3 * SPACING_GRID_BITS)) + 1, 0);
+
+    for (size_t i = 0; i < n_points; i++)
+    {
+        uint32_t c[3];
+        for (int d = 0; d < 3; d++)
+            c[d] = (uint32_t) ((pc.points_[i][d] - min_bound[d]) * scale[d]);
+        key[i] = spacing_morton_spread(c[0]) | (spacing_morton_spread(c[1]) << 1) | (spacing_morton_spread(c[2]) << 2);
+        bucket[key[i] + 1]++;
+    }
+
+    for (size_t b = 1; b < bucket.size(); b++)
+        bucket[b] += bucket[b - 1];
+
+    std::vector<size_t> order(n_points);
+    for (size_t i = 0; i < n_points; i++)
+        order[bucket[key[i]]++] = i;
+
+    return order;
+}
+
+static inline spacing_estimate exact_mean_spacing(const open3d::geometry::PointCloud &pc,
+                                                  const open3d::geometry::KDTreeFlann &kdtree,
+                                                  int knn)
+{
+    spacing_estimate est;
+    double average_dist = 0;
+
+#pragma omp parallel for reduction(+:average_dist) schedule(dynamic,1000)
+    for (size_t i = 0; i < pc.points_.size(); i++)
+        average_dist += point_knn_spacing(pc, kdtree, i, knn);
+
+    est.mean = est.ci_low = est.ci_high = average_dist / pc.points_.size();
+    est.samples = pc.points_.size();
+    est.exact = true;
+    return est;
+}
+
+/*
+ * Estimate the mean distance of each point to its (knn - 1) nearest neighbours
+ * ("knn" counts the own point, as in the kd-tree search), stopping as soon as
+ * the confidence interval half width is below "rel_tol" times the mean.
+ */
+static inline spacing_estimate estimate_mean_spacing(const open3d::geometry::PointCloud &pc,
+                                                     const open3d::geometry::KDTreeFlann &kdtree,
+                                                     int knn, double rel_tol = SPACING_REL_TOL,
+                                                     uint64_t seed = SPACING_SEED)
+{
+    const size_t n_points = pc.points_.size();
+
+    if (n_points < 4 * SPACING_MIN_SAMPLES)
+        return exact_mean_spacing(pc, kdtree, knn);
+
+    std::vector<size_t> order = spacing_stratified_order(pc);
+    std::mt19937_64 rng(seed);
+
+    // stratum "k" of "n" covers positions [k * N / n, (k + 1) * N / n) of "order"
+    auto stratum_begin = [n_points](size_t k, size_t n) { return k * n_points / n; };
+
+    size_t n = SPACING_MIN_SAMPLES;
+    std::vector<size_t> pos(n);
+    std::vector<double> value(n);
+    std::vector<size_t> pending; // strata (at the current level) still to be queried
+
+    for (size_t k = 0; k < n; k++)
+    {
+        size_t lo = stratum_begin(k, n), hi = stratum_begin(k + 1, n);
+        pos[k] = lo + rng() % (hi - lo);
+        pending.push_back(k);
+    }
+
+    spacing_estimate est;
+    est.samples = 0;
+    est.exact = false;
+
+    while (true)
+    {
+#pragma omp parallel for schedule(dynamic,16)
+        for (size_t p = 0; p < pending.size(); p++)
+        {
+            size_t k = pending[p];
+            value[k] = point_knn_spacing(pc, kdtree, order[pos[k]], knn);
+        }
+        est.samples += pending.size();
+
+        double sum = 0, var = 0;
+        for (size_t k = 0; k < n; k++)
+            sum += value[k] * (stratum_begin(k + 1, n) - stratum_begin(k, n));
+        for (size_t k = 0; k < n; k += 2)
+            var += (value[k] - value[k + 1]) * (value[k] - value[k + 1]);
+
+        est.mean = sum / n_points;
+        double half_width = SPACING_CONFIDENCE_Z * sqrt(var) / n;
+        est.ci_low = est.mean - half_width;
+        est.ci_high = est.mean + half_width;
+
+        if (half_width <= rel_tol * est.mean)
+            return est;
+
+        if (2 * n > n_points / 2)
+            break;
+
+        // split every stratum, sampling only the half without a sample
+        std::vector<size_t> pos2(2 * n);
+        std::vector<double> value2(2 * n);
+        pending.clear();
+        for (size_t k = 0; k < n; k++)
+        {
+            size_t mid = stratum_begin(2 * k + 1, 2 * n);
+            size_t kept = (pos[k] < mid) ? 2 * k : 2 * k + 1;
+            size_t other = (pos[k] < mid) ? 2 * k + 1 : 2 * k;
+            size_t lo = stratum_begin(other, 2 * n), hi = stratum_begin(other + 1, 2 * n);
+
+            pos2[kept] = pos[k];
+            value2[kept] = value[k];
+            pos2[other] = lo + rng() % (hi - lo);
+            pending.push_back(other);
+        }
+        pos.swap(pos2);
+        value.swap(value2);
+        n *= 2;
+    }
+
+    return exact_mean_spacing(pc, kdtree, knn);
+}
+
+// kd-tree search size for the voxelization strategies: 2 (average NN) and 3 (average k-NN)
+static inline int voxel_strategy_knn(int voxel_strategy)
+{
+    return (voxel_strategy == 2) ? 2 : SPACING_KNN;
+}
+
+#endif /* __SPACING_ESTIMATOR */